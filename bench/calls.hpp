@@ -0,0 +1,114 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_BENCH_CALLS_HPP
+#define DBUS_BENCH_CALLS_HPP
+
+#include <dbus/connection.hpp>
+#include <dbus/message.hpp>
+#include <results.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <boost/asio.hpp>
+
+/// The size m marshals to, header included.
+inline std::uint64_t marshalled_size(const dbus::message& m) {
+  dbus::message copy = dbus::message::new_copy(m);
+  char* data = nullptr;
+  int size = 0;
+  if (!dbus_message_marshal(copy, &data, &size)) {
+    return 0;
+  }
+  dbus_free(data);
+  return static_cast<std::uint64_t>(size);
+}
+
+/// Latencies of a run of calls, and how long it took.
+struct calls_run {
+  typedef std::chrono::steady_clock clock;
+
+  std::vector<clock::duration> latencies;
+  clock::duration elapsed;
+  std::uint64_t errors = 0;
+  std::uint64_t reply_bytes = 0;
+
+  double per_second() const {
+    return latencies.size() / std::chrono::duration<double>(elapsed).count();
+  }
+};
+
+/// Make calls copies of prototype, keeping concurrency of them in flight.
+inline calls_run async_calls(boost::asio::io_service& io,
+                             dbus::connection& bus,
+                             const dbus::message& prototype,
+                             std::size_t concurrency, std::size_t calls) {
+  typedef calls_run::clock clock;
+  calls_run run;
+  run.latencies.reserve(calls);
+  std::size_t issued = 0;
+  std::function<void()> issue = [&]() {
+    issued++;
+    dbus::message m = dbus::message::new_copy(prototype);
+    clock::time_point start = clock::now();
+    bus.async_send(m, [&, start](boost::system::error_code ec,
+                                 dbus::message reply) {
+      run.latencies.push_back(clock::now() - start);
+      if (ec) {
+        run.errors++;
+      } else if (run.reply_bytes == 0) {
+        run.reply_bytes = marshalled_size(reply);
+      }
+      if (issued < calls) {
+        issue();
+      } else if (run.latencies.size() == calls) {
+        io.stop();
+      }
+    });
+  };
+
+  clock::time_point start = clock::now();
+  for (std::size_t i = 0; i < std::min(concurrency, calls); i++) {
+    issue();
+  }
+  io.run();
+  io.reset();
+  run.elapsed = clock::now() - start;
+  return run;
+}
+
+/// Make calls copies of prototype, one after another, blocking on each.
+inline calls_run blocking_calls(dbus::connection& bus,
+                                const dbus::message& prototype,
+                                std::size_t calls) {
+  typedef calls_run::clock clock;
+  calls_run run;
+  run.latencies.reserve(calls);
+  clock::time_point begin = clock::now();
+  for (std::size_t i = 0; i < calls; i++) {
+    dbus::message m = dbus::message::new_copy(prototype);
+    clock::time_point start = clock::now();
+    try {
+      bus.send(m);
+    } catch (const boost::system::system_error&) {
+      run.errors++;
+    }
+    run.latencies.push_back(clock::now() - start);
+  }
+  run.elapsed = clock::now() - begin;
+  return run;
+}
+
+/// Add run's throughput and latencies to r, and print it.
+inline void print(result& r, calls_run& run) {
+  r.add("errors", run.errors)
+      .add("calls_per_sec", run.per_second())
+      .add_latencies(run.latencies)
+      .print();
+}
+
+#endif  // DBUS_BENCH_CALLS_HPP
@@ -0,0 +1,207 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// End-to-end benchmarks through a private dbus-daemon.
+//
+//   dbus_e2e_bench [calls]
+//
+// Starts its own daemon, serves a DbusObjectServer from a second thread and
+// measures, from a client connection:
+//
+// - method_call: round-trip latency with 1 to 64 calls in flight
+// - send: async_send against blocking send, one call at a time
+// - signal_fanout: signals per second delivered to 1 to 16 subscribers
+// - properties: Get, GetAll and GetManagedObjects, with reply sizes
+//
+// Each measurement is printed to stdout as a line of JSON; see results.hpp.
+
+#include <dbus/connection.hpp>
+#include <dbus/endpoint.hpp>
+#include <dbus/filter.hpp>
+#include <dbus/match.hpp>
+#include <dbus/properties.hpp>
+#include <dbus/signal_subscription.hpp>
+#include <calls.hpp>
+#include <private_bus.hpp>
+#include <results.hpp>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+namespace {
+
+typedef std::chrono::steady_clock clock;
+
+const char* bench_path = "/org/boost/bench";
+const char* bench_interface = "org.boost.bench.Echo";
+
+/// The service end, run on a thread of its own.
+class server {
+ public:
+  server(const std::string& address, std::size_t objects)
+      : work_(io_),
+        conn_(std::make_shared<dbus::connection>(io_, address)),
+        objects_(conn_) {
+    auto object = objects_.add_object(bench_path);
+    auto echo = object->add_interface(bench_interface);
+    echo->register_method("Echo", [](uint32_t x) { return x; });
+    tick_ = echo->register_signal<uint32_t>("Tick", {"value"});
+    for (uint32_t i = 0; i < 10; i++) {
+      echo->set_property("Property" + std::to_string(i), i);
+    }
+
+    // Something for GetManagedObjects to return
+    dbus::DbusObjectServer::transaction tx(objects_);
+    for (std::size_t i = 0; i < objects; i++) {
+      auto child = tx.add_object(std::string(bench_path) + "/objects/" +
+                                 std::to_string(i));
+      for (int j = 0; j < 2; j++) {
+        auto iface = child->add_interface("org.boost.bench.Child" +
+                                          std::to_string(j));
+        for (uint32_t k = 0; k < 5; k++) {
+          iface->set_property("Property" + std::to_string(k), k);
+        }
+      }
+    }
+    tx.commit();
+
+    thread_ = std::thread([this]() { io_.run(); });
+  }
+
+  ~server() {
+    io_.stop();
+    thread_.join();
+  }
+
+  std::string name() { return conn_->get_unique_name(); }
+
+  /// Broadcast n Tick signals, from the server's thread.
+  void emit(std::size_t n) {
+    io_.post([this, n]() {
+      for (std::size_t i = 0; i < n; i++) {
+        tick_->send(static_cast<uint32_t>(i));
+      }
+    });
+  }
+
+ private:
+  boost::asio::io_service io_;
+  boost::asio::io_service::work work_;
+  std::shared_ptr<dbus::connection> conn_;
+  dbus::DbusObjectServer objects_;
+  std::shared_ptr<dbus::DbusTemplateSignal<uint32_t>> tick_;
+  std::thread thread_;
+};
+
+void signal_fanout(boost::asio::io_service& io, const std::string& address,
+                   server& s, std::size_t subscribers, std::size_t signals) {
+  std::size_t expected = subscribers * signals;
+  std::size_t received = 0;
+  std::vector<std::unique_ptr<dbus::signal_subscription>> subscriptions;
+  for (std::size_t i = 0; i < subscribers; i++) {
+    auto c = std::make_shared<dbus::connection>(io, address);
+    subscriptions.emplace_back(new dbus::signal_subscription(
+        c, "type='signal',interface='org.boost.bench.Echo',member='Tick'",
+        [](dbus::message& m) { return m.get_member_view() == "Tick"; },
+        [&](dbus::message&) {
+          if (++received == expected) {
+            io.stop();
+          }
+        }));
+  }
+
+  // Don't wait forever if the daemon drops some
+  boost::asio::steady_timer timeout(io, std::chrono::seconds(60));
+  timeout.async_wait([&](boost::system::error_code ec) {
+    if (!ec) {
+      io.stop();
+    }
+  });
+
+  clock::time_point start = clock::now();
+  s.emit(signals);
+  io.run();
+  clock::duration elapsed = clock::now() - start;
+  timeout.cancel();
+  io.run();
+  io.reset();
+
+  double seconds = std::chrono::duration<double>(elapsed).count();
+  result("signal_fanout")
+      .add("subscribers", static_cast<std::uint64_t>(subscribers))
+      .add("signals", static_cast<std::uint64_t>(signals))
+      .add("received", static_cast<std::uint64_t>(received))
+      .add("elapsed", elapsed)
+      .add("signals_per_sec", signals / seconds)
+      .add("deliveries_per_sec", received / seconds)
+      .print();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t calls = argc > 1 ? std::stoul(argv[1]) : 10000;
+
+  private_bus daemon;
+  server s(daemon.address(), 100);
+  boost::asio::io_service io;
+  auto bus = std::make_shared<dbus::connection>(io, daemon.address());
+
+  dbus::message echo = dbus::message::new_call(
+      dbus::endpoint(s.name(), bench_path, bench_interface, "Echo"));
+  echo.pack(uint32_t(7));
+
+  // Warm up both ends
+  async_calls(io, *bus, echo, 1, 100);
+
+  for (std::size_t concurrency : {1, 4, 16, 64}) {
+    calls_run run = async_calls(io, *bus, echo, concurrency, calls);
+    result r("method_call");
+    r.add("concurrency", static_cast<std::uint64_t>(concurrency));
+    print(r, run);
+  }
+
+  {
+    calls_run run = async_calls(io, *bus, echo, 1, calls);
+    result r("send");
+    r.add("mode", "async");
+    print(r, run);
+  }
+  {
+    calls_run run = blocking_calls(*bus, echo, calls);
+    result r("send");
+    r.add("mode", "blocking");
+    print(r, run);
+  }
+
+  for (std::size_t subscribers : {1, 4, 16}) {
+    signal_fanout(io, daemon.address(), s, subscribers, calls);
+  }
+
+  dbus::endpoint properties(s.name(), bench_path,
+                            "org.freedesktop.DBus.Properties", "");
+  dbus::message get = dbus::message::new_call(properties, "Get");
+  get.pack(bench_interface, "Property3");
+  dbus::message get_all = dbus::message::new_call(properties, "GetAll");
+  get_all.pack(bench_interface);
+  dbus::message get_managed_objects = dbus::message::new_call(
+      dbus::endpoint(s.name(), "/", "org.freedesktop.DBus.ObjectManager",
+                     "GetManagedObjects"));
+
+  for (auto& method :
+       {std::make_pair("Get", get), std::make_pair("GetAll", get_all),
+        std::make_pair("GetManagedObjects", get_managed_objects)}) {
+    calls_run run = async_calls(io, *bus, method.second, 1, calls);
+    result r("properties");
+    r.add("method", method.first).add("reply_bytes", run.reply_bytes);
+    print(r, run);
+  }
+  return 0;
+}
@@ -0,0 +1,263 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Marshalling microbenchmarks.  None of them needs a bus: messages are built,
+// packed and unpacked in memory.  Each reports time per operation, bytes
+// per second (by the size the message marshals to) and allocs/op, which
+// counts libdbus's mallocs as well as ours.
+//
+// Packing appends to a message, so the pack benchmarks build a fresh call
+// each iteration; NewCall is the cost to subtract.
+
+#include <dbus/message.hpp>
+#include <allocation_counter.hpp>
+#include <string>
+#include <utility>
+#include <vector>
+#include <benchmark/benchmark.h>
+
+namespace {
+
+typedef std::vector<std::pair<std::string, dbus::dbus_variant>> properties;
+typedef std::vector<std::pair<std::string, properties>> interfaces;
+typedef std::vector<std::pair<dbus::object_path, interfaces>> managed_objects;
+typedef std::vector<std::vector<std::vector<std::vector<dbus::int32>>>>
+    nested;
+
+const dbus::endpoint target("org.boost.bench", "/org/boost/bench/object",
+                            "org.boost.bench.Interface", "Method");
+
+/// Reports the allocations made while it's in scope as allocs/op.
+class allocations_per_op {
+ public:
+  explicit allocations_per_op(benchmark::State& state) : state_(state) {}
+
+  ~allocations_per_op() {
+    state_.counters["allocs/op"] =
+        benchmark::Counter(static_cast<double>(counted_.allocations()),
+                           benchmark::Counter::kAvgIterations);
+  }
+
+ private:
+  benchmark::State& state_;
+  allocation_counter::scope counted_;
+};
+
+std::size_t marshalled_size(const dbus::message& m) {
+  // Marshalling locks the message, so measure a copy
+  dbus::message copy = dbus::message::new_copy(m);
+  char* data = nullptr;
+  int size = 0;
+  if (!dbus_message_marshal(copy, &data, &size)) {
+    return 0;
+  }
+  dbus_free(data);
+  return static_cast<std::size_t>(size);
+}
+
+template <typename... Args>
+dbus::message packed(const Args&... args) {
+  dbus::message m = dbus::message::new_call(target);
+  m.pack(args...);
+  return m;
+}
+
+void set_bytes(benchmark::State& state, const dbus::message& m) {
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(marshalled_size(m)));
+}
+
+std::vector<std::string> strings(std::size_t n) {
+  std::vector<std::string> v;
+  for (std::size_t i = 0; i < n; i++) {
+    v.push_back("string number " + std::to_string(i));
+  }
+  return v;
+}
+
+properties some_properties(std::size_t n) {
+  properties p;
+  for (std::size_t i = 0; i < n; i++) {
+    std::string name = "Property" + std::to_string(i);
+    switch (i % 4) {
+      case 0:
+        p.emplace_back(name, std::string("value ") + std::to_string(i));
+        break;
+      case 1:
+        p.emplace_back(name, static_cast<dbus::uint32>(i));
+        break;
+      case 2:
+        p.emplace_back(name, i % 8 == 2);
+        break;
+      default:
+        p.emplace_back(name, 0.5 * i);
+        break;
+    }
+  }
+  return p;
+}
+
+/// What GetManagedObjects returns for objects objects with three interfaces
+/// of five properties each.
+managed_objects some_objects(std::size_t objects) {
+  managed_objects o;
+  for (std::size_t i = 0; i < objects; i++) {
+    interfaces ifaces;
+    for (int j = 0; j < 3; j++) {
+      ifaces.emplace_back("org.boost.bench.Interface" + std::to_string(j),
+                          some_properties(5));
+    }
+    o.emplace_back(
+        dbus::object_path{"/org/boost/bench/object" + std::to_string(i)},
+        ifaces);
+  }
+  return o;
+}
+
+nested some_nesting(std::size_t width) {
+  return nested(width, std::vector<std::vector<std::vector<dbus::int32>>>(
+                           width, std::vector<std::vector<dbus::int32>>(
+                                      width, std::vector<dbus::int32>(
+                                                 width, 42))));
+}
+
+void BM_NewCall(benchmark::State& state) {
+  allocations_per_op allocations(state);
+  for (auto _ : state) {
+    dbus::message m = dbus::message::new_call(target);
+    benchmark::DoNotOptimize(m);
+  }
+}
+BENCHMARK(BM_NewCall);
+
+void BM_NewSignal(benchmark::State& state) {
+  allocations_per_op allocations(state);
+  for (auto _ : state) {
+    dbus::message m = dbus::message::new_signal(target, "Changed");
+    benchmark::DoNotOptimize(m);
+  }
+}
+BENCHMARK(BM_NewSignal);
+
+void BM_HeaderStrings(benchmark::State& state) {
+  dbus::message m = dbus::message::new_call(target);
+  allocations_per_op allocations(state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(m.get_path());
+    benchmark::DoNotOptimize(m.get_interface());
+    benchmark::DoNotOptimize(m.get_member());
+    benchmark::DoNotOptimize(m.get_destination());
+  }
+}
+BENCHMARK(BM_HeaderStrings);
+
+void BM_HeaderViews(benchmark::State& state) {
+  dbus::message m = dbus::message::new_call(target);
+  allocations_per_op allocations(state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(m.get_path_view());
+    benchmark::DoNotOptimize(m.get_interface_view());
+    benchmark::DoNotOptimize(m.get_member_view());
+  }
+}
+BENCHMARK(BM_HeaderViews);
+
+void BM_PackScalars(benchmark::State& state) {
+  const std::string s("a short string");
+  allocations_per_op allocations(state);
+  for (auto _ : state) {
+    dbus::message m = dbus::message::new_call(target);
+    m.pack(dbus::int32(-7), dbus::uint64(7), 0.5, true, s);
+    benchmark::DoNotOptimize(m);
+  }
+  set_bytes(state, packed(dbus::int32(-7), dbus::uint64(7), 0.5, true, s));
+}
+BENCHMARK(BM_PackScalars);
+
+void BM_UnpackScalars(benchmark::State& state) {
+  dbus::message m = packed(dbus::int32(-7), dbus::uint64(7), 0.5, true,
+                           std::string("a short string"));
+  allocations_per_op allocations(state);
+  for (auto _ : state) {
+    dbus::int32 i;
+    dbus::uint64 t;
+    double d;
+    bool b;
+    std::string s;
+    m.unpack(i, t, d, b, s);
+    benchmark::DoNotOptimize(s);
+  }
+  set_bytes(state, m);
+}
+BENCHMARK(BM_UnpackScalars);
+
+void BM_PackBytes(benchmark::State& state) {
+  std::vector<dbus::byte> bytes(static_cast<std::size_t>(state.range(0)), 7);
+  allocations_per_op allocations(state);
+  for (auto _ : state) {
+    dbus::message m = dbus::message::new_call(target);
+    m.pack(bytes);
+    benchmark::DoNotOptimize(m);
+  }
+  set_bytes(state, packed(bytes));
+}
+BENCHMARK(BM_PackBytes)->Range(16, 1 << 16);
+
+void BM_UnpackBytes(benchmark::State& state) {
+  dbus::message m = packed(
+      std::vector<dbus::byte>(static_cast<std::size_t>(state.range(0)), 7));
+  allocations_per_op allocations(state);
+  for (auto _ : state) {
+    std::vector<dbus::byte> bytes;
+    m.unpack(bytes);
+    benchmark::DoNotOptimize(bytes);
+  }
+  set_bytes(state, m);
+}
+BENCHMARK(BM_UnpackBytes)->Range(16, 1 << 16);
+
+template <typename T>
+void BM_Pack(benchmark::State& state, const T& value) {
+  allocations_per_op allocations(state);
+  for (auto _ : state) {
+    dbus::message m = dbus::message::new_call(target);
+    m.pack(value);
+    benchmark::DoNotOptimize(m);
+  }
+  set_bytes(state, packed(value));
+}
+
+template <typename T>
+void BM_Unpack(benchmark::State& state, const T& value) {
+  dbus::message m = packed(value);
+  allocations_per_op allocations(state);
+  for (auto _ : state) {
+    T out;
+    m.unpack(out);
+    benchmark::DoNotOptimize(out);
+  }
+  set_bytes(state, m);
+}
+
+BENCHMARK_CAPTURE(BM_Pack, as, strings(100));
+BENCHMARK_CAPTURE(BM_Unpack, as, strings(100));
+BENCHMARK_CAPTURE(BM_Pack, a{sv}, some_properties(20));
+BENCHMARK_CAPTURE(BM_Unpack, a{sv}, some_properties(20));
+BENCHMARK_CAPTURE(BM_Pack, a{oa{sa{sv}}}, some_objects(10));
+BENCHMARK_CAPTURE(BM_Unpack, a{oa{sa{sv}}}, some_objects(10));
+BENCHMARK_CAPTURE(BM_Pack, aaaai, some_nesting(4));
+BENCHMARK_CAPTURE(BM_Unpack, aaaai, some_nesting(4));
+
+BENCHMARK_CAPTURE(BM_Pack, v_string, dbus::dbus_variant(std::string("text")));
+BENCHMARK_CAPTURE(BM_Unpack, v_string,
+                  dbus::dbus_variant(std::string("text")));
+BENCHMARK_CAPTURE(BM_Pack, v_uint32, dbus::dbus_variant(dbus::uint32(7)));
+BENCHMARK_CAPTURE(BM_Unpack, v_uint32, dbus::dbus_variant(dbus::uint32(7)));
+BENCHMARK_CAPTURE(BM_Pack, v_double, dbus::dbus_variant(0.5));
+BENCHMARK_CAPTURE(BM_Unpack, v_double, dbus::dbus_variant(0.5));
+
+}  // namespace
+
+BENCHMARK_MAIN();
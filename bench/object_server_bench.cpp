@@ -0,0 +1,202 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// How DbusObjectServer scales with the number of objects it serves.
+//
+//   dbus_object_server_bench [objects...]
+//
+// For each object count (1000, 10000 and 100000 by default) a fresh process
+// registers that many objects, each with an inventory item, a sensor value
+// and a control interface, grouped 100 to a node, on a private dbus-daemon.
+// It then measures:
+//
+// - registration: time and resident memory per object
+// - properties_changed: PropertiesChanged signals emitted per second
+// - method_call: latency of a call to one of the objects
+// - introspect: latency and reply size at several depths of the tree
+// - get_managed_objects: latency and reply size
+//
+// Each measurement is printed to stdout as a line of JSON carrying the
+// object count, so that the lines for several counts make scaling curves.
+
+#include <dbus/connection.hpp>
+#include <dbus/endpoint.hpp>
+#include <dbus/filter.hpp>
+#include <dbus/match.hpp>
+#include <dbus/properties.hpp>
+#include <calls.hpp>
+#include <private_bus.hpp>
+#include <results.hpp>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+typedef std::chrono::steady_clock clock;
+
+const std::size_t objects_per_group = 100;
+
+std::string group_path(std::size_t group) {
+  return "/org/boost/bench/group" + std::to_string(group);
+}
+
+std::string object_path(std::size_t i) {
+  return group_path(i / objects_per_group) + "/object" + std::to_string(i);
+}
+
+std::uint64_t resident_bytes() {
+  std::ifstream statm("/proc/self/statm");
+  std::uint64_t size = 0;
+  std::uint64_t resident = 0;
+  statm >> size >> resident;
+  return resident * static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE));
+}
+
+std::uint64_t depth_of(const std::string& path) {
+  return path == "/" ? 0 : std::count(path.begin(), path.end(), '/');
+}
+
+void run(const std::string& address, std::size_t objects) {
+  const std::uint64_t n = objects;
+  boost::asio::io_service server_io;
+  boost::asio::io_service::work work(server_io);
+  auto service = std::make_shared<dbus::connection>(server_io, address);
+  dbus::DbusObjectServer server(service);
+
+  std::vector<std::shared_ptr<dbus::DbusInterface>> sensors;
+  sensors.reserve(objects);
+  std::uint64_t rss_before = resident_bytes();
+  clock::time_point start = clock::now();
+  {
+    dbus::DbusObjectServer::transaction tx(server);
+    for (std::size_t i = 0; i < objects; i++) {
+      auto object = tx.add_object(object_path(i));
+      auto item = object->add_interface("org.boost.bench.Inventory.Item");
+      item->set_property("PrettyName", "Item " + std::to_string(i));
+      item->set_property("Present", true);
+      auto sensor = object->add_interface("org.boost.bench.Sensor.Value");
+      sensor->set_property("Value", 0.0);
+      sensor->set_property("MinValue", -50.0);
+      sensor->set_property("MaxValue", 150.0);
+      sensor->set_property("Unit",
+                           std::string("org.boost.bench.Unit.DegreesC"));
+      auto control = object->add_interface("org.boost.bench.Control");
+      control->register_method("Reset", [](uint32_t x) { return x; });
+      sensors.push_back(sensor);
+    }
+  }
+  clock::duration registration = clock::now() - start;
+  // Send the InterfacesAdded signals before counting memory
+  service->flush();
+  std::uint64_t rss_after = resident_bytes();
+  result("registration")
+      .add("objects", n)
+      .add("elapsed", registration)
+      .add("per_object", registration / objects)
+      .add("rss_per_object_bytes",
+           static_cast<double>(rss_after - rss_before) / objects)
+      .print();
+
+  std::size_t changes = std::min<std::size_t>(objects, 10000);
+  start = clock::now();
+  for (std::size_t i = 0; i < changes; i++) {
+    sensors[i]->set_property("Value", 1.0 + i);
+  }
+  service->flush();
+  clock::duration emitting = clock::now() - start;
+  result("properties_changed")
+      .add("objects", n)
+      .add("signals", static_cast<std::uint64_t>(changes))
+      .add("elapsed", emitting)
+      .add("signals_per_sec",
+           changes / std::chrono::duration<double>(emitting).count())
+      .print();
+
+  std::thread server_thread([&server_io]() { server_io.run(); });
+
+  boost::asio::io_service io;
+  auto bus = std::make_shared<dbus::connection>(io, address);
+  std::string name = service->get_unique_name();
+  // Calls that walk every object get fewer repetitions
+  std::size_t few = std::max<std::size_t>(5, 100000 / objects);
+
+  dbus::message reset = dbus::message::new_call(dbus::endpoint(
+      name, object_path(objects / 2), "org.boost.bench.Control", "Reset"));
+  reset.pack(uint32_t(1));
+  async_calls(io, *bus, reset, 1, 100);
+  {
+    calls_run calls = async_calls(io, *bus, reset, 1, 2000);
+    result r("method_call");
+    r.add("objects", n);
+    print(r, calls);
+  }
+
+  for (auto& path : {std::string("/"), std::string("/org/boost/bench"),
+                     group_path(0), object_path(0)}) {
+    dbus::message introspect = dbus::message::new_call(dbus::endpoint(
+        name, path, "org.freedesktop.DBus.Introspectable", "Introspect"));
+    calls_run calls = async_calls(io, *bus, introspect, 1, few);
+    result r("introspect");
+    r.add("objects", n)
+        .add("path", path)
+        .add("depth", depth_of(path))
+        .add("reply_bytes", calls.reply_bytes);
+    print(r, calls);
+  }
+
+  {
+    dbus::message get_managed_objects = dbus::message::new_call(
+        dbus::endpoint(name, "/", "org.freedesktop.DBus.ObjectManager",
+                       "GetManagedObjects"));
+    calls_run calls = async_calls(io, *bus, get_managed_objects, 1, few);
+    result r("get_managed_objects");
+    r.add("objects", n).add("reply_bytes", calls.reply_bytes);
+    print(r, calls);
+  }
+
+  server_io.stop();
+  server_thread.join();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::vector<std::size_t> counts;
+  for (int i = 1; i < argc; i++) {
+    counts.push_back(std::stoul(argv[i]));
+  }
+  if (counts.empty()) {
+    counts = {1000, 10000, 100000};
+  }
+
+  private_bus daemon;
+  for (std::size_t objects : counts) {
+    // A process per count, so that each starts with a clean heap and its
+    // resident memory is its own
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+      run(daemon.address(), objects);
+      std::cout.flush();
+      _exit(0);
+    }
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      std::cerr << "run with " << objects << " objects failed\n";
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,125 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_BENCH_PRIVATE_BUS_HPP
+#define DBUS_BENCH_PRIVATE_BUS_HPP
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/// A dbus-daemon of our own, listening on a socket in a temporary directory.
+/**
+ * Benchmarks run against it rather than the session or system bus, so
+ * nothing else on the machine shares the daemon, and its limits are raised
+ * far enough that a benchmark is never throttled.  The daemon is killed
+ * and its directory removed on destruction.
+ */
+class private_bus {
+ public:
+  private_bus() {
+    char dir[] = "/tmp/dbus-bench-XXXXXX";
+    if (mkdtemp(dir) == nullptr) {
+      throw std::runtime_error("mkdtemp: " + std::string(strerror(errno)));
+    }
+    dir_ = dir;
+    socket_ = dir_ + "/bus";
+    config_ = dir_ + "/bus.conf";
+    write_config();
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+      throw std::runtime_error("pipe: " + std::string(strerror(errno)));
+    }
+    pid_ = fork();
+    if (pid_ == 0) {
+      close(fds[0]);
+      std::string config = "--config-file=" + config_;
+      std::string print = "--print-address=" + std::to_string(fds[1]);
+      execlp("dbus-daemon", "dbus-daemon", config.c_str(), "--nofork",
+             print.c_str(), static_cast<char*>(nullptr));
+      _exit(127);
+    }
+    close(fds[1]);
+    if (pid_ < 0) {
+      close(fds[0]);
+      throw std::runtime_error("fork: " + std::string(strerror(errno)));
+    }
+
+    // The daemon prints its address once it's listening
+    char c;
+    while (read(fds[0], &c, 1) == 1 && c != '\n') {
+      address_ += c;
+    }
+    close(fds[0]);
+    if (address_.empty()) {
+      stop();
+      throw std::runtime_error("dbus-daemon didn't start");
+    }
+  }
+
+  ~private_bus() { stop(); }
+
+  private_bus(const private_bus&) = delete;
+  private_bus& operator=(const private_bus&) = delete;
+
+  const std::string& address() const { return address_; }
+
+ private:
+  void write_config() {
+    std::ofstream out(config_);
+    out << "<!DOCTYPE busconfig PUBLIC "
+           "\"-//freedesktop//DTD D-Bus Bus Configuration 1.0//EN\" "
+           "\"http://www.freedesktop.org/standards/dbus/1.0/"
+           "busconfig.dtd\">\n"
+           "<busconfig>\n"
+           "  <type>session</type>\n"
+           "  <listen>unix:path="
+        << socket_
+        << "</listen>\n"
+           "  <auth>EXTERNAL</auth>\n"
+           "  <policy context=\"default\">\n"
+           "    <allow send_destination=\"*\" eavesdrop=\"true\"/>\n"
+           "    <allow eavesdrop=\"true\"/>\n"
+           "    <allow own=\"*\"/>\n"
+           "  </policy>\n"
+           "  <limit name=\"max_incoming_bytes\">1000000000</limit>\n"
+           "  <limit name=\"max_outgoing_bytes\">1000000000</limit>\n"
+           "  <limit name=\"max_message_size\">134217728</limit>\n"
+           "  <limit name=\"max_replies_per_connection\">100000</limit>\n"
+           "  <limit name=\"max_match_rules_per_connection\">100000</limit>\n"
+           "  <limit name=\"reply_timeout\">300000</limit>\n"
+           "</busconfig>\n";
+    if (!out) {
+      throw std::runtime_error("can't write " + config_);
+    }
+  }
+
+  void stop() {
+    if (pid_ > 0) {
+      kill(pid_, SIGTERM);
+      waitpid(pid_, nullptr, 0);
+      pid_ = -1;
+    }
+    std::remove(socket_.c_str());
+    std::remove(config_.c_str());
+    rmdir(dir_.c_str());
+  }
+
+  std::string dir_;
+  std::string socket_;
+  std::string config_;
+  std::string address_;
+  pid_t pid_ = -1;
+};
+
+#endif  // DBUS_BENCH_PRIVATE_BUS_HPP
@@ -0,0 +1,108 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_BENCH_RESULTS_HPP
+#define DBUS_BENCH_RESULTS_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/// One measurement, printed as a line of JSON.
+/**
+ * Benchmarks print one object per measurement, so a run's output can be
+ * read line by line (jq, pandas.read_json(lines=True)) or diffed across
+ * runs.  Times are in microseconds.
+ */
+class result {
+ public:
+  explicit result(const std::string& benchmark) { add("benchmark", benchmark); }
+
+  result& add(const std::string& key, const std::string& value) {
+    field(key);
+    out_ << '"';
+    for (char c : value) {
+      if (c == '"' || c == '\\') {
+        out_ << '\\';
+      }
+      out_ << c;
+    }
+    out_ << '"';
+    return *this;
+  }
+
+  result& add(const std::string& key, const char* value) {
+    return add(key, std::string(value));
+  }
+
+  result& add(const std::string& key, double value) {
+    field(key);
+    out_ << value;
+    return *this;
+  }
+
+  result& add(const std::string& key, std::uint64_t value) {
+    field(key);
+    out_ << value;
+    return *this;
+  }
+
+  template <typename Rep, typename Period>
+  result& add(const std::string& key,
+              std::chrono::duration<Rep, Period> value) {
+    return add(key + "_us", micros(value));
+  }
+
+  /// Mean, p50, p90, p99, p99.9 and max of samples, which it sorts.
+  template <typename Duration>
+  result& add_latencies(std::vector<Duration>& samples) {
+    add("samples", static_cast<std::uint64_t>(samples.size()));
+    if (samples.empty()) {
+      return *this;
+    }
+    std::sort(samples.begin(), samples.end());
+    Duration total = Duration::zero();
+    for (auto& s : samples) {
+      total += s;
+    }
+    add("mean", total / static_cast<typename Duration::rep>(samples.size()));
+    add("p50", percentile(samples, 0.5));
+    add("p90", percentile(samples, 0.9));
+    add("p99", percentile(samples, 0.99));
+    add("p999", percentile(samples, 0.999));
+    add("max", samples.back());
+    return *this;
+  }
+
+  void print(std::ostream& os = std::cout) {
+    os << out_.str() << "}" << std::endl;
+  }
+
+ private:
+  template <typename Rep, typename Period>
+  static double micros(std::chrono::duration<Rep, Period> d) {
+    return std::chrono::duration<double, std::micro>(d).count();
+  }
+
+  template <typename Duration>
+  static Duration percentile(const std::vector<Duration>& sorted, double q) {
+    std::size_t i = static_cast<std::size_t>(q * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(i, sorted.size() - 1)];
+  }
+
+  void field(const std::string& key) {
+    out_ << (first_ ? "{" : ",") << '"' << key << "\":";
+    first_ = false;
+  }
+
+  std::ostringstream out_;
+  bool first_ = true;
+};
+
+#endif  // DBUS_BENCH_RESULTS_HPP
@@ -0,0 +1,49 @@
+# Copyright (c) Benjamin Kietzman (github.com/bkietz)
+#
+# Distributed under the Boost Software License, Version 1.0. (See accompanying
+# file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+# Generate typed bindings from D-Bus introspection XML at build time.
+#
+#   dbus_generate_proxy(<header> <xml> [NAMESPACE <ns>])
+#   dbus_generate_skeleton(<header> <xml> [NAMESPACE <ns>])
+#
+# Each adds a custom command writing <header> (relative paths are taken from
+# the current binary directory) with a class for every interface in <xml>:
+# a dbus::proxy subclass for clients, or an abstract dbus::StaticDbusInterface
+# for servers to implement.  Add <header> to a target's sources to have it
+# generated before the target is compiled.
+
+include(CMakeParseArguments)
+find_package(PythonInterp 3 REQUIRED)
+
+set(DBUS_CODEGEN_EXECUTABLE
+    ${CMAKE_CURRENT_LIST_DIR}/../tools/dbus-codegen.py
+    CACHE FILEPATH "Generator for D-Bus bindings")
+
+function(_dbus_generate mode header xml)
+  cmake_parse_arguments(ARG "" "NAMESPACE" "" ${ARGN})
+  get_filename_component(xml ${xml} ABSOLUTE)
+  if(NOT IS_ABSOLUTE ${header})
+    set(header ${CMAKE_CURRENT_BINARY_DIR}/${header})
+  endif()
+  set(options)
+  if(ARG_NAMESPACE)
+    list(APPEND options --namespace ${ARG_NAMESPACE})
+  endif()
+  add_custom_command(
+    OUTPUT ${header}
+    COMMAND ${PYTHON_EXECUTABLE} ${DBUS_CODEGEN_EXECUTABLE} ${mode} ${options}
+            -o ${header} ${xml}
+    DEPENDS ${xml} ${DBUS_CODEGEN_EXECUTABLE}
+    COMMENT "Generating ${header} from ${xml}"
+    VERBATIM)
+endfunction()
+
+function(dbus_generate_proxy header xml)
+  _dbus_generate(--proxy ${header} ${xml} ${ARGN})
+endfunction()
+
+function(dbus_generate_skeleton header xml)
+  _dbus_generate(--skeleton ${header} ${xml} ${ARGN})
+endfunction()
@@ -0,0 +1,199 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_BRIDGE_HPP
+#define DBUS_BRIDGE_HPP
+
+#include <dbus/connection.hpp>
+#include <dbus/detail/match_rule.hpp>
+#include <dbus/filter.hpp>
+#include <dbus/match.hpp>
+#include <dbus/message.hpp>
+#include <dbus/name_watcher.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+
+namespace dbus {
+
+/// Relays selected messages between two connections without unpacking them.
+/**
+ * Each route names a direction, a match rule and the destination to give
+ * the messages it selects.  A selected message is copied as it was
+ * marshalled, its header rewritten and the copy sent on the other
+ * connection; its body is never decoded.  The reply to a forwarded method
+ * call, or the error libdbus makes when none comes, is relayed back to the
+ * caller as the reply to the original call.
+ *
+ * Only method calls and signals are forwarded, and the bridge's own
+ * messages are never sent back the way they came.  Forwarded messages are
+ * claimed, like any filter's, so the object paths of the source connection
+ * don't see them.  Routes for signals also add their rule to the source's
+ * bus, so that the bus delivers them.
+ *
+ * A route whose rule names a well-known sender selects messages from that
+ * name's owner.  The owner is looked up when the route is added and followed
+ * as it changes; until the first answer comes, the route selects nothing.
+ *
+ * Both connections must run from the same io_service thread.
+ */
+class bridge {
+ public:
+  enum direction { a_to_b, b_to_a };
+
+  bridge(connection_ptr a, connection_ptr b)
+      : state_(std::make_shared<state>()) {
+    state_->sides[a_to_b].from = a;
+    state_->sides[a_to_b].to = b;
+    state_->sides[b_to_a].from = b;
+    state_->sides[b_to_a].to = a;
+    for (auto& s : state_->sides) {
+      s.own_name = s.from->get_unique_name();
+    }
+  }
+
+  bridge(const bridge&) = delete;
+  bridge& operator=(const bridge&) = delete;
+
+  /// Forward messages matching rule in direction d.
+  /**
+   * Forwarded messages are addressed to destination; an empty destination
+   * sends them unaddressed, which suits signals.  Routes are tried in the
+   * order they were added.
+   *
+   * @throws std::invalid_argument When rule is malformed.
+   */
+  void forward(direction d, const std::string& rule,
+               const std::string& destination = std::string()) {
+    side& s = state_->sides[d];
+    detail::match_rule parsed(rule);
+    if (parsed.type() == DBUS_MESSAGE_TYPE_SIGNAL) {
+      s.matches.emplace_back(new match(s.from, std::string(rule)));
+    }
+    const std::string& sender = parsed.sender();
+    if (!sender.empty() && sender[0] != ':') {
+      if (!s.owners) {
+        s.owners.reset(new name_watcher(s.from));
+      }
+      s.owners->watch(sender);
+    }
+    s.routes.push_back(route{parsed, destination});
+    if (!s.claim) {
+      start(d);
+    }
+  }
+
+  /// Messages forwarded so far in direction d, not counting replies.
+  std::size_t forwarded(direction d) const {
+    return state_->sides[d].forwarded;
+  }
+
+ private:
+  struct route {
+    detail::match_rule rule;
+    std::string destination;
+  };
+
+  struct side {
+    connection_ptr from;
+    connection_ptr to;
+    // The sender of messages this bridge sent on from, which the bus may
+    // echo back to it
+    std::string own_name;
+    std::vector<route> routes;
+    std::vector<std::unique_ptr<match>> matches;
+    std::unique_ptr<filter> claim;
+    // Owners of the well-known senders routes name; messages carry only
+    // unique names
+    std::unique_ptr<name_watcher> owners;
+    std::size_t forwarded = 0;
+
+    const route* find(message& m) const {
+      int type = dbus_message_get_type(m);
+      if (type != DBUS_MESSAGE_TYPE_METHOD_CALL &&
+          type != DBUS_MESSAGE_TYPE_SIGNAL) {
+        return nullptr;
+      }
+      if (dbus_message_has_sender(m, own_name.c_str())) {
+        return nullptr;
+      }
+      auto owner_of = [this](const std::string& name) {
+        return owners ? owners->get_owner(name) : std::string();
+      };
+      for (auto& r : routes) {
+        if (r.rule.matches(m, owner_of)) {
+          return &r;
+        }
+      }
+      return nullptr;
+    }
+  };
+
+  struct state {
+    side sides[2];
+  };
+
+  void start(direction d) {
+    std::weak_ptr<state> weak = state_;
+    side& s = state_->sides[d];
+    s.claim.reset(new filter(s.from, [weak, d](message& m) {
+      auto self = weak.lock();
+      return self && self->sides[d].find(m) != nullptr;
+    }));
+    pump(state_, d);
+  }
+
+  static void pump(const std::shared_ptr<state>& self, direction d) {
+    std::weak_ptr<state> weak = self;
+    self->sides[d].claim->async_dispatch(
+        [weak, d](boost::system::error_code ec, message m) {
+          auto self = weak.lock();
+          if (ec || !self) {
+            return;
+          }
+          relay(self->sides[d], m);
+          pump(self, d);
+        });
+  }
+
+  static void relay(side& s, message& m) {
+    const route* r = s.find(m);
+    if (r == nullptr) {
+      return;
+    }
+    // The copy carries the marshalled header and body over as they are,
+    // with no serial, so the outgoing connection can number it.  The sender
+    // is dropped too: a bus would overwrite it, but a peer-to-peer
+    // connection would pass on one naming a peer on the other side.
+    message copy = message::new_copy(m);
+    dbus_message_set_sender(copy, nullptr);
+    dbus_message_set_destination(
+        copy, r->destination.empty() ? nullptr : r->destination.c_str());
+    s.forwarded++;
+
+    if (dbus_message_get_type(m) != DBUS_MESSAGE_TYPE_METHOD_CALL ||
+        dbus_message_get_no_reply(m)) {
+      s.to->send(copy, std::chrono::seconds(0));
+      return;
+    }
+    connection_ptr from = s.from;
+    s.to->async_send(
+        copy, [from, m](boost::system::error_code, message reply) mutable {
+          message back = message::new_copy(reply);
+          dbus_message_set_sender(back, nullptr);
+          back.set_reply_serial(dbus_message_get_serial(m));
+          dbus_message_set_destination(back, dbus_message_get_sender(m));
+          from->send(back, std::chrono::seconds(0));
+        });
+  }
+
+  std::shared_ptr<state> state_;
+};
+
+}  // namespace dbus
+
+#endif  // DBUS_BRIDGE_HPP
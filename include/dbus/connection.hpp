@@ -6,17 +6,27 @@
 #ifndef DBUS_CONNECTION_HPP
 #define DBUS_CONNECTION_HPP
 
+#include <dbus/connection_metrics.hpp>
 #include <dbus/connection_service.hpp>
 #include <dbus/element.hpp>
+#include <dbus/loop_monitor.hpp>
 #include <dbus/message.hpp>
+#include <dbus/outgoing_scheduler.hpp>
 #include <chrono>
+#include <memory>
 #include <string>
 #include <boost/asio.hpp>
 
 namespace dbus {
 
+class credentials_cache;
 class filter;
 class match;
+class method_profiler;
+
+namespace detail {
+class object_server_root;
+}  // namespace detail
 
 /// Root D-Bus IO object
 /**
@@ -186,7 +196,114 @@ class connection : public boost::asio::basic_io_object<connection_service> {
     }
   }
 
-  void flush(void) { this->get_implementation().flush(); };
+  void flush(void) {
+    if (this->get_implementation().scheduler) {
+      this->get_implementation().scheduler->flush();
+    }
+    this->get_implementation().flush();
+  };
+
+  /// Send by priority class instead of in order.
+  /**
+ * Installs an outgoing_scheduler, through which every later non-blocking
+ * send is queued.  Calling it again returns the same scheduler.
+ *
+ * Sends may still come from any thread: the scheduler locks its queues, and
+ * queues a copy of each message, so the caller's message is left with a
+ * serial of 0 and may be reused.  Install it before other threads start
+ * sending, though; installing it is not itself synchronised.
+ */
+  outgoing_scheduler& enable_scheduler() {
+    auto& scheduler = this->get_implementation().scheduler;
+    if (!scheduler) {
+      scheduler.reset(new outgoing_scheduler(
+          this->get_io_service(), this->get_implementation()));
+    }
+    return *scheduler;
+  }
+
+  /// Bound the work done for this connection per turn of the io_service.
+  /**
+ * Incoming replies are always completed before signal handlers run.  Each
+ * turn takes at most messages messages off the incoming queue and runs at
+ * most handlers signal handlers, then yields to the rest of the io_service.
+ *
+ * handlers doesn't cover dbus::filter: messages a filter takes are handed
+ * to its async_dispatch handlers through the io_service as they arrive,
+ * so a busy filter is bounded only by messages.
+ */
+  void set_dispatch_budget(std::size_t messages, std::size_t handlers) {
+    this->get_implementation().dispatch->set_budget(messages, handlers);
+  }
+
+  /// Report blocking calls made from the io_service, and io_service lag.
+  /**
+ * Installs and starts a loop_monitor that passes what it finds to handler.
+ * Calling it again returns the same monitor, with its original handler.
+ */
+  loop_monitor& enable_loop_monitor(loop_monitor::violation_handler handler) {
+    auto& monitor = this->get_implementation().monitor;
+    if (!monitor) {
+      monitor.reset(new loop_monitor(this->get_io_service(), handler));
+      monitor->start();
+    }
+    return *monitor;
+  }
+
+  /// Serve calls from other connections in this process without the bus.
+  /**
+ * Once enabled, a method call that another connection in the process sends
+ * with async_send() to this one, by its unique name or a name it owns,
+ * is handed over in memory: it's dispatched to the handlers registered on
+ * this connection (a DbusObjectServer's, say) from this connection's
+ * io_service, and the reply or error they send goes straight back to the
+ * caller's handler.  Neither message is marshalled onto a socket or routed
+ * through the daemon.  Signals, and calls from other processes, still go
+ * through the bus as before.
+ *
+ * What differs from a call through the bus:
+ * - Arguments are still packed into and unpacked from the message, but
+ *   the message is never serialized.
+ * - Calls sent with a blocking send() still go through the bus.
+ * - Loopback calls aren't seen by this connection's filters or counted in
+ *   either connection's metrics.
+ * - A loopback call isn't ordered against messages sent through the bus,
+ *   so may be handled before a signal sent ahead of it.
+ * - A name only counts while the bus says this connection owns it: not if
+ *   request_name() found it taken, nor once NameLost reports it gone.
+ */
+  void enable_loopback() { this->get_implementation().enable_loopback(); }
+
+  /// The monitor installed by enable_loop_monitor(), or nullptr.
+  loop_monitor* get_loop_monitor() {
+    return this->get_implementation().monitor.get();
+  }
+
+  /// The scheduler installed by enable_scheduler(), or nullptr.
+  outgoing_scheduler* get_scheduler() {
+    return this->get_implementation().scheduler.get();
+  }
+
+  /// A snapshot of this connection's transport counters and queue sizes.
+  /**
+ * Counting is always on and costs a relaxed atomic increment or two per
+ * message, on counters kept per thread so that threads sending at once
+ * don't contend; the snapshot adds them up.  The counters can be read from
+ * any thread, but the queue sizes are read unlocked, so take snapshots from
+ * the io_service's thread.
+ */
+  connection_metrics metrics() {
+    return this->get_implementation().snapshot();
+  }
+
+  /// Also count the marshalled size of every message in and out.
+  /**
+ * Off by default: it marshals each message a second time, just to measure
+ * it.
+ */
+  void count_message_bytes(bool enabled) {
+    this->get_implementation().metrics->count_bytes = enabled;
+  }
 
   /// Create a new match.
   void new_match(match& m) {
@@ -208,9 +325,52 @@ class connection : public boost::asio::basic_io_object<connection_service> {
     this->get_service().delete_filter(this->get_implementation(), f);
   }
 
+  /// Register a handler for messages addressed to an object path.
+  /**
+ * The vtable's message function is called during dispatch, after every
+ * filter has declined the message, so it runs without any queueing.
+ *
+ * @param path The object path to handle.
+ *
+ * @param vtable Handler functions. Must outlive the registration.
+ *
+ * @param user_data Passed through to the handler functions.
+ *
+ * @param fallback Also handle every path below this one that has no
+ * handler of its own.
+ *
+ * @throws boost::system::system_error When the path is already registered.
+ */
+  void register_object_path(const string& path,
+                            const DBusObjectPathVTable& vtable,
+                            void* user_data, bool fallback = false) {
+    this->get_service().register_object_path(this->get_implementation(), path,
+                                             vtable, user_data, fallback);
+  }
+
+  /// Remove a handler added with register_object_path.
+  void unregister_object_path(const string& path) {
+    this->get_service().unregister_object_path(this->get_implementation(),
+                                               path);
+  }
+
   // FIXME the only way around this I see is to expose start() here, which seems
   // ugly
   friend class filter;
+  friend class signal_subscription;
+
+ private:
+  // Turns on the dispatch queue's intake stamps
+  friend class method_profiler;
+
+  // Shared by everything answering calls on this connection; weak so the
+  // cache, which holds the connection, doesn't keep it alive
+  std::weak_ptr<credentials_cache> credentials_cache_;
+  friend class credentials_cache;
+
+  // The fallback on / that every DbusObjectServer on this connection shares
+  std::weak_ptr<detail::object_server_root> object_server_root_;
+  friend class detail::object_server_root;
 };
 
 typedef std::shared_ptr<connection> connection_ptr;
@@ -0,0 +1,303 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_CONNECTION_METRICS_HPP
+#define DBUS_CONNECTION_METRICS_HPP
+
+#include <dbus/dbus.h>
+#include <dbus/element.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+
+namespace dbus {
+
+/// A copy of one connection's transport counters, taken at one moment.
+/**
+ * Counters (messages, bytes, dispatches, replies) only ever grow; gauges
+ * (queue sizes, calls in flight) are read when the snapshot is taken.  See
+ * connection::metrics().
+ */
+struct connection_metrics {
+  struct by_type {
+    uint64 method_calls = 0;
+    uint64 method_returns = 0;
+    uint64 errors = 0;
+    uint64 signals = 0;
+
+    uint64 total() const {
+      return method_calls + method_returns + errors + signals;
+    }
+  };
+
+  /// Reply latencies are counted in power-of-two buckets of microseconds.
+  static const std::size_t latency_buckets = 28;
+
+  by_type messages_in;
+  by_type messages_out;
+  /// Marshalled sizes; zero unless connection::count_message_bytes() is on.
+  by_type bytes_in;
+  by_type bytes_out;
+
+  /// dbus_connection_dispatch calls, and the turns of the io_service that
+  /// made them.
+  uint64 dispatches = 0;
+  uint64 dispatch_turns = 0;
+  uint64 max_dispatches_per_turn = 0;
+
+  /// Method calls sent and still waiting for a reply, and those whose
+  /// reply never came.
+  uint64 calls_in_flight = 0;
+  uint64 call_timeouts = 0;
+
+  /// Bytes libdbus has yet to write, and messages the outgoing_scheduler
+  /// is still holding back.
+  uint64 outgoing_bytes = 0;
+  uint64 outgoing_messages = 0;
+
+  /// Handlers queued behind dispatch, and messages queued on filters
+  /// waiting for async_dispatch.
+  uint64 dispatch_pending = 0;
+  uint64 filter_queued = 0;
+  uint64 max_filter_queued = 0;
+
+  /// Bucket 0 counts replies under 1us; bucket i > 0 those in
+  /// [2^(i-1), 2^i) us.  The last bucket takes everything slower.  Calls
+  /// that timed out are counted at the time they gave up.
+  std::array<uint64, latency_buckets> reply_latency{};
+
+  double dispatches_per_turn() const {
+    return dispatch_turns == 0 ? 0.0
+                               : static_cast<double>(dispatches) /
+                                     static_cast<double>(dispatch_turns);
+  }
+
+  uint64 replies() const {
+    uint64 n = 0;
+    for (uint64 count : reply_latency) {
+      n += count;
+    }
+    return n;
+  }
+
+  /// The bucket a latency is counted in.
+  template <typename Duration>
+  static std::size_t latency_bucket(Duration latency) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(latency)
+                  .count();
+    std::size_t bucket = 0;
+    while (us > 0 && bucket < latency_buckets - 1) {
+      us >>= 1;
+      bucket++;
+    }
+    return bucket;
+  }
+
+  /// The exclusive upper bound of a latency bucket.
+  static std::chrono::microseconds latency_bound(std::size_t bucket) {
+    return std::chrono::microseconds(uint64(1) << bucket);
+  }
+
+  /// The bucket bound under which at least fraction q of replies arrived.
+  std::chrono::microseconds latency_percentile(double q) const {
+    return percentile(reply_latency, q);
+  }
+
+  /// The same, for any histogram bucketed by latency_bucket().
+  static std::chrono::microseconds percentile(
+      const std::array<uint64, latency_buckets>& histogram, double q) {
+    uint64 total = 0;
+    for (uint64 count : histogram) {
+      total += count;
+    }
+    if (total == 0) {
+      return std::chrono::microseconds::zero();
+    }
+    uint64 seen = 0;
+    for (std::size_t i = 0; i < latency_buckets; i++) {
+      seen += histogram[i];
+      if (static_cast<double>(seen) >= q * static_cast<double>(total)) {
+        return latency_bound(i);
+      }
+    }
+    return latency_bound(latency_buckets - 1);
+  }
+};
+
+namespace detail {
+
+/// The counters behind connection_metrics.
+/**
+ * Everything here is a relaxed atomic increment on the path that sends or
+ * dispatches a message, cheap enough to leave on.  Each thread counts into
+ * one of a few shards, kept on separate cache lines, so threads sending at
+ * once don't fight over the same counters; snapshot() adds the shards up.
+ * The one expensive measurement, marshalling each message to learn its
+ * size, is off unless count_bytes is set.
+ */
+class metrics_collector {
+ public:
+  typedef std::chrono::steady_clock clock;
+
+  metrics_collector() = default;
+  metrics_collector(const metrics_collector&) = delete;
+  metrics_collector& operator=(const metrics_collector&) = delete;
+
+  std::atomic<bool> count_bytes{false};
+
+  /// Counts every message libdbus dispatches that isn't a pending call's
+  /// reply; those are counted by call_finished.  Add it before any other
+  /// filter.
+  static DBusHandlerResult filter_callback(DBusConnection*, DBusMessage* m,
+                                           void* userdata) {
+    static_cast<metrics_collector*>(userdata)->received(m);
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+  }
+
+  void sent(DBusMessage* m) { count(local().out, m); }
+
+  void received(DBusMessage* m) { count(local().in, m); }
+
+  void call_started() { bump(local().in_flight); }
+
+  /// reply is null if a blocking call failed without one.
+  void call_finished(DBusMessage* reply, clock::duration latency) {
+    // May well be another shard than the one that counted the call in;
+    // the sum comes out right all the same
+    local().in_flight.fetch_sub(1, std::memory_order_relaxed);
+    if (reply != nullptr) {
+      received(reply);
+      // What libdbus completes a pending call with when it times out
+      if (dbus_message_is_error(reply, DBUS_ERROR_NO_REPLY)) {
+        call_timed_out();
+      }
+    }
+    bump(local().latency[connection_metrics::latency_bucket(latency)]);
+  }
+
+  void call_timed_out() { bump(local().timeouts); }
+
+  void dispatch_turn(uint64 dispatches) {
+    if (dispatches == 0) {
+      return;
+    }
+    shard& mine = local();
+    bump(mine.turns);
+    mine.dispatches.fetch_add(dispatches, std::memory_order_relaxed);
+    uint64 max = mine.max_per_turn.load(std::memory_order_relaxed);
+    while (dispatches > max &&
+           !mine.max_per_turn.compare_exchange_weak(
+               max, dispatches, std::memory_order_relaxed)) {
+    }
+  }
+
+  /// Fills in the counters; the connection adds the gauges.
+  void snapshot(connection_metrics& s) const {
+    s.messages_in = s.messages_out = s.bytes_in = s.bytes_out =
+        connection_metrics::by_type();
+    s.dispatches = s.dispatch_turns = s.max_dispatches_per_turn = 0;
+    s.calls_in_flight = s.call_timeouts = 0;
+    s.reply_latency.fill(0);
+    for (const shard& h : shards_) {
+      add(h.in, s.messages_in, s.bytes_in);
+      add(h.out, s.messages_out, s.bytes_out);
+      s.dispatches += read(h.dispatches);
+      s.dispatch_turns += read(h.turns);
+      s.max_dispatches_per_turn =
+          std::max(s.max_dispatches_per_turn, read(h.max_per_turn));
+      s.calls_in_flight += read(h.in_flight);
+      s.call_timeouts += read(h.timeouts);
+      for (std::size_t i = 0; i < connection_metrics::latency_buckets; i++) {
+        s.reply_latency[i] += read(h.latency[i]);
+      }
+    }
+  }
+
+ private:
+  typedef std::atomic<uint64> counter;
+
+  struct direction {
+    counter messages[4] = {};
+    counter bytes[4] = {};
+  };
+
+  // Threads beyond this many share shards, which costs contention but
+  // never counts
+  static const std::size_t shard_count = 8;
+
+  struct shard {
+    direction in;
+    direction out;
+    counter dispatches{0};
+    counter turns{0};
+    counter max_per_turn{0};
+    // Wraps below zero in a shard that only sees calls finish
+    counter in_flight{0};
+    counter timeouts{0};
+    counter latency[connection_metrics::latency_buckets] = {};
+    // Keeps the next shard's counters off this one's last cache line
+    char padding[64];
+  };
+
+  // The calling thread's shard, the same one for every collector
+  shard& local() {
+    static std::atomic<std::size_t> threads{0};
+    static thread_local std::size_t index =
+        threads.fetch_add(1, std::memory_order_relaxed) % shard_count;
+    return shards_[index];
+  }
+
+  static void bump(counter& c) { c.fetch_add(1, std::memory_order_relaxed); }
+
+  static uint64 read(const counter& c) {
+    return c.load(std::memory_order_relaxed);
+  }
+
+  static std::size_t type_index(DBusMessage* m) {
+    switch (dbus_message_get_type(m)) {
+      case DBUS_MESSAGE_TYPE_METHOD_CALL:
+        return 0;
+      case DBUS_MESSAGE_TYPE_METHOD_RETURN:
+        return 1;
+      case DBUS_MESSAGE_TYPE_ERROR:
+        return 2;
+      default:
+        return 3;
+    }
+  }
+
+  void count(direction& d, DBusMessage* m) {
+    std::size_t type = type_index(m);
+    bump(d.messages[type]);
+    if (count_bytes.load(std::memory_order_relaxed)) {
+      char* marshalled = nullptr;
+      int size = 0;
+      if (dbus_message_marshal(m, &marshalled, &size)) {
+        d.bytes[type].fetch_add(size, std::memory_order_relaxed);
+        dbus_free(marshalled);
+      }
+    }
+  }
+
+  static void add(const direction& d, connection_metrics::by_type& messages,
+                  connection_metrics::by_type& bytes) {
+    messages.method_calls += read(d.messages[0]);
+    messages.method_returns += read(d.messages[1]);
+    messages.errors += read(d.messages[2]);
+    messages.signals += read(d.messages[3]);
+    bytes.method_calls += read(d.bytes[0]);
+    bytes.method_returns += read(d.bytes[1]);
+    bytes.errors += read(d.bytes[2]);
+    bytes.signals += read(d.bytes[3]);
+  }
+
+  std::array<shard, shard_count> shards_;
+};
+
+}  // namespace detail
+}  // namespace dbus
+
+#endif  // DBUS_CONNECTION_METRICS_HPP
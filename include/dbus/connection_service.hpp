@@ -13,6 +13,7 @@
 #include <dbus/element.hpp>
 #include <dbus/error.hpp>
 #include <dbus/message.hpp>
+#include <dbus/trace.hpp>
 
 #include <dbus/impl/connection.ipp>
 
@@ -63,6 +64,10 @@ class connection_service
   inline message send(implementation_type& impl, message& m,
                       const Duration& timeout) {
     if (timeout == Duration::zero()) {
+      if (impl.scheduler) {
+        impl.scheduler->submit(m, [&impl](message& m) { impl.send(m); });
+        return message(nullptr);
+      }
       // TODO this can return false if it failed
       impl.send(m);
       // TODO(ed) rework API to seperate blocking and non blocking sends
@@ -78,6 +83,8 @@ class connection_service
                                        void(boost::system::error_code, message))
       async_send(implementation_type& impl, message& m,
                  BOOST_ASIO_MOVE_ARG(MessageHandler) handler) {
+    BOOST_DBUS_TRACE(async_send, m, reinterpret_cast<std::uintptr_t>(
+                                        static_cast<DBusMessage*>(m)));
     // begin asynchronous operation
     impl.start(this->get_io_service());
 
@@ -85,13 +92,34 @@ class connection_service
         MessageHandler, void(boost::system::error_code, message)>
         init(BOOST_ASIO_MOVE_CAST(MessageHandler)(handler));
     detail::async_send_op<typename boost::asio::handler_type<
-        MessageHandler, void(boost::system::error_code, message)>::type>(
-        this->get_io_service(),
-        BOOST_ASIO_MOVE_CAST(MessageHandler)(init.handler))(impl, m);
+        MessageHandler, void(boost::system::error_code, message)>::type>
+        op(this->get_io_service(),
+           BOOST_ASIO_MOVE_CAST(MessageHandler)(init.handler));
+    if (impl.scheduler) {
+      impl.scheduler->submit(
+          m, [&impl, op](message& m) mutable { op(impl, m); });
+    } else {
+      op(impl, m);
+    }
 
     return init.result.get();
   }
 
+  inline void register_object_path(implementation_type& impl,
+                                   const string& path,
+                                   const DBusObjectPathVTable& vtable,
+                                   void* user_data, bool fallback) {
+    impl.register_object_path(path, &vtable, user_data, fallback);
+
+    // object path handlers are called from dispatch, so make sure it runs
+    impl.start(this->get_io_service());
+  }
+
+  inline void unregister_object_path(implementation_type& impl,
+                                     const string& path) {
+    impl.unregister_object_path(path);
+  }
+
  private:
   friend connection;
   inline void new_match(implementation_type& impl, match& m);
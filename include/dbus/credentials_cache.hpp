@@ -0,0 +1,222 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_CREDENTIALS_CACHE_HPP
+#define DBUS_CREDENTIALS_CACHE_HPP
+
+#include <dbus/connection.hpp>
+#include <dbus/endpoint.hpp>
+#include <dbus/message.hpp>
+#include <dbus/signal_subscription.hpp>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/asio.hpp>
+
+namespace dbus {
+
+/// What the bus knows about the process behind a unique name.
+/**
+ * Filled from GetConnectionCredentials; fields the bus didn't report are
+ * left unset.
+ */
+struct peer_credentials {
+  std::string unique_name;
+  bool has_uid = false;
+  uint32 uid = 0;
+  bool has_pid = false;
+  uint32 pid = 0;
+  std::vector<uint32> gids;
+  std::string security_label;
+};
+
+/// Per-connection cache of peer credentials, keyed by unique name.
+/**
+ * The first lookup for a peer costs one asynchronous GetConnectionCredentials
+ * call (concurrent lookups share it); later ones are a hash lookup.  Entries
+ * are dropped when NameOwnerChanged reports the peer gone, so a recycled
+ * unique name can never be served stale credentials.
+ *
+ * Obtain the cache for a connection with credentials_cache::get().
+ */
+class credentials_cache
+    : public std::enable_shared_from_this<credentials_cache> {
+ public:
+  typedef std::function<void(boost::system::error_code,
+                             const peer_credentials&)>
+      handler_type;
+
+  /// The connection's cache, created on first use.
+  static std::shared_ptr<credentials_cache> get(const connection_ptr& c) {
+    auto cache = c->credentials_cache_.lock();
+    if (!cache) {
+      cache.reset(new credentials_cache(c));
+      cache->start();
+      c->credentials_cache_ = cache;
+    }
+    return cache;
+  }
+
+  credentials_cache(const credentials_cache&) = delete;
+  credentials_cache& operator=(const credentials_cache&) = delete;
+
+  /// Cached credentials for a peer, or nullptr if not cached yet.
+  const peer_credentials* find(const std::string& unique_name) const {
+    auto it = entries_.find(unique_name);
+    return it == entries_.end() ? nullptr : &it->second;
+  }
+
+  /// Call handler(error_code, credentials) for a peer.
+  /**
+   * Answers from the cache when it can, in which case the handler runs before
+   * async_get returns.
+   */
+  void async_get(const std::string& unique_name, handler_type handler) {
+    auto it = entries_.find(unique_name);
+    if (it != entries_.end()) {
+      handler(boost::system::error_code(), it->second);
+      return;
+    }
+    auto& waiters = pending_[unique_name];
+    waiters.emplace_back(std::move(handler));
+    if (waiters.size() > 1) {
+      return;
+    }
+
+    std::weak_ptr<credentials_cache> weak = shared_from_this();
+    dbus::endpoint e("org.freedesktop.DBus", "/org/freedesktop/DBus",
+                     "org.freedesktop.DBus", "GetConnectionCredentials");
+    auto m = message::new_call(e);
+    m.pack(unique_name);
+    connection_->async_send(
+        m, [weak, unique_name](boost::system::error_code ec, message r) {
+          auto self = weak.lock();
+          if (self) self->complete(unique_name, ec, r);
+        });
+  }
+
+  /// Forget a peer's credentials.
+  void invalidate(const std::string& unique_name) {
+    entries_.erase(unique_name);
+  }
+
+  std::size_t size() const { return entries_.size(); }
+
+ private:
+  explicit credentials_cache(const connection_ptr& c) : connection_(c) {}
+
+  void start() {
+    std::weak_ptr<credentials_cache> weak = shared_from_this();
+    // Only unique names are cached, and those never change hands; all we
+    // need to hear about is one going away, which is when arg2 (the new
+    // owner) is empty
+    owner_changes_.reset(new signal_subscription(
+        connection_,
+        "type='signal',sender='org.freedesktop.DBus',"
+        "interface='org.freedesktop.DBus',member='NameOwnerChanged',"
+        "arg2=''",
+        [](message& m) {
+          return dbus_message_is_signal(m, "org.freedesktop.DBus",
+                                        "NameOwnerChanged") &&
+                 dbus_message_has_sender(m, "org.freedesktop.DBus");
+        },
+        [weak](message& m) {
+          std::string name, old_owner, new_owner;
+          auto self = weak.lock();
+          if (self && m.unpack(name, old_owner, new_owner) &&
+              new_owner.empty()) {
+            self->invalidate(name);
+          }
+        }));
+  }
+
+  void complete(const std::string& unique_name, boost::system::error_code ec,
+                message& r) {
+    auto waiting = pending_.find(unique_name);
+    if (waiting == pending_.end()) {
+      return;
+    }
+    std::vector<handler_type> waiters = std::move(waiting->second);
+    pending_.erase(waiting);
+
+    peer_credentials credentials;
+    credentials.unique_name = unique_name;
+    if (!ec && !parse(r, credentials)) {
+      ec = boost::system::errc::make_error_code(
+          boost::system::errc::invalid_argument);
+    }
+    if (!ec) {
+      entries_[unique_name] = credentials;
+    }
+    for (auto& waiter : waiters) {
+      waiter(ec, credentials);
+    }
+  }
+
+  // Reads the a{sv} reply by hand: dbus_variant can't hold the arrays in it
+  static bool parse(message& r, peer_credentials& c) {
+    DBusMessageIter it, dict;
+    if (!dbus_message_iter_init(r, &it) ||
+        dbus_message_iter_get_arg_type(&it) != DBUS_TYPE_ARRAY) {
+      return false;
+    }
+    dbus_message_iter_recurse(&it, &dict);
+    while (dbus_message_iter_get_arg_type(&dict) == DBUS_TYPE_DICT_ENTRY) {
+      DBusMessageIter entry, value;
+      const char* key = "";
+      dbus_message_iter_recurse(&dict, &entry);
+      dbus_message_iter_get_basic(&entry, &key);
+      dbus_message_iter_next(&entry);
+      dbus_message_iter_recurse(&entry, &value);
+      int type = dbus_message_iter_get_arg_type(&value);
+
+      if (std::strcmp(key, "UnixUserID") == 0 && type == DBUS_TYPE_UINT32) {
+        dbus_message_iter_get_basic(&value, &c.uid);
+        c.has_uid = true;
+      } else if (std::strcmp(key, "ProcessID") == 0 &&
+                 type == DBUS_TYPE_UINT32) {
+        dbus_message_iter_get_basic(&value, &c.pid);
+        c.has_pid = true;
+      } else if (std::strcmp(key, "UnixGroupIDs") == 0 &&
+                 type == DBUS_TYPE_ARRAY) {
+        DBusMessageIter gid;
+        dbus_message_iter_recurse(&value, &gid);
+        while (dbus_message_iter_get_arg_type(&gid) == DBUS_TYPE_UINT32) {
+          uint32 g;
+          dbus_message_iter_get_basic(&gid, &g);
+          c.gids.push_back(g);
+          dbus_message_iter_next(&gid);
+        }
+      } else if (std::strcmp(key, "LinuxSecurityLabel") == 0 &&
+                 type == DBUS_TYPE_ARRAY) {
+        // A NUL terminated byte array
+        DBusMessageIter bytes;
+        const char* label = nullptr;
+        int n = 0;
+        dbus_message_iter_recurse(&value, &bytes);
+        if (dbus_message_iter_get_arg_type(&bytes) == DBUS_TYPE_BYTE) {
+          dbus_message_iter_get_fixed_array(&bytes, &label, &n);
+        }
+        if (label != nullptr) {
+          c.security_label.assign(label, strnlen(label, n));
+        }
+      }
+      dbus_message_iter_next(&dict);
+    }
+    return true;
+  }
+
+  connection_ptr connection_;
+  std::unique_ptr<signal_subscription> owner_changes_;
+  std::unordered_map<std::string, peer_credentials> entries_;
+  std::unordered_map<std::string, std::vector<handler_type>> pending_;
+};
+
+}  // namespace dbus
+
+#endif  // DBUS_CREDENTIALS_CACHE_HPP
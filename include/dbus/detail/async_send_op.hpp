@@ -11,6 +11,7 @@
 #include <dbus/dbus.h>
 #include <dbus/error.hpp>
 #include <dbus/message.hpp>
+#include <dbus/trace.hpp>
 
 #include <dbus/impl/connection.ipp>
 
@@ -25,10 +26,16 @@ struct async_send_op {
   // not
   std::shared_ptr<message> message_;
   MessageHandler handler_;
+  // Where the completion is queued, ahead of signal handlers
+  std::weak_ptr<dispatch_queue> dispatch_;
+  // Where the reply and its latency are counted
+  std::weak_ptr<metrics_collector> metrics_;
+  metrics_collector::clock::time_point sent_at_;
   async_send_op(boost::asio::io_service& io,
                 BOOST_ASIO_MOVE_ARG(MessageHandler) handler);
   static void callback(DBusPendingCall* p, void* userdata);  // for C API
   void operator()(impl::connection& c, message& m);  // initiate operation
+  void loopback(impl::connection& c, loopback_endpoint& peer, message& m);
   void operator()();  // bound completion handler form
 };
 
@@ -48,8 +55,14 @@ void async_send_op<MessageHandler>::operator()(impl::connection& c,
     // dbuspending call when the callback doesn't fire, simply send it without a
     // reply
     c.send(m);
+  } else if (auto peer = loopback_registry::instance().find(
+                 dbus_message_get_destination(m))) {
+    loopback(c, *peer, m);
   } else {
+    sent_at_ = metrics_collector::clock::now();
     c.send_with_reply(m, &p, -1);
+    dispatch_ = c.dispatch;
+    metrics_ = c.metrics;
 
     // We have to throw this onto the heap so that the
     // C API can store it as `void *userdata`
@@ -71,20 +84,47 @@ void async_send_op<MessageHandler>::operator()(impl::connection& c,
   }
 }
 
+template <typename MessageHandler>
+void async_send_op<MessageHandler>::loopback(impl::connection& c,
+                                             loopback_endpoint& peer,
+                                             message& m) {
+  // The destination is served in this process, so the call never reaches
+  // the bus, or this connection's metrics
+  auto op = std::make_shared<async_send_op>(
+      BOOST_ASIO_MOVE_CAST(async_send_op)(*this));
+  peer.call(c.get_unique_name(), m, op->io_, [op](message reply) {
+    BOOST_DBUS_TRACE(reply_received, reply, 0);
+    op->message_ = std::make_shared<message>(reply);
+    (*op)();
+  });
+}
+
 template <typename MessageHandler>
 void async_send_op<MessageHandler>::callback(DBusPendingCall* p,
                                              void* userdata) {
   boost::scoped_ptr<async_send_op> op(static_cast<async_send_op*>(userdata));
   auto x = dbus_pending_call_steal_reply(p);
+  BOOST_DBUS_TRACE(reply_received, x, 0);
+  if (auto metrics = op->metrics_.lock()) {
+    metrics->call_finished(x, metrics_collector::clock::now() - op->sent_at_);
+  }
   op->message_ = std::make_shared<message>(x);
   dbus_message_unref(x);
   dbus_pending_call_unref(p);
 
-  op->io_.post(BOOST_ASIO_MOVE_CAST(async_send_op)(*op));
+  auto dispatch = op->dispatch_.lock();
+  if (dispatch) {
+    auto completion = std::make_shared<async_send_op>(
+        BOOST_ASIO_MOVE_CAST(async_send_op)(*op));
+    dispatch->push_reply([completion]() { (*completion)(); });
+  } else {
+    op->io_.post(BOOST_ASIO_MOVE_CAST(async_send_op)(*op));
+  }
 }
 
 template <typename MessageHandler>
 void async_send_op<MessageHandler>::operator()() {
+  BOOST_DBUS_TRACE(reply_handler, *message_, 0);
   handler_(error(*message_.get()).error_code(), *message_.get());
 }
 
@@ -0,0 +1,72 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_CALL_SCOPE_HPP
+#define DBUS_CALL_SCOPE_HPP
+
+#include <dbus/connection.hpp>
+#include <dbus/message.hpp>
+#include <chrono>
+#include <string>
+
+namespace dbus {
+namespace detail {
+
+/// Marks the method call a server handler is running for on this thread.
+/**
+ * While a scope is open, send_error() notes any error sent in reply to its
+ * call, which is how the method_profiler tells failed calls from answered
+ * ones whichever interface class handled them.  Scopes nest, for handlers
+ * that dispatch again.
+ */
+class call_scope {
+ public:
+  explicit call_scope(DBusMessage* call) : call_(call), previous_(current()) {
+    current() = this;
+  }
+
+  ~call_scope() { current() = previous_; }
+
+  call_scope(const call_scope&) = delete;
+  call_scope& operator=(const call_scope&) = delete;
+
+  bool failed() const { return failed_; }
+
+  static void replied_with_error(DBusMessage* call) {
+    for (call_scope* s = current(); s != nullptr; s = s->previous_) {
+      if (s->call_ == call) {
+        s->failed_ = true;
+        return;
+      }
+    }
+  }
+
+ private:
+  static call_scope*& current() {
+    static thread_local call_scope* scope = nullptr;
+    return scope;
+  }
+
+  DBusMessage* call_;
+  call_scope* previous_;
+  bool failed_ = false;
+};
+
+/// Answer call with an error, noting it against the call's scope.
+/**
+ * The object server sends every error reply through here, so only errors
+ * that go out to a caller count as failed calls.
+ */
+inline void send_error(connection& conn, message& call,
+                       const std::string& name, const std::string& text) {
+  message err = message::new_error(call, name, text);
+  call_scope::replied_with_error(call);
+  conn.send(err, std::chrono::seconds(0));
+}
+
+}  // namespace detail
+}  // namespace dbus
+
+#endif  // DBUS_CALL_SCOPE_HPP
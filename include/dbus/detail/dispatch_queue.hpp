@@ -0,0 +1,208 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_DISPATCH_QUEUE_HPP
+#define DBUS_DISPATCH_QUEUE_HPP
+
+#include <dbus/dbus.h>
+#include <dbus/connection_metrics.hpp>
+#include <dbus/trace.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <boost/asio.hpp>
+
+namespace dbus {
+namespace detail {
+
+/// Drives dbus_connection_dispatch for one connection, replies first.
+/**
+ * Each turn takes up to intake_budget messages off libdbus's incoming queue.
+ * That is cheap, because the handlers it reaches don't do their work there:
+ * pending-call completions are pushed onto the reply lane and signal
+ * deliveries onto the message lane.  The turn then runs every queued reply
+ * and at most handler_budget signal handlers, and posts another turn if
+ * anything is left.  A reply stuck behind thousands of signals is found
+ * after a few cheap intakes instead of after thousands of signal handlers.
+ *
+ * Method calls to registered object paths still run during intake, since
+ * libdbus needs to know there and then whether they were handled.
+ *
+ * Messages a dbus::filter takes are queued on the filter instead, whose
+ * async_dispatch handlers are posted to the io_service outside the lanes.
+ *
+ * With stamp_intake() on, each message is stamped as it is taken in with
+ * the moment its turn was scheduled; see intake_time().
+ *
+ * schedule() may be called from any thread: libdbus reports new data from
+ * whichever thread read it, and connection::start() runs on the caller's.
+ * Everything else, the lanes included, belongs to the io_service's thread.
+ */
+class dispatch_queue : public std::enable_shared_from_this<dispatch_queue> {
+ public:
+  typedef std::function<void()> work;
+  typedef std::chrono::steady_clock clock;
+
+  dispatch_queue(boost::asio::io_service& io, DBusConnection* c,
+                 std::shared_ptr<metrics_collector> metrics = nullptr)
+      : io_(io), connection_(c), metrics_(std::move(metrics)) {}
+
+  dispatch_queue(const dispatch_queue&) = delete;
+  dispatch_queue& operator=(const dispatch_queue&) = delete;
+
+  /// Have libdbus tell us when messages arrive.
+  void attach() {
+    dbus_connection_set_dispatch_status_function(connection_, &status_changed,
+                                                 this, nullptr);
+  }
+
+  void detach() {
+    dbus_connection_set_dispatch_status_function(connection_, nullptr,
+                                                 nullptr, nullptr);
+  }
+
+  void set_budget(std::size_t intake, std::size_t handlers) {
+    intake_budget_ = std::max<std::size_t>(intake, 1);
+    handler_budget_ = std::max<std::size_t>(handlers, 1);
+  }
+
+  /// Run f ahead of any queued signal handlers.
+  void push_reply(work f) {
+    replies_.emplace_back(std::move(f));
+    schedule();
+  }
+
+  /// Run f once the replies are done, within the handler budget.
+  void push(work f) {
+    messages_.emplace_back(std::move(f));
+    schedule();
+  }
+
+  /// Handlers waiting to run, replies and others.
+  std::size_t pending() const { return replies_.size() + messages_.size(); }
+
+  /// Stamp each message taken in, for intake_time().  Costs an allocation
+  /// per message, so it is off unless something reads the stamps.
+  void stamp_intake(bool enabled) { stamp_intake_ = enabled; }
+
+  /// When m's turn was scheduled, or the epoch if m wasn't stamped.
+  /**
+   * libdbus doesn't timestamp messages, and reads happen between turns, so
+   * a message taken in by a turn was read no earlier than that turn was
+   * scheduled: when libdbus reported the data, or when the previous turn
+   * ended.  A message left behind by a turn that ran out of intake budget
+   * is stamped by the turn that takes it, so its wait is understated by at
+   * most the turn it sat through.
+   */
+  static clock::time_point intake_time(DBusMessage* m) {
+    auto stamp = static_cast<clock::time_point*>(
+        dbus_message_get_data(m, intake_slot()));
+    return stamp == nullptr ? clock::time_point() : *stamp;
+  }
+
+  /// Post a turn, unless one is already posted.  Thread safe.
+  void schedule() {
+    if (posted_.exchange(true)) {
+      return;
+    }
+    scheduled_at_ = clock::now().time_since_epoch().count();
+    std::weak_ptr<dispatch_queue> weak = shared_from_this();
+    io_.post([weak]() {
+      if (auto self = weak.lock()) self->run();
+    });
+  }
+
+ private:
+  void run() {
+    // Before posted_ is cleared, after which the next turn may overwrite it
+    clock::time_point scheduled{clock::duration(scheduled_at_.load())};
+    posted_ = false;
+    BOOST_DBUS_TRACE(dispatch_begin, nullptr, 0);
+
+    std::size_t n = 0;
+    for (; n < intake_budget_ &&
+           dbus_connection_get_dispatch_status(connection_) ==
+               DBUS_DISPATCH_DATA_REMAINS;
+         n++) {
+      if (stamp_intake_) {
+        stamp(scheduled);
+      }
+      dbus_connection_dispatch(connection_);
+    }
+    BOOST_DBUS_TRACE(dispatch_end, nullptr, n);
+    if (metrics_) {
+      metrics_->dispatch_turn(n);
+    }
+
+    // Replies queued by the handlers below wait for the next turn, so a
+    // chain of calls can't keep the signals from ever running
+    std::size_t replies = replies_.size();
+    for (std::size_t n = 0; n < replies && !replies_.empty(); n++) {
+      work f = std::move(replies_.front());
+      replies_.pop_front();
+      f();
+    }
+    for (std::size_t n = 0; n < handler_budget_ && !messages_.empty(); n++) {
+      work f = std::move(messages_.front());
+      messages_.pop_front();
+      f();
+    }
+
+    if (!replies_.empty() || !messages_.empty() ||
+        dbus_connection_get_dispatch_status(connection_) ==
+            DBUS_DISPATCH_DATA_REMAINS) {
+      schedule();
+    }
+  }
+
+  // Stamps the message the next dbus_connection_dispatch will take
+  void stamp(clock::time_point scheduled) {
+    DBusMessage* m = dbus_connection_borrow_message(connection_);
+    if (m == nullptr) {
+      return;
+    }
+    dbus_message_set_data(m, intake_slot(), new clock::time_point(scheduled),
+                          [](void* p) {
+                            delete static_cast<clock::time_point*>(p);
+                          });
+    dbus_connection_return_message(connection_, m);
+  }
+
+  static dbus_int32_t intake_slot() {
+    // libdbus keeps a pointer to the slot, so it has to stay put
+    static dbus_int32_t slot = -1;
+    static bool allocated = dbus_message_allocate_data_slot(&slot);
+    (void)allocated;
+    return slot;
+  }
+
+  static void status_changed(DBusConnection*, DBusDispatchStatus status,
+                             void* data) {
+    if (status == DBUS_DISPATCH_DATA_REMAINS) {
+      static_cast<dispatch_queue*>(data)->schedule();
+    }
+  }
+
+  boost::asio::io_service& io_;
+  DBusConnection* connection_;
+  std::shared_ptr<metrics_collector> metrics_;
+  std::atomic<bool> posted_{false};
+  // Written by schedule() on any thread, so kept as a count of ticks since
+  // the epoch
+  std::atomic<clock::rep> scheduled_at_{0};
+  bool stamp_intake_ = false;
+  std::size_t intake_budget_ = 256;
+  std::size_t handler_budget_ = 64;
+  std::deque<work> replies_;
+  std::deque<work> messages_;
+};
+
+}  // namespace detail
+}  // namespace dbus
+
+#endif  // DBUS_DISPATCH_QUEUE_HPP
@@ -0,0 +1,125 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_DISPATCH_TABLE_HPP
+#define DBUS_DISPATCH_TABLE_HPP
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/utility/string_view.hpp>
+
+namespace dbus {
+namespace detail {
+
+/// Read-only name lookup for method and interface dispatch.
+/**
+ * Built once from a map of owning pointers, after which a lookup hashes the
+ * name and, in the usual case, compares against a single slot.  The builder
+ * searches for a hash seed that gives every key its own slot; if none turns up
+ * the table falls back to linear probing, which is still allocation free.
+ */
+template <typename T>
+class dispatch_table {
+ public:
+  typedef boost::string_view key_type;
+
+  dispatch_table() : mask_(0), seed_(0), probing_(false) {}
+
+  // Rebuild from any range of pairs whose first is the name and whose second
+  // dereferences to a T.  The table points into the range's values, so it must
+  // be rebuilt whenever the range changes.
+  template <typename Map>
+  void assign(const Map& entries) {
+    std::size_t count = entries.size();
+    if (count == 0) {
+      slots_.clear();
+      mask_ = 0;
+      return;
+    }
+
+    std::size_t size = 2;
+    while (size < count * 2) {
+      size <<= 1;
+    }
+    // Give the perfect hash a few seeds at a few table sizes before settling
+    // for probing
+    for (int grow = 0; grow < 3; grow++, size <<= 1) {
+      for (boost::uint64_t seed = 0; seed < 32; seed++) {
+        if (build(entries, size, seed, false)) {
+          return;
+        }
+      }
+    }
+    build(entries, size, 0, true);
+  }
+
+  T* find(key_type key) const {
+    if (slots_.empty()) {
+      return nullptr;
+    }
+    std::size_t i = hash(key, seed_) & mask_;
+    while (slots_[i].value != nullptr) {
+      if (slots_[i].key == key) {
+        return slots_[i].value;
+      }
+      if (!probing_) {
+        return nullptr;
+      }
+      i = (i + 1) & mask_;
+    }
+    return nullptr;
+  }
+
+  bool is_perfect() const { return !probing_; }
+
+ private:
+  struct slot {
+    std::string key;
+    T* value = nullptr;
+  };
+
+  static std::size_t hash(key_type key, boost::uint64_t seed) {
+    // FNV-1a, with the seed folded into the offset basis
+    boost::uint64_t h =
+        14695981039346656037ULL ^ (seed * 0x9e3779b97f4a7c15ULL);
+    for (char c : key) {
+      h ^= static_cast<unsigned char>(c);
+      h *= 1099511628211ULL;
+    }
+    return static_cast<std::size_t>(h ^ (h >> 32));
+  }
+
+  template <typename Map>
+  bool build(const Map& entries, std::size_t size, boost::uint64_t seed,
+             bool probe) {
+    slots_.assign(size, slot());
+    mask_ = size - 1;
+    seed_ = seed;
+    probing_ = probe;
+    for (auto& entry : entries) {
+      std::size_t i = hash(entry.first, seed) & mask_;
+      while (slots_[i].value != nullptr) {
+        if (!probe) {
+          return false;
+        }
+        i = (i + 1) & mask_;
+      }
+      slots_[i].key = entry.first;
+      slots_[i].value = &*entry.second;
+    }
+    return true;
+  }
+
+  std::vector<slot> slots_;
+  std::size_t mask_;
+  boost::uint64_t seed_;
+  bool probing_;
+};
+
+}  // namespace detail
+}  // namespace dbus
+
+#endif  // DBUS_DISPATCH_TABLE_HPP
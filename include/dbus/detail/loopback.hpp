@@ -0,0 +1,322 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_LOOPBACK_HPP
+#define DBUS_LOOPBACK_HPP
+
+#include <dbus/dbus.h>
+#include <dbus/element.hpp>
+#include <dbus/message.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+namespace dbus {
+namespace detail {
+
+/// The serving end of method calls made from within the process.
+/**
+ * Every connection has one, which mirrors its object path registrations.
+ * Once enabled and named in the loopback_registry, calls to the connection
+ * from other connections in the process are handed to it here, rather than
+ * going through the bus: the call is dispatched to the registered handlers
+ * from this connection's io_service, and the reply they send comes back
+ * through complete() to the caller's handler.
+ */
+class loopback_endpoint
+    : public std::enable_shared_from_this<loopback_endpoint> {
+ public:
+  typedef std::function<void(message)> reply_handler;
+
+  loopback_endpoint(boost::asio::io_service& io, DBusConnection* conn)
+      : io_(io), conn_(conn), enabled_(false) {}
+
+  ~loopback_endpoint() { fail_pending("connection closed"); }
+
+  loopback_endpoint(const loopback_endpoint&) = delete;
+  loopback_endpoint& operator=(const loopback_endpoint&) = delete;
+
+  void add_path(const string& path, const DBusObjectPathVTable* vtable,
+                void* user_data, bool fallback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    paths_[path] = registration{vtable, user_data, fallback};
+  }
+
+  void remove_path(const string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    paths_.erase(path);
+  }
+
+  bool enabled() const { return enabled_.load(std::memory_order_acquire); }
+
+  void set_enabled() { enabled_.store(true, std::memory_order_release); }
+
+  /// Stop serving, as the connection is closing.
+  /**
+ * Calls already posted find no handlers, and callers still waiting get an
+ * error reply.
+ */
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      paths_.clear();
+    }
+    fail_pending("connection closed");
+  }
+
+  /// Pass a method call to this connection, bypassing the bus.
+  /**
+ * call is stamped with a serial and with sender as its sender, as the bus
+ * would have, then dispatched from this connection's io_service.  done is
+ * run from caller_io with the reply; an error reply if the handlers send
+ * none within libdbus's default timeout, or this connection goes away
+ * first.
+ */
+  void call(const string& sender, message& m,
+            boost::asio::io_service& caller_io, reply_handler done) {
+    // A message that has been sent before is locked; send a copy of it
+    message call = dbus_message_get_serial(m) == 0 ? m : message::new_copy(m);
+    dbus_message_set_serial(call, next_serial());
+    dbus_message_set_sender(call, sender.c_str());
+    dbus_message_lock(call);
+
+    auto timer = std::make_shared<boost::asio::steady_timer>(caller_io,
+                                                             reply_timeout());
+    key k(sender, dbus_message_get_serial(call));
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_.emplace(k, pending{call, &caller_io, timer, std::move(done)});
+    }
+
+    std::weak_ptr<loopback_endpoint> weak = shared_from_this();
+    timer->async_wait([weak, k](const boost::system::error_code& ec) {
+      auto self = weak.lock();
+      if (ec || !self) {
+        return;
+      }
+      pending p;
+      if (self->take(k, p)) {
+        p.done(message::new_error(p.call, DBUS_ERROR_NO_REPLY,
+                                  "Did not receive a reply"));
+      }
+    });
+
+    auto self = shared_from_this();
+    io_.post([self, call]() mutable { self->dispatch(call); });
+  }
+
+  /// Deliver m to a caller if it replies to a call made through call().
+  /**
+ * Called with every message the connection sends; returns false for all
+ * but the replies it delivers, which must then not go to the bus.
+ */
+  bool complete(message& m) {
+    int type = dbus_message_get_type(m);
+    if (type != DBUS_MESSAGE_TYPE_METHOD_RETURN &&
+        type != DBUS_MESSAGE_TYPE_ERROR) {
+      return false;
+    }
+    const char* destination = dbus_message_get_destination(m);
+    if (destination == nullptr) {
+      return false;
+    }
+    pending p;
+    if (!take(key(destination, dbus_message_get_reply_serial(m)), p)) {
+      return false;
+    }
+    message reply = m;
+    p.caller_io->post([p, reply]() {
+      p.timer->cancel();
+      p.done(reply);
+    });
+    return true;
+  }
+
+ private:
+  typedef std::pair<string, uint32> key;
+
+  struct registration {
+    const DBusObjectPathVTable* vtable;
+    void* user_data;
+    bool fallback;
+  };
+
+  struct pending {
+    message call;
+    boost::asio::io_service* caller_io;
+    std::shared_ptr<boost::asio::steady_timer> timer;
+    reply_handler done;
+
+    pending() : call(nullptr), caller_io(nullptr) {}
+    pending(message c, boost::asio::io_service* io,
+            std::shared_ptr<boost::asio::steady_timer> t, reply_handler d)
+        : call(c), caller_io(io), timer(std::move(t)), done(std::move(d)) {}
+  };
+
+  // libdbus's default, which a call through the bus would have had
+  static std::chrono::milliseconds reply_timeout() {
+    return std::chrono::milliseconds(25000);
+  }
+
+  static uint32 next_serial() {
+    // Clear of the serials libdbus gives a connection's own messages,
+    // which count up from 1
+    static std::atomic<uint32> serial{0x80000000u};
+    return serial++;
+  }
+
+  bool take(const key& k, pending& p) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pending_.empty()) {
+      return false;
+    }
+    auto it = pending_.find(k);
+    if (it == pending_.end()) {
+      return false;
+    }
+    p = std::move(it->second);
+    pending_.erase(it);
+    return true;
+  }
+
+  // Offer the call to its handlers the way libdbus would: the object
+  // registered at its path, then each fallback above it, nearest first
+  void dispatch(message& call) {
+    std::vector<registration> handlers;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      string path = dbus_message_get_path(call);
+      auto exact = paths_.find(path);
+      if (exact != paths_.end()) {
+        handlers.push_back(exact->second);
+      }
+      while (path != "/") {
+        auto slash = path.rfind('/');
+        path.erase(slash == 0 ? 1 : slash);
+        auto parent = paths_.find(path);
+        if (parent != paths_.end() && parent->second.fallback) {
+          handlers.push_back(parent->second);
+        }
+      }
+    }
+
+    for (auto& h : handlers) {
+      if (h.vtable->message_function != nullptr &&
+          h.vtable->message_function(conn_, call, h.user_data) ==
+              DBUS_HANDLER_RESULT_HANDLED) {
+        return;
+      }
+    }
+
+    const char* interface = dbus_message_get_interface(call);
+    message error = message::new_error(
+        call, DBUS_ERROR_UNKNOWN_METHOD,
+        "Method \"" + string(dbus_message_get_member(call)) +
+            "\" with signature \"" + dbus_message_get_signature(call) +
+            "\" on interface \"" + (interface ? interface : "(null)") +
+            "\" doesn't exist");
+    complete(error);
+  }
+
+  void fail_pending(const char* why) {
+    std::map<key, pending> failed;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      failed.swap(pending_);
+    }
+    for (auto& f : failed) {
+      pending p = f.second;
+      message error = message::new_error(p.call, DBUS_ERROR_NO_REPLY, why);
+      p.caller_io->post([p, error]() {
+        p.timer->cancel();
+        p.done(error);
+      });
+    }
+  }
+
+  boost::asio::io_service& io_;
+  DBusConnection* conn_;
+  std::atomic<bool> enabled_;
+  std::mutex mutex_;
+  std::map<string, registration> paths_;
+  std::map<key, pending> pending_;
+};
+
+/// The connections in this process that take loopback calls, by bus name.
+class loopback_registry {
+ public:
+  static loopback_registry& instance() {
+    // Never destroyed, so that connections outliving main() can still
+    // remove themselves
+    static loopback_registry* registry = new loopback_registry;
+    return *registry;
+  }
+
+  void add(const string& name,
+           const std::shared_ptr<loopback_endpoint>& endpoint) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    names_[name] = endpoint;
+    count_.store(names_.size(), std::memory_order_release);
+  }
+
+  void remove(const loopback_endpoint* endpoint) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = names_.begin(); it != names_.end();) {
+      auto e = it->second.lock();
+      if (!e || e.get() == endpoint) {
+        it = names_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    count_.store(names_.size(), std::memory_order_release);
+  }
+
+  /// Stop serving name from endpoint, if it still serves it.
+  void remove(const string& name, const loopback_endpoint* endpoint) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = names_.find(name);
+    if (it != names_.end()) {
+      auto e = it->second.lock();
+      if (!e || e.get() == endpoint) {
+        names_.erase(it);
+      }
+    }
+    count_.store(names_.size(), std::memory_order_release);
+  }
+
+  /// The endpoint serving destination, if it's in this process.
+  std::shared_ptr<loopback_endpoint> find(const char* destination) {
+    // Most processes never enable loopback; don't make them take the lock
+    if (destination == nullptr ||
+        count_.load(std::memory_order_acquire) == 0) {
+      return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = names_.find(destination);
+    return it == names_.end() ? nullptr : it->second.lock();
+  }
+
+ private:
+  loopback_registry() : count_(0) {}
+
+  std::mutex mutex_;
+  std::map<string, std::weak_ptr<loopback_endpoint>> names_;
+  std::atomic<std::size_t> count_;
+};
+
+}  // namespace detail
+}  // namespace dbus
+
+#endif  // DBUS_LOOPBACK_HPP
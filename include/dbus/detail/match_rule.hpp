@@ -0,0 +1,256 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_MATCH_RULE_HPP
+#define DBUS_MATCH_RULE_HPP
+
+#include <dbus/dbus.h>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+
+namespace dbus {
+namespace detail {
+
+/// A parsed match rule, as the bus applies them to its routing.
+/**
+ * Understands the keys of the D-Bus specification: type, sender,
+ * interface, member, path, path_namespace, destination, argN, argNpath and
+ * arg0namespace.  eavesdrop is accepted and ignored.  Anything else, or a
+ * malformed rule, throws std::invalid_argument.
+ */
+class match_rule {
+ public:
+  typedef std::function<std::string(const std::string&)> owner_lookup;
+
+  match_rule() : type_(DBUS_MESSAGE_TYPE_INVALID) {}
+
+  explicit match_rule(const std::string& rule)
+      : type_(DBUS_MESSAGE_TYPE_INVALID) {
+    std::size_t i = 0;
+    while (i < rule.size()) {
+      while (i < rule.size() && (rule[i] == ' ' || rule[i] == '\t')) {
+        i++;
+      }
+      auto equals = rule.find('=', i);
+      if (equals == std::string::npos) {
+        throw std::invalid_argument("match rule key without a value");
+      }
+      std::string key = rule.substr(i, equals - i);
+      std::string value;
+      i = equals + 1;
+      bool quoted = false;
+      for (; i < rule.size() && (quoted || rule[i] != ','); i++) {
+        if (rule[i] == '\'') {
+          quoted = !quoted;
+        } else if (!quoted && rule[i] == '\\' && i + 1 < rule.size() &&
+                   rule[i + 1] == '\'') {
+          value += '\'';
+          i++;
+        } else {
+          value += rule[i];
+        }
+      }
+      if (quoted) {
+        throw std::invalid_argument("unterminated quote in match rule");
+      }
+      if (i < rule.size()) {
+        i++;  // the comma
+      }
+      set(key, value);
+    }
+  }
+
+  /// Whether m passes the rule.
+  /**
+   * A sender rule naming a well-known name also passes messages from its
+   * owner, when owner_of can say who that is.
+   */
+  bool matches(DBusMessage* m, const owner_lookup& owner_of = nullptr) const {
+    if (type_ != DBUS_MESSAGE_TYPE_INVALID &&
+        dbus_message_get_type(m) != type_) {
+      return false;
+    }
+    if (!sender_.empty() && !has_sender(m, owner_of)) {
+      return false;
+    }
+    if (!equal(interface_, dbus_message_get_interface(m)) ||
+        !equal(member_, dbus_message_get_member(m)) ||
+        !equal(path_, dbus_message_get_path(m)) ||
+        !equal(destination_, dbus_message_get_destination(m))) {
+      return false;
+    }
+    if (!path_namespace_.empty() &&
+        !in_namespace(dbus_message_get_path(m), path_namespace_, '/')) {
+      return false;
+    }
+    return args_.empty() || args_match(m);
+  }
+
+  /// The message type the rule is limited to, or DBUS_MESSAGE_TYPE_INVALID.
+  int type() const { return type_; }
+
+  /// The sender the rule is limited to, or an empty string.
+  const std::string& sender() const { return sender_; }
+
+  bool operator==(const match_rule& other) const {
+    return std::tie(type_, sender_, interface_, member_, path_,
+                    path_namespace_, destination_, args_) ==
+           std::tie(other.type_, other.sender_, other.interface_,
+                    other.member_, other.path_, other.path_namespace_,
+                    other.destination_, other.args_);
+  }
+
+  bool operator!=(const match_rule& other) const { return !(*this == other); }
+
+ private:
+  enum arg_kind { arg_string, arg_path, arg_namespace };
+
+  void set(const std::string& key, const std::string& value) {
+    if (key == "type") {
+      type_ = dbus_message_type_from_string(value.c_str());
+      if (type_ == DBUS_MESSAGE_TYPE_INVALID) {
+        throw std::invalid_argument("unknown message type " + value);
+      }
+    } else if (key == "sender") {
+      sender_ = value;
+    } else if (key == "interface") {
+      interface_ = value;
+    } else if (key == "member") {
+      member_ = value;
+    } else if (key == "path") {
+      path_ = value;
+    } else if (key == "path_namespace") {
+      path_namespace_ = value;
+    } else if (key == "destination") {
+      destination_ = value;
+    } else if (key == "eavesdrop") {
+    } else if (key.compare(0, 3, "arg") == 0) {
+      set_arg(key, value);
+    } else {
+      throw std::invalid_argument("unknown match rule key " + key);
+    }
+    if (!path_.empty() && !path_namespace_.empty()) {
+      throw std::invalid_argument("path and path_namespace both given");
+    }
+  }
+
+  void set_arg(const std::string& key, const std::string& value) {
+    char* end = nullptr;
+    const char* digits = key.c_str() + 3;
+    long n = std::strtol(digits, &end, 10);
+    if (end == digits || n < 0 || n > 63) {
+      throw std::invalid_argument("bad argument index in " + key);
+    }
+    arg_kind kind = arg_string;
+    if (std::strcmp(end, "path") == 0) {
+      kind = arg_path;
+    } else if (std::strcmp(end, "namespace") == 0 && n == 0) {
+      kind = arg_namespace;
+    } else if (*end != '\0') {
+      throw std::invalid_argument("unknown match rule key " + key);
+    }
+    args_[static_cast<int>(n)] = std::make_pair(kind, value);
+  }
+
+  bool has_sender(DBusMessage* m, const owner_lookup& owner_of) const {
+    const char* sender = dbus_message_get_sender(m);
+    if (sender == nullptr) {
+      return false;
+    }
+    if (sender_ == sender) {
+      return true;
+    }
+    return sender_[0] != ':' && owner_of && owner_of(sender_) == sender;
+  }
+
+  bool args_match(DBusMessage* m) const {
+    DBusMessageIter iter;
+    bool more = dbus_message_iter_init(m, &iter);
+    int index = 0;
+    for (auto& arg : args_) {
+      while (more && index < arg.first) {
+        more = dbus_message_iter_next(&iter);
+        index++;
+      }
+      if (!more) {
+        return false;
+      }
+      int type = dbus_message_iter_get_arg_type(&iter);
+      if (type != DBUS_TYPE_STRING &&
+          !(type == DBUS_TYPE_OBJECT_PATH && arg.second.first == arg_path)) {
+        return false;
+      }
+      const char* value = nullptr;
+      dbus_message_iter_get_basic(&iter, &value);
+      if (!arg_matches(arg.second.first, arg.second.second, value)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static bool arg_matches(arg_kind kind, const std::string& rule,
+                          const char* value) {
+    switch (kind) {
+      case arg_string:
+        return rule == value;
+      case arg_namespace:
+        return in_namespace(value, rule, '.');
+      case arg_path: {
+        // Either may be a directory, ending in '/', holding the other
+        std::string v(value);
+        if (v == rule) {
+          return true;
+        }
+        if (!rule.empty() && rule.back() == '/' &&
+            v.compare(0, rule.size(), rule) == 0) {
+          return true;
+        }
+        return !v.empty() && v.back() == '/' &&
+               rule.compare(0, v.size(), v) == 0;
+      }
+    }
+    return false;
+  }
+
+  static bool in_namespace(const char* value, const std::string& ns,
+                           char separator) {
+    if (value == nullptr) {
+      return false;
+    }
+    std::size_t size = std::strlen(value);
+    // The root path_namespace holds every path
+    if (separator == '/' && ns == "/") {
+      return true;
+    }
+    if (size < ns.size() || ns.compare(0, ns.size(), value, ns.size()) != 0) {
+      return false;
+    }
+    return size == ns.size() || value[ns.size()] == separator;
+  }
+
+  static bool equal(const std::string& rule, const char* value) {
+    return rule.empty() || (value != nullptr && rule == value);
+  }
+
+  int type_;
+  std::string sender_;
+  std::string interface_;
+  std::string member_;
+  std::string path_;
+  std::string path_namespace_;
+  std::string destination_;
+  std::map<int, std::pair<arg_kind, std::string>> args_;
+};
+
+}  // namespace detail
+}  // namespace dbus
+
+#endif  // DBUS_MATCH_RULE_HPP
@@ -6,6 +6,8 @@
 #ifndef DBUS_QUEUE_HPP
 #define DBUS_QUEUE_HPP
 
+#include <dbus/message.hpp>
+#include <dbus/trace.hpp>
 #include <deque>
 #include <functional>
 #include <boost/asio.hpp>
@@ -14,6 +16,14 @@
 namespace dbus {
 namespace detail {
 
+// The libdbus message a queued item traces as, if it is one
+inline DBusMessage* traced_message(message& m) { return m; }
+
+template <typename T>
+inline DBusMessage* traced_message(T&) {
+  return nullptr;
+}
+
 template <typename Message>
 class queue {
  public:
@@ -49,16 +59,25 @@ class queue {
   };
 
  public:
+  /// Messages waiting for a handler.
+  std::size_t size() {
+    mutex_type::scoped_lock lock(mutex);
+    return messages.size();
+  }
+
   void push(message_type m) {
     mutex_type::scoped_lock lock(mutex);
-    if (handlers.empty())
+    if (handlers.empty()) {
       messages.push_back(m);
-    else {
+      BOOST_DBUS_TRACE(queue_push, traced_message(m), messages.size());
+    } else {
       handler_type h = handlers.front();
       handlers.pop_front();
 
       lock.unlock();
 
+      BOOST_DBUS_TRACE(queue_push, traced_message(m), 0);
+      BOOST_DBUS_TRACE(queue_pop, traced_message(m), 0);
       io.post(closure(h, m));
     }
   }
@@ -85,6 +104,7 @@ class queue {
     } else {
       message_type m = messages.front();
       messages.pop_front();
+      BOOST_DBUS_TRACE(queue_pop, traced_message(m), messages.size());
 
       lock.unlock();
 
@@ -8,57 +8,74 @@
 
 #include <dbus/dbus.h>
 #include <boost/asio/generic/stream_protocol.hpp>
+#include <boost/asio/io_service.hpp>
 #include <boost/asio/steady_timer.hpp>
 
 #include <chrono>
 
+#include <unistd.h>
+
 namespace dbus {
 namespace detail {
 
+// The asio side of a DBusWatch.  libdbus gives a connection's read and write
+// watches the same fd, which epoll won't register twice, so each watch works
+// on its own dup of it.
+struct watch_socket {
+  explicit watch_socket(boost::asio::io_service &io) : socket(io) {}
+  boost::asio::generic::stream_protocol::socket socket;
+  // The DBusWatchFlags directions with a wait outstanding, and which waits
+  // they are: bumped on every cancel so a completion that was already
+  // queued can tell it's stale
+  unsigned armed = 0;
+  unsigned generation = 0;
+};
+
 static void watch_toggled(DBusWatch *dbus_watch, void *data);
 struct watch_handler {
   DBusWatchFlags flags;
   DBusWatch *dbus_watch;
-  watch_handler(DBusWatchFlags f, DBusWatch *w) : flags(f), dbus_watch(w) {}
+  unsigned generation;
+  watch_handler(DBusWatchFlags f, DBusWatch *w, unsigned g)
+      : flags(f), dbus_watch(w), generation(g) {}
   void operator()(boost::system::error_code ec, size_t) {
     if (ec) return;
+    auto w = static_cast<watch_socket *>(dbus_watch_get_data(dbus_watch));
+    if (w == nullptr || w->generation != generation) return;
+    w->armed &= ~flags;
     dbus_watch_handle(dbus_watch, flags);
-    auto data = dbus_watch_get_data(dbus_watch);
-    if (data != nullptr) {
-      boost::asio::generic::stream_protocol::socket &socket =
-          *static_cast<boost::asio::generic::stream_protocol::socket *>(data);
-
-      watch_toggled(dbus_watch, &socket.get_io_service());
-    }
+    // Wait again if the watch is still enabled; libdbus only reports changes
+    watch_toggled(dbus_watch, nullptr);
   }
 };
 static void watch_toggled(DBusWatch *dbus_watch, void *data) {
-  void *watch_data = dbus_watch_get_data(dbus_watch);
-  if (watch_data == nullptr) {
+  auto w = static_cast<watch_socket *>(dbus_watch_get_data(dbus_watch));
+  if (w == nullptr) {
     return;
   }
 
-  auto socket =
-      static_cast<boost::asio::generic::stream_protocol::socket *>(watch_data);
   if (dbus_watch_get_enabled(dbus_watch)) {
-    if (dbus_watch_get_flags(dbus_watch) & DBUS_WATCH_READABLE)
-      socket->async_read_some(boost::asio::null_buffers(),
-                              watch_handler(DBUS_WATCH_READABLE, dbus_watch));
-
-    if (dbus_watch_get_flags(dbus_watch) & DBUS_WATCH_WRITABLE)
-      socket->async_write_some(boost::asio::null_buffers(),
-                               watch_handler(DBUS_WATCH_WRITABLE, dbus_watch));
-
-  } else {
-    socket->cancel();
+    // Only the directions not already waiting; either may complete first
+    unsigned wanted = dbus_watch_get_flags(dbus_watch) & ~w->armed;
+    w->armed |= wanted;
+    if (wanted & DBUS_WATCH_READABLE)
+      w->socket.async_read_some(
+          boost::asio::null_buffers(),
+          watch_handler(DBUS_WATCH_READABLE, dbus_watch, w->generation));
+
+    if (wanted & DBUS_WATCH_WRITABLE)
+      w->socket.async_write_some(
+          boost::asio::null_buffers(),
+          watch_handler(DBUS_WATCH_WRITABLE, dbus_watch, w->generation));
+
+  } else if (w->armed) {
+    w->armed = 0;
+    w->generation++;
+    w->socket.cancel();
   }
 }
 
 static dbus_bool_t add_watch(DBusWatch *dbus_watch, void *data) {
-  if (!dbus_watch_get_enabled(dbus_watch)) {
-    return TRUE;
-  }
-
   boost::asio::io_service &io = *static_cast<boost::asio::io_service *>(data);
 
   int fd = dbus_watch_get_unix_fd(dbus_watch);
@@ -67,20 +84,30 @@ static dbus_bool_t add_watch(DBusWatch *dbus_watch, void *data) {
     // socket based watches
     fd = dbus_watch_get_socket(dbus_watch);
 
-  boost::asio::generic::stream_protocol::socket &socket =
-      *new boost::asio::generic::stream_protocol::socket(io);
-
-  socket.assign(boost::asio::generic::stream_protocol(0, 0), fd);
+  // Watches start out disabled as often as not (the write watch always
+  // does), and still need a socket for when they're enabled
+  fd = dup(fd);
+  if (fd == -1) {
+    return FALSE;
+  }
+  watch_socket *w = new watch_socket(io);
+  boost::system::error_code ec;
+  w->socket.assign(boost::asio::generic::stream_protocol(0, 0), fd, ec);
+  if (ec) {
+    ::close(fd);
+    delete w;
+    return FALSE;
+  }
 
-  dbus_watch_set_data(dbus_watch, &socket, NULL);
+  dbus_watch_set_data(dbus_watch, w, NULL);
 
   watch_toggled(dbus_watch, &io);
   return TRUE;
 }
 
 static void remove_watch(DBusWatch *dbus_watch, void *data) {
-  delete static_cast<boost::asio::generic::stream_protocol::socket *>(
-      dbus_watch_get_data(dbus_watch));
+  delete static_cast<watch_socket *>(dbus_watch_get_data(dbus_watch));
+  dbus_watch_set_data(dbus_watch, NULL, NULL);
 }
 
 struct timeout_handler {
@@ -125,34 +152,24 @@ static void remove_timeout(DBusTimeout *dbus_timeout, void *data) {
       dbus_timeout_get_data(dbus_timeout));
 }
 
-struct dispatch_handler {
-  boost::asio::io_service &io;
-  DBusConnection *conn;
-  dispatch_handler(boost::asio::io_service &i, DBusConnection *c)
-      : io(i), conn(c) {}
-  void operator()() {
-    if (dbus_connection_dispatch(conn) == DBUS_DISPATCH_DATA_REMAINS)
-      io.post(dispatch_handler(io, conn));
-  }
-};
-
-static void dispatch_status(DBusConnection *conn, DBusDispatchStatus new_status,
-                            void *data) {
-  boost::asio::io_service &io = *static_cast<boost::asio::io_service *>(data);
-  if (new_status == DBUS_DISPATCH_DATA_REMAINS)
-    io.post(dispatch_handler(io, conn));
-}
-
-static void set_watch_timeout_dispatch_functions(DBusConnection *conn,
-                                                 boost::asio::io_service &io) {
+static void set_watch_timeout_functions(DBusConnection *conn,
+                                        boost::asio::io_service &io) {
   dbus_connection_set_watch_functions(conn, &add_watch, &remove_watch,
                                       &watch_toggled, &io, NULL);
 
   dbus_connection_set_timeout_functions(conn, &add_timeout, &remove_timeout,
                                         &timeout_toggled, &io, NULL);
+}
+
+// A listening server's watches are driven the same way as a connection's.
+// Inline, so translation units that never run a server don't warn about it.
+inline void set_watch_timeout_functions(DBusServer *server,
+                                        boost::asio::io_service &io) {
+  dbus_server_set_watch_functions(server, &add_watch, &remove_watch,
+                                  &watch_toggled, &io, NULL);
 
-  dbus_connection_set_dispatch_status_function(conn, &dispatch_status, &io,
-                                               NULL);
+  dbus_server_set_timeout_functions(server, &add_timeout, &remove_timeout,
+                                    &timeout_toggled, &io, NULL);
 }
 
 }  // namespace detail
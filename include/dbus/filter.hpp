@@ -40,6 +40,9 @@ class filter {
 
   ~filter() { connection_->delete_filter(*this); }
 
+  /// Messages that matched and are waiting for async_dispatch.
+  std::size_t queued() { return queue_.size(); }
+
   template <typename MessageHandler>
   inline BOOST_ASIO_INITFN_RESULT_TYPE(MessageHandler,
                                        void(boost::system::error_code, message))
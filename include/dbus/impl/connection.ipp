@@ -7,7 +7,21 @@
 #define DBUS_CONNECTION_IPP
 
 #include <dbus/dbus.h>
+#include <dbus/connection_metrics.hpp>
+#include <dbus/detail/dispatch_queue.hpp>
+#include <dbus/detail/loopback.hpp>
 #include <dbus/detail/watch_timeout.hpp>
+#include <dbus/loop_monitor.hpp>
+#include <dbus/outgoing_scheduler.hpp>
+#include <dbus/trace.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #include <boost/atomic.hpp>
 
@@ -18,6 +32,28 @@ class connection {
  public:
   boost::atomic<bool> is_paused;
 
+  // Set by connection::enable_scheduler(); non-blocking sends are queued
+  // here instead of going straight to libdbus
+  std::unique_ptr<outgoing_scheduler> scheduler;
+
+  // Set by connection::enable_loop_monitor(); times the blocking calls below
+  std::unique_ptr<loop_monitor> monitor;
+
+  // Runs dispatch, and the handlers it defers, from the io_service
+  std::shared_ptr<detail::dispatch_queue> dispatch;
+
+  // Transport counters; see connection::metrics()
+  std::shared_ptr<detail::metrics_collector> metrics =
+      std::make_shared<detail::metrics_collector>();
+
+  // Serves calls from elsewhere in the process once
+  // connection::enable_loopback() is called
+  std::shared_ptr<detail::loopback_endpoint> loopback;
+
+  // The queue depth of each filter, by filter, for the metrics snapshot
+  std::mutex filters_mutex;
+  std::map<const void*, std::function<std::size_t()>> filter_depths;
+
  private:
   DBusConnection* conn;
 
@@ -36,7 +72,7 @@ class connection {
 
     dbus_connection_set_exit_on_disconnect(conn, false);
 
-    detail::set_watch_timeout_dispatch_functions(conn, io);
+    attach(io);
   }
 
   void open(boost::asio::io_service& io, const string& address) {
@@ -49,15 +85,42 @@ class connection {
 
     dbus_connection_set_exit_on_disconnect(conn, false);
 
-    detail::set_watch_timeout_dispatch_functions(conn, io);
+    attach(io);
   }
 
   void request_name(const string& name) {
+    loop_monitor::blocking_call timing(monitor.get(), "request_name");
     error e;
-    dbus_bus_request_name(
+    int result = dbus_bus_request_name(
         conn, name.c_str(),
         DBUS_NAME_FLAG_DO_NOT_QUEUE | DBUS_NAME_FLAG_REPLACE_EXISTING, e);
     e.throw_if_set();
+    // With DO_NOT_QUEUE, a name someone else holds comes back as EXISTS
+    // rather than an error; calls to it must keep going to its owner
+    if (result != DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER &&
+        result != DBUS_REQUEST_NAME_REPLY_ALREADY_OWNER) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(names_mutex);
+    if (std::find(names.begin(), names.end(), name) == names.end()) {
+      names.push_back(name);
+    }
+    if (loopback->enabled()) {
+      detail::loopback_registry::instance().add(name, loopback);
+    }
+  }
+
+  void enable_loopback() {
+    if (loopback->enabled()) {
+      return;
+    }
+    loopback->set_enabled();
+    auto& registry = detail::loopback_registry::instance();
+    registry.add(get_unique_name(), loopback);
+    std::lock_guard<std::mutex> lock(names_mutex);
+    for (auto& name : names) {
+      registry.add(name, loopback);
+    }
   }
 
   std::string get_unique_name() {
@@ -69,6 +132,12 @@ class connection {
 
   ~connection() {
     if (conn != NULL) {
+      if (loopback->enabled()) {
+        detail::loopback_registry::instance().remove(loopback.get());
+      }
+      loopback->close();
+      dispatch->detach();
+      dbus_connection_remove_filter(conn, &name_lost_callback, this);
       dbus_connection_close(conn);
       dbus_connection_unref(conn);
     }
@@ -86,10 +155,20 @@ class connection {
 
   message send_with_reply_and_block(message& m,
                                     int timeout_in_milliseconds = -1) {
+    loop_monitor::blocking_call timing(monitor.get(),
+                                       "send_with_reply_and_block");
     error e;
 
+    metrics->call_started();
+    auto sent_at = detail::metrics_collector::clock::now();
     DBusMessage* out = dbus_connection_send_with_reply_and_block(
         conn, m, timeout_in_milliseconds, e);
+    metrics->sent(m);
+    metrics->call_finished(out,
+                           detail::metrics_collector::clock::now() - sent_at);
+    if (dbus_error_has_name(e, DBUS_ERROR_NO_REPLY)) {
+      metrics->call_timed_out();
+    }
 
     e.throw_if_set();
     message reply(out);
@@ -98,14 +177,45 @@ class connection {
   }
 
   void send(message& m) {
+    // Replies to loopback calls go straight back to their caller
+    if (loopback->enabled() && loopback->complete(m)) {
+      return;
+    }
     // ignoring message serial for now
     dbus_connection_send(conn, m, NULL);
+    BOOST_DBUS_TRACE(sent, m, reinterpret_cast<std::uintptr_t>(
+                                  static_cast<DBusMessage*>(m)));
+    metrics->sent(m);
   }
 
   void send_with_reply(message& m, DBusPendingCall** p,
                        int timeout_in_milliseconds = -1) {
     // TODO(Ed) check error code
     dbus_connection_send_with_reply(conn, m, p, timeout_in_milliseconds);
+    BOOST_DBUS_TRACE(sent, m, reinterpret_cast<std::uintptr_t>(
+                                  static_cast<DBusMessage*>(m)));
+    metrics->sent(m);
+    metrics->call_started();
+  }
+
+  void register_object_path(const string& path,
+                            const DBusObjectPathVTable* vtable,
+                            void* user_data, bool fallback) {
+    error e;
+    if (fallback) {
+      dbus_connection_try_register_fallback(conn, path.c_str(), vtable,
+                                            user_data, e);
+    } else {
+      dbus_connection_try_register_object_path(conn, path.c_str(), vtable,
+                                               user_data, e);
+    }
+    e.throw_if_set();
+    loopback->add_path(path, vtable, user_data, fallback);
+  }
+
+  void unregister_object_path(const string& path) {
+    loopback->remove_path(path);
+    dbus_connection_unregister_object_path(conn, path.c_str());
   }
 
   // begin asynchronous operation
@@ -116,8 +226,8 @@ class connection {
       // If two threads call connection::async_send()
       // simultaneously on a paused connection, then
       // only one will pass the CAS instruction and
-      // only one dispatch_handler will be injected.
-      io.post(detail::dispatch_handler(io, conn));
+      // only one dispatch turn will be posted.
+      dispatch->schedule();
     }
   }
 
@@ -128,7 +238,65 @@ class connection {
     }
   }
 
-  void flush(void) { dbus_connection_flush(conn); }
+  void flush(void) {
+    loop_monitor::blocking_call timing(monitor.get(), "flush");
+    dbus_connection_flush(conn);
+  }
+
+  connection_metrics snapshot() {
+    connection_metrics s;
+    metrics->snapshot(s);
+    s.outgoing_bytes = dbus_connection_get_outgoing_size(conn);
+    if (scheduler) {
+      s.outgoing_messages = scheduler->queued();
+    }
+    s.dispatch_pending = dispatch->pending();
+    std::lock_guard<std::mutex> lock(filters_mutex);
+    for (auto& f : filter_depths) {
+      std::size_t depth = f.second();
+      s.filter_queued += depth;
+      s.max_filter_queued = std::max<uint64>(s.max_filter_queued, depth);
+    }
+    return s;
+  }
+
+ private:
+  // Names taken with request_name() and not lost since, for
+  // enable_loopback().  request_name() runs on the caller's thread and
+  // NameLost arrives on the io_service's.
+  std::mutex names_mutex;
+  std::vector<string> names;
+
+  // The bus tells the owner when a name is taken over or released, without
+  // it having to add a match rule
+  static DBusHandlerResult name_lost_callback(DBusConnection*,
+                                              DBusMessage* m, void* userdata) {
+    const char* name = nullptr;
+    if (dbus_message_is_signal(m, DBUS_INTERFACE_DBUS, "NameLost") &&
+        dbus_message_has_sender(m, DBUS_SERVICE_DBUS) &&
+        dbus_message_get_args(m, nullptr, DBUS_TYPE_STRING, &name,
+                              DBUS_TYPE_INVALID)) {
+      static_cast<connection*>(userdata)->name_lost(name);
+    }
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+  }
+
+  void name_lost(const string& name) {
+    std::lock_guard<std::mutex> lock(names_mutex);
+    names.erase(std::remove(names.begin(), names.end(), name), names.end());
+    detail::loopback_registry::instance().remove(name, loopback.get());
+  }
+
+  void attach(boost::asio::io_service& io) {
+    detail::set_watch_timeout_functions(conn, io);
+    loopback = std::make_shared<detail::loopback_endpoint>(io, conn);
+    dispatch = std::make_shared<detail::dispatch_queue>(io, conn, metrics);
+    dispatch->attach();
+    // First, so it sees every message before a filter can claim it
+    dbus_connection_add_filter(
+        conn, &detail::metrics_collector::filter_callback, metrics.get(), NULL);
+    dbus_connection_add_filter(conn, &name_lost_callback, this, NULL);
+  }
 };
 
 }  // namespace impl
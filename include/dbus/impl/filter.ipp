@@ -14,7 +14,9 @@ inline DBusHandlerResult filter_callback(DBusConnection* c, DBusMessage* m,
   try {
     filter& f = *static_cast<filter*>(userdata);
     message m_(m);
-    if (f.offer(m_)) {
+    bool matched = f.offer(m_);
+    BOOST_DBUS_TRACE(filter_offer, m, matched);
+    if (matched) {
       return DBUS_HANDLER_RESULT_HANDLED;
     }
   } catch (...) {
@@ -28,10 +30,14 @@ inline DBusHandlerResult filter_callback(DBusConnection* c, DBusMessage* m,
 
 void connection_service::new_filter(implementation_type& impl, filter& f) {
   dbus_connection_add_filter(impl, &impl::filter_callback, &f, NULL);
+  std::lock_guard<std::mutex> lock(impl.filters_mutex);
+  impl.filter_depths[&f] = [&f]() { return f.queued(); };
 }
 
 void connection_service::delete_filter(implementation_type& impl, filter& f) {
   dbus_connection_remove_filter(impl, &impl::filter_callback, &f);
+  std::lock_guard<std::mutex> lock(impl.filters_mutex);
+  impl.filter_depths.erase(&f);
 }
 
 }  // namespace dbus
@@ -8,6 +8,7 @@
 
 namespace dbus {
 void connection_service::new_match(implementation_type& impl, match& m) {
+  loop_monitor::blocking_call timing(impl.monitor.get(), "add_match");
   error e;
   dbus_bus_add_match(impl, m.get_expression().c_str(), e);
   e.throw_if_set();
@@ -16,6 +17,7 @@ void connection_service::new_match(implementation_type& impl, match& m) {
 }
 
 void connection_service::delete_match(implementation_type& impl, match& m) {
+  loop_monitor::blocking_call timing(impl.monitor.get(), "remove_match");
   error e;
   dbus_bus_remove_match(impl, m.get_expression().c_str(), e);
   e.throw_if_set();
@@ -0,0 +1,248 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_LOOP_MONITOR_HPP
+#define DBUS_LOOP_MONITOR_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#if defined(__GLIBC__)
+#include <execinfo.h>
+#endif
+
+namespace dbus {
+
+/// Finds what stalls a connection's io_service.
+/**
+ * A diagnostic, installed with connection::enable_loop_monitor().  It does
+ * two things:
+ *
+ * - Times every call into libdbus that blocks (blocking sends and
+ *   method_call, request_name, adding and removing matches, flush) and
+ *   reports those made on a thread that runs the io_service, along with
+ *   the stack they were made from.  Every other handler on that
+ *   io_service waits for them.
+ *
+ * - Runs a probe timer and reports whenever it fires later than it should
+ *   by more than the lag threshold, whatever held the io_service up.
+ *
+ * A thread counts as an io thread once it has run one of the probe's
+ * handlers, so start() the monitor before the stalls of interest, and give
+ * multi-threaded io_services a few probe intervals to be seen on every
+ * thread.  Reports go to the handler, on the thread that saw them.
+ */
+class loop_monitor {
+ public:
+  typedef std::chrono::steady_clock clock;
+
+  struct violation {
+    enum class kind { blocking_call, lag };
+    kind what;
+    /// The blocking libdbus call, or "lag" for a late probe.
+    const char* operation;
+    /// How long the call blocked, or how late the probe ran.
+    clock::duration duration;
+    std::thread::id thread;
+    /// Return addresses, innermost first; empty for lag, or where the C
+    /// library can't walk the stack.  backtrace_symbols() names them.
+    std::vector<void*> stack;
+  };
+
+  struct counters {
+    std::uint64_t blocking_calls = 0;
+    std::uint64_t blocking_calls_on_io_thread = 0;
+    clock::duration max_blocking = clock::duration::zero();
+    std::uint64_t probes = 0;
+    std::uint64_t late_probes = 0;
+    clock::duration max_lag = clock::duration::zero();
+  };
+
+  typedef std::function<void(const violation&)> violation_handler;
+
+  loop_monitor(boost::asio::io_service& io, violation_handler handler)
+      : state_(std::make_shared<state>(io, std::move(handler))) {}
+
+  loop_monitor(const loop_monitor&) = delete;
+  loop_monitor& operator=(const loop_monitor&) = delete;
+
+  ~loop_monitor() { stop(); }
+
+  /// How often the probe timer runs.  Takes effect straight away.
+  void set_probe_interval(clock::duration d) {
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      state_->probe_interval = d;
+      boost::system::error_code ignored;
+      state_->timer.cancel(ignored);
+    }
+    state_->arm();
+  }
+
+  /// Report probes later than this.
+  void set_lag_threshold(clock::duration d) {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->lag_threshold = d;
+  }
+
+  /// Report blocking calls on io threads that take at least this long;
+  /// zero, the default, reports them all.
+  void set_blocking_threshold(clock::duration d) {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->blocking_threshold = d;
+  }
+
+  void start() {
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      if (state_->running) {
+        return;
+      }
+      state_->running = true;
+    }
+    state_->arm();
+  }
+
+  void stop() {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->running = false;
+    boost::system::error_code ignored;
+    state_->timer.cancel(ignored);
+  }
+
+  counters get_counters() const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->totals;
+  }
+
+  /// Whether the calling thread has been seen running the io_service.
+  bool on_io_thread() const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->io_threads.count(std::this_thread::get_id()) != 0;
+  }
+
+  /// Times one blocking libdbus call, made while it's in scope.
+  class blocking_call {
+   public:
+    /// monitor may be null, in which case nothing is timed.
+    blocking_call(loop_monitor* monitor, const char* operation)
+        : monitor_(monitor), operation_(operation) {
+      if (monitor_ != nullptr) {
+        start_ = clock::now();
+      }
+    }
+
+    ~blocking_call() {
+      if (monitor_ != nullptr) {
+        monitor_->blocked(operation_, clock::now() - start_);
+      }
+    }
+
+    blocking_call(const blocking_call&) = delete;
+    blocking_call& operator=(const blocking_call&) = delete;
+
+   private:
+    loop_monitor* monitor_;
+    const char* operation_;
+    clock::time_point start_;
+  };
+
+ private:
+  struct state : std::enable_shared_from_this<state> {
+    state(boost::asio::io_service& io, violation_handler handler)
+        : timer(io), handler(std::move(handler)) {}
+
+    void arm() {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!running) {
+        return;
+      }
+      due = clock::now() + probe_interval;
+      timer.expires_at(due);
+      std::weak_ptr<state> weak = shared_from_this();
+      timer.async_wait([weak](boost::system::error_code ec) {
+        if (ec) return;
+        if (auto s = weak.lock()) s->probe();
+      });
+    }
+
+    void probe() {
+      clock::duration lag = clock::now() - due;
+      bool late;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        io_threads.insert(std::this_thread::get_id());
+        totals.probes++;
+        totals.max_lag = std::max(totals.max_lag, lag);
+        late = lag > lag_threshold;
+        if (late) {
+          totals.late_probes++;
+        }
+      }
+      if (late && handler) {
+        violation v{violation::kind::lag, "lag", lag,
+                    std::this_thread::get_id(), {}};
+        handler(v);
+      }
+      arm();
+    }
+
+    boost::asio::steady_timer timer;
+    violation_handler handler;
+    mutable std::mutex mutex;
+    bool running = false;
+    clock::time_point due;
+    clock::duration probe_interval = std::chrono::milliseconds(100);
+    clock::duration lag_threshold = std::chrono::milliseconds(20);
+    clock::duration blocking_threshold = clock::duration::zero();
+    std::set<std::thread::id> io_threads;
+    counters totals;
+  };
+
+  void blocked(const char* operation, clock::duration d) {
+    bool report;
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      counters& c = state_->totals;
+      c.blocking_calls++;
+      c.max_blocking = std::max(c.max_blocking, d);
+      report = state_->io_threads.count(std::this_thread::get_id()) != 0;
+      if (report) {
+        c.blocking_calls_on_io_thread++;
+      }
+      report = report && d >= state_->blocking_threshold;
+    }
+    if (report && state_->handler) {
+      violation v{violation::kind::blocking_call, operation, d,
+                  std::this_thread::get_id(), stack()};
+      state_->handler(v);
+    }
+  }
+
+  static std::vector<void*> stack() {
+    std::vector<void*> frames;
+#if defined(__GLIBC__)
+    frames.resize(32);
+    int n = backtrace(frames.data(), static_cast<int>(frames.size()));
+    frames.resize(n > 0 ? n : 0);
+#endif
+    return frames;
+  }
+
+  std::shared_ptr<state> state_;
+};
+
+}  // namespace dbus
+
+#endif  // DBUS_LOOP_MONITOR_HPP
@@ -15,6 +15,7 @@
 #include <boost/intrusive_ptr.hpp>
 #include <boost/mpl/for_each.hpp>
 #include <boost/utility/enable_if.hpp>
+#include <boost/utility/string_view.hpp>
 
 inline void intrusive_ptr_add_ref(DBusMessage* m) { dbus_message_ref(m); }
 
@@ -71,6 +72,17 @@ class message {
     return x;
   }
 
+  /// Create an unlocked copy of a message, with no serial set
+  /**
+   * Copying a prebuilt message skips validating and marshalling the header
+   * fields again, which makes it a cheap way to stamp out repeated calls.
+   */
+  static message new_copy(const message& m) {
+    auto x = message(dbus_message_copy(m));
+    dbus_message_unref(x.message_.get());
+    return x;
+  }
+
   message() = delete;
 
   message(DBusMessage* m) : message_(m) {}
@@ -108,6 +120,21 @@ class message {
     return sanitize(dbus_message_get_destination(message_.get()));
   }
 
+  // Views straight into the message header, for lookups that shouldn't
+  // allocate.  Valid for as long as the message is; empty if the field is
+  // unset.
+  boost::string_view get_path_view() const {
+    return view(dbus_message_get_path(message_.get()));
+  }
+
+  boost::string_view get_interface_view() const {
+    return view(dbus_message_get_interface(message_.get()));
+  }
+
+  boost::string_view get_member_view() const {
+    return view(dbus_message_get_member(message_.get()));
+  }
+
   uint32 get_serial() { return dbus_message_get_serial(message_.get()); }
 
   message& set_serial(uint32 serial) {
@@ -115,6 +142,16 @@ class message {
     return *this;
   }
 
+  message& set_destination(const string& destination) {
+    dbus_message_set_destination(message_.get(), destination.c_str());
+    return *this;
+  }
+
+  message& set_no_reply(bool no_reply = true) {
+    dbus_message_set_no_reply(message_.get(), no_reply);
+    return *this;
+  }
+
   uint32 get_reply_serial() {
     return dbus_message_get_reply_serial(message_.get());
   }
@@ -182,16 +219,24 @@ class message {
     }
 
     template <typename Key, typename Value>
-    bool pack(const std::pair<Key, Value> element) {
+    bool pack(const std::pair<Key, Value>& element) {
+      return pack_dict_entry(element.first, element.second);
+    }
+
+    // Packs a single dict entry from a key and value held elsewhere, so
+    // callers with data spread across several containers don't need to build
+    // an intermediate std::pair
+    template <typename Key, typename Value>
+    bool pack_dict_entry(const Key& key, const Value& value) {
       message::packer dict_entry;
       if (iter_.open_container(DBUS_TYPE_DICT_ENTRY, NULL, dict_entry.iter_) ==
           false) {
         return false;
       }
-      if (dict_entry.pack(element.first) == false) {
+      if (dict_entry.pack(key) == false) {
         return false;
       };
-      if (dict_entry.pack(element.second) == false) {
+      if (dict_entry.pack(value) == false) {
         return false;
       };
       return iter_.close_container(dict_entry.iter_);
@@ -217,11 +262,15 @@ class message {
           },
           v);
       message::packer sub;
-      iter_.open_container(element<dbus_variant>::code, type, sub.iter_);
-      boost::apply_visitor([&](const auto& val) { sub.pack(val); }, v);
-      iter_.close_container(sub.iter_);
-
-      return true;
+      if (iter_.open_container(element<dbus_variant>::code, type, sub.iter_) ==
+          false) {
+        return false;
+      }
+      if (boost::apply_visitor(
+              [&](const auto& val) { return sub.pack(val); }, v) == false) {
+        return false;
+      }
+      return iter_.close_container(sub.iter_);
     }
   };
 
@@ -459,6 +508,10 @@ class message {
   static std::string sanitize(const char* str) {
     return (str == NULL) ? "(null)" : str;
   }
+
+  static boost::string_view view(const char* str) {
+    return (str == NULL) ? boost::string_view() : boost::string_view(str);
+  }
 };
 
 inline std::ostream& operator<<(std::ostream& os, const message& m) {
@@ -516,20 +569,22 @@ struct function_traits<R (T::*)(Args...) const> {
   using decayed_arg_types = std::tuple<typename std::decay<Args>::type...>;
 };
 
+// These forward the callee's return type unchanged, so handlers that return a
+// reference to stored state don't have it copied on the way out
 template <class F, size_t... Is>
-constexpr auto index_apply_impl(F f, std::index_sequence<Is...>) {
+constexpr decltype(auto) index_apply_impl(F f, std::index_sequence<Is...>) {
   return f(std::integral_constant<size_t, Is>{}...);
 }
 
 template <size_t N, class F>
-constexpr auto index_apply(F f) {
+constexpr decltype(auto) index_apply(F f) {
   return index_apply_impl(f, std::make_index_sequence<N>{});
 }
 
 template <class Tuple, class F>
-constexpr auto apply(F f, Tuple& t) {
+constexpr decltype(auto) apply(F f, Tuple& t) {
   return index_apply<std::tuple_size<Tuple>{}>(
-      [&](auto... Is) { return f(std::get<Is>(t)...); });
+      [&](auto... Is) -> decltype(auto) { return f(std::get<Is>(t)...); });
 }
 
 template <class Tuple>
@@ -0,0 +1,224 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_METHOD_PROFILER_HPP
+#define DBUS_METHOD_PROFILER_HPP
+
+#include <dbus/connection.hpp>
+#include <dbus/connection_metrics.hpp>
+#include <dbus/detail/call_scope.hpp>
+#include <dbus/detail/dispatch_queue.hpp>
+#include <dbus/message.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace dbus {
+
+/// Times the method handlers a DbusObjectServer runs.
+/**
+ * Installed with DbusObjectServer::enable_profiling().  Every handled call
+ * is counted against its object path, interface and member, along with
+ * whether it was answered with an error, how long the handler ran and how
+ * long the call waited to be dispatched.  Calls are also counted by sender.
+ *
+ * Handler time is measured around the synchronous part of the handler; a
+ * handler that answers later (one waiting on peer credentials, say) is
+ * timed up to the point it returned.  Queueing delay runs from the stamp
+ * the connection's dispatch queue put on the call as it took it in, the
+ * moment its dispatch turn was scheduled, so it covers the wait for the
+ * io_service and for the calls dispatched ahead of it in the same turn.
+ *
+ * Recording runs on the dispatching thread, as do snapshot() and report().
+ */
+class method_profiler {
+ public:
+  typedef std::chrono::steady_clock clock;
+
+  struct histogram {
+    std::array<uint64, connection_metrics::latency_buckets> buckets{};
+    uint64 count = 0;
+    clock::duration total = clock::duration::zero();
+    clock::duration max = clock::duration::zero();
+
+    void record(clock::duration d) {
+      buckets[connection_metrics::latency_bucket(d)]++;
+      count++;
+      total += d;
+      max = std::max(max, d);
+    }
+
+    clock::duration mean() const {
+      return count == 0 ? clock::duration::zero()
+                        : total / static_cast<clock::rep>(count);
+    }
+
+    std::chrono::microseconds percentile(double q) const {
+      return connection_metrics::percentile(buckets, q);
+    }
+  };
+
+  struct method_stats {
+    std::string path;
+    std::string interface;
+    std::string member;
+    uint64 calls = 0;
+    uint64 errors = 0;
+    histogram handler_time;
+    histogram queue_delay;
+  };
+
+  struct profile {
+    /// Busiest first, by total handler time.
+    std::vector<method_stats> methods;
+    std::map<std::string, uint64> calls_by_sender;
+  };
+
+  explicit method_profiler(connection_ptr c) : connection_(c) {
+    connection_->get_implementation().dispatch->stamp_intake(true);
+  }
+
+  method_profiler(const method_profiler&) = delete;
+  method_profiler& operator=(const method_profiler&) = delete;
+
+  /// Count calls to any object below prefix under prefix + "/*", so that
+  /// per-instance objects share a row.
+  void add_path_pattern(const std::string& prefix) {
+    patterns_.push_back(prefix);
+  }
+
+  /// Track at most n distinct senders; calls from any more are counted
+  /// under "*".
+  void set_max_senders(std::size_t n) { max_senders_ = n; }
+
+  void reset() {
+    methods_.clear();
+    senders_.clear();
+  }
+
+  /// Run call(), the handler for m, and record it if it handled m.
+  template <typename Call>
+  bool record(message& m, Call&& call) {
+    clock::time_point waiting = detail::dispatch_queue::intake_time(m);
+    clock::time_point start = clock::now();
+    detail::call_scope scope(m);
+    bool handled;
+    try {
+      handled = call();
+    } catch (...) {
+      finish(m, waiting, start, true);
+      throw;
+    }
+    if (handled) {
+      finish(m, waiting, start, scope.failed());
+    }
+    return handled;
+  }
+
+  profile snapshot() const {
+    profile p;
+    p.methods.reserve(methods_.size());
+    for (auto& m : methods_) {
+      p.methods.push_back(m.second);
+    }
+    std::sort(p.methods.begin(), p.methods.end(),
+              [](const method_stats& a, const method_stats& b) {
+                return a.handler_time.total > b.handler_time.total;
+              });
+    p.calls_by_sender = senders_;
+    return p;
+  }
+
+  /// snapshot() as a table, busiest method first, times in microseconds.
+  std::string report() const {
+    profile p = snapshot();
+    std::ostringstream out;
+    out << std::setw(10) << "calls" << std::setw(8) << "errors"
+        << std::setw(10) << "mean" << std::setw(10) << "p50" << std::setw(10)
+        << "p99" << std::setw(10) << "max" << std::setw(10) << "queue p99"
+        << "  method\n";
+    for (auto& m : p.methods) {
+      out << std::setw(10) << m.calls << std::setw(8) << m.errors
+          << std::setw(10) << micros(m.handler_time.mean()) << std::setw(10)
+          << m.handler_time.percentile(0.5).count() << std::setw(10)
+          << m.handler_time.percentile(0.99).count() << std::setw(10)
+          << micros(m.handler_time.max) << std::setw(10)
+          << m.queue_delay.percentile(0.99).count() << "  " << m.path << " "
+          << m.interface << "." << m.member << "\n";
+    }
+    out << "\n" << std::setw(10) << "calls" << "  sender\n";
+    for (auto& s : p.calls_by_sender) {
+      out << std::setw(10) << s.second << "  " << s.first << "\n";
+    }
+    return out.str();
+  }
+
+ private:
+  typedef std::tuple<std::string, std::string, std::string> method_key;
+
+  static long long micros(clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+  }
+
+  std::string path_of(message& m) const {
+    std::string path = m.get_path();
+    for (auto& prefix : patterns_) {
+      if (path.size() > prefix.size() + 1 &&
+          path.compare(0, prefix.size(), prefix) == 0 &&
+          path[prefix.size()] == '/') {
+        return prefix + "/*";
+      }
+    }
+    return path;
+  }
+
+  void finish(message& m, clock::time_point waiting, clock::time_point start,
+              bool failed) {
+    clock::time_point end = clock::now();
+    method_key key(path_of(m), m.get_interface(), m.get_member());
+    auto it = methods_.find(key);
+    if (it == methods_.end()) {
+      it = methods_.emplace(key, method_stats()).first;
+      it->second.path = std::get<0>(key);
+      it->second.interface = std::get<1>(key);
+      it->second.member = std::get<2>(key);
+    }
+    method_stats& s = it->second;
+    s.calls++;
+    if (failed) {
+      s.errors++;
+    }
+    s.handler_time.record(end - start);
+    s.queue_delay.record(waiting == clock::time_point()
+                             ? clock::duration::zero()
+                             : start - waiting);
+
+    std::string sender = m.get_sender();
+    auto counted = senders_.find(sender);
+    if (counted != senders_.end()) {
+      counted->second++;
+    } else if (senders_.size() < max_senders_) {
+      senders_.emplace(sender, 1);
+    } else {
+      senders_["*"]++;
+    }
+  }
+
+  connection_ptr connection_;
+  std::vector<std::string> patterns_;
+  std::size_t max_senders_ = 1024;
+  std::map<method_key, method_stats> methods_;
+  std::map<std::string, uint64> senders_;
+};
+
+}  // namespace dbus
+
+#endif  // DBUS_METHOD_PROFILER_HPP
@@ -0,0 +1,497 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_MOCK_BUS_HPP
+#define DBUS_MOCK_BUS_HPP
+
+#include <dbus/dbus.h>
+#include <dbus/detail/match_rule.hpp>
+#include <dbus/detail/watch_timeout.hpp>
+#include <dbus/element.hpp>
+#include <dbus/error.hpp>
+#include <dbus/message.hpp>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <boost/asio.hpp>
+
+namespace dbus {
+
+/// A bus of our own, brokered from a thread in this process.
+/**
+ * Stands in for dbus-daemon in tests and benchmarks: connections opened
+ * with connection(io, address()) are registered, own names and add match
+ * rules as they would on a real bus, and their messages are routed between
+ * them by destination, or to every connection with a matching rule.  The
+ * broker answers Hello, RequestName, ReleaseName, AddMatch, RemoveMatch,
+ * GetNameOwner, NameHasOwner, ListNames, GetId, GetConnectionUnixUser,
+ * GetConnectionUnixProcessID and GetConnectionCredentials, and sends
+ * NameOwnerChanged, NameAcquired and NameLost.
+ *
+ * Differences from dbus-daemon:
+ * - There's no security policy, service activation or eavesdropping.
+ * - Name requests are never queued; a taken name that can't be replaced
+ *   gets DBUS_REQUEST_NAME_REPLY_EXISTS.
+ * - Replies are routed like any other unicast message, whether or not a
+ *   call is waiting for them.
+ *
+ * libdbus has no public in-memory transport, so connections reach the
+ * broker through a socket in a temporary directory.  Since the blocking
+ * calls of connection need the broker to answer them, it runs on its own
+ * io_service and thread, which the destructor stops.
+ */
+class mock_bus {
+ public:
+  mock_bus()
+      : work_(io_), server_(nullptr), stamp_senders_(true), next_id_(1) {
+    dbus_threads_init_default();
+    error e;
+    server_ = dbus_server_listen("unix:tmpdir=/tmp", e);
+    e.throw_if_set();
+    char* address = dbus_server_get_address(server_);
+    address_ = address;
+    dbus_free(address);
+    char* id = dbus_server_get_id(server_);
+    id_ = id;
+    dbus_free(id);
+
+    dbus_server_set_new_connection_function(server_, &on_new_connection,
+                                            this, nullptr);
+    detail::set_watch_timeout_functions(server_, io_);
+    thread_ = std::thread([this]() { io_.run(); });
+  }
+
+  ~mock_bus() {
+    // libdbus objects are only touched from the broker's thread
+    io_.post([this]() {
+      dbus_server_disconnect(server_);
+      for (auto& p : peers_) {
+        dbus_connection_close(p.first);
+        dbus_connection_unref(p.first);
+      }
+      peers_.clear();
+      io_.stop();
+    });
+    thread_.join();
+    dbus_server_unref(server_);
+  }
+
+  mock_bus(const mock_bus&) = delete;
+  mock_bus& operator=(const mock_bus&) = delete;
+
+  /// The address to open connections to.
+  const std::string& address() const { return address_; }
+
+  /// Whether to overwrite each message's sender with its connection's name.
+  /**
+   * On by default, as dbus-daemon does.  Off, messages other than those to
+   * the broker itself are routed with whatever sender they arrived with,
+   * as on a peer-to-peer connection, where nothing rewrites the header.
+   */
+  void set_stamp_senders(bool stamp) { stamp_senders_ = stamp; }
+
+ private:
+  struct peer {
+    std::string unique_name;  // empty until Hello
+    std::vector<detail::match_rule> rules;
+  };
+
+  struct owned_name {
+    DBusConnection* conn;
+    bool allow_replacement;
+  };
+
+  static void on_new_connection(DBusServer*, DBusConnection* conn,
+                                void* data) {
+    static_cast<mock_bus*>(data)->accept(conn);
+  }
+
+  static void on_dispatch_status(DBusConnection* conn,
+                                 DBusDispatchStatus status, void* data) {
+    if (status == DBUS_DISPATCH_DATA_REMAINS) {
+      static_cast<mock_bus*>(data)->schedule_dispatch(conn);
+    }
+  }
+
+  static DBusHandlerResult on_message(DBusConnection* conn, DBusMessage* m,
+                                      void* data) {
+    static_cast<mock_bus*>(data)->receive(conn, message(m));
+    return DBUS_HANDLER_RESULT_HANDLED;
+  }
+
+  void accept(DBusConnection* conn) {
+    dbus_connection_ref(conn);
+    dbus_connection_set_exit_on_disconnect(conn, false);
+    peers_[conn];
+    dbus_connection_add_filter(conn, &on_message, this, nullptr);
+    dbus_connection_set_dispatch_status_function(conn, &on_dispatch_status,
+                                                 this, nullptr);
+    detail::set_watch_timeout_functions(conn, io_);
+    schedule_dispatch(conn);
+  }
+
+  void schedule_dispatch(DBusConnection* conn) {
+    // One message per turn, so that a busy connection can't starve the
+    // others.  A connection dropped in the meantime is no longer a peer.
+    io_.post([this, conn]() {
+      if (peers_.count(conn) &&
+          dbus_connection_dispatch(conn) == DBUS_DISPATCH_DATA_REMAINS) {
+        schedule_dispatch(conn);
+      }
+    });
+  }
+
+  void receive(DBusConnection* conn, message m) {
+    if (dbus_message_is_signal(m, DBUS_INTERFACE_LOCAL, "Disconnected")) {
+      drop(conn);
+      return;
+    }
+    auto it = peers_.find(conn);
+    if (it == peers_.end()) {
+      return;
+    }
+    peer& p = it->second;
+    bool to_driver = dbus_message_has_destination(m, DBUS_SERVICE_DBUS);
+    if (p.unique_name.empty()) {
+      // As the daemon does, disconnect clients that don't start with Hello
+      if (to_driver && dbus_message_is_method_call(m, DBUS_INTERFACE_DBUS,
+                                                   "Hello")) {
+        hello(conn, p, m);
+      } else {
+        dbus_connection_close(conn);
+      }
+      return;
+    }
+
+    if (stamp_senders_ || to_driver) {
+      dbus_message_set_sender(m, p.unique_name.c_str());
+    }
+    if (to_driver) {
+      driver(conn, p, m);
+    } else {
+      route(m);
+    }
+  }
+
+  void route(message& m) {
+    const char* destination = dbus_message_get_destination(m);
+    if (destination != nullptr) {
+      DBusConnection* to = owner(destination);
+      if (to != nullptr) {
+        dbus_connection_send(to, m, nullptr);
+      } else if (dbus_message_get_type(m) == DBUS_MESSAGE_TYPE_METHOD_CALL &&
+                 !dbus_message_get_no_reply(m)) {
+        from_driver(message::new_error(
+            m, DBUS_ERROR_SERVICE_UNKNOWN,
+            "The name " + string(destination) +
+                " was not provided by any .service files"));
+      }
+      return;
+    }
+
+    auto owner_of = [this](const std::string& name) {
+      return owner_name(name);
+    };
+    for (auto& p : peers_) {
+      for (auto& rule : p.second.rules) {
+        if (rule.matches(m, owner_of)) {
+          dbus_connection_send(p.first, m, nullptr);
+          break;
+        }
+      }
+    }
+  }
+
+  void hello(DBusConnection* conn, peer& p, message& m) {
+    p.unique_name = ":1." + std::to_string(next_id_++);
+    unique_[p.unique_name] = conn;
+    message r = message::new_return(m);
+    r.set_destination(p.unique_name);
+    r.pack(p.unique_name);
+    from_driver(r);
+    signal(p.unique_name, "NameAcquired", p.unique_name);
+    signal("", "NameOwnerChanged", p.unique_name, std::string(),
+           p.unique_name);
+    flush_signals();
+  }
+
+  // Calls to org.freedesktop.DBus; the reply goes out ahead of any
+  // signals the call caused
+  void driver(DBusConnection* conn, peer& p, message& m) {
+    const char* interface = dbus_message_get_interface(m);
+    std::string member = m.get_member();
+    message r = message::new_return(m);
+    std::string name;
+    uint32 flags = 0;
+
+    if (interface != nullptr &&
+        string(interface) == DBUS_INTERFACE_PEER && member == "Ping") {
+      // The empty reply is all a ping needs
+    } else if (interface != nullptr &&
+               string(interface) != DBUS_INTERFACE_DBUS) {
+      r = unknown_method(m);
+    } else if (member == "Hello") {
+      r = message::new_error(m, DBUS_ERROR_FAILED,
+                             "Already handled an Hello message");
+    } else if (member == "RequestName") {
+      if (!m.unpack(name, flags) || !valid_well_known(name)) {
+        r = invalid_args(m);
+      } else {
+        r.pack(request_name(conn, p, name, flags));
+      }
+    } else if (member == "ReleaseName") {
+      if (!m.unpack(name) || !valid_well_known(name)) {
+        r = invalid_args(m);
+      } else {
+        r.pack(release_name(conn, p, name));
+      }
+    } else if (member == "AddMatch" || member == "RemoveMatch") {
+      std::string rule;
+      try {
+        if (!m.unpack(rule)) {
+          throw std::invalid_argument("expected a match rule string");
+        }
+        detail::match_rule parsed(rule);
+        if (member == "AddMatch") {
+          p.rules.push_back(parsed);
+        } else {
+          auto it = std::find(p.rules.begin(), p.rules.end(), parsed);
+          if (it == p.rules.end()) {
+            r = message::new_error(
+                m, DBUS_ERROR_MATCH_RULE_NOT_FOUND,
+                "The given match rule wasn't found and can't be removed");
+          } else {
+            p.rules.erase(it);
+          }
+        }
+      } catch (const std::invalid_argument& e) {
+        r = message::new_error(m, DBUS_ERROR_MATCH_RULE_INVALID, e.what());
+      }
+    } else if (member == "GetNameOwner") {
+      if (!m.unpack(name)) {
+        r = invalid_args(m);
+      } else if (owner_name(name).empty()) {
+        r = no_owner(m, name);
+      } else {
+        r.pack(owner_name(name));
+      }
+    } else if (member == "NameHasOwner") {
+      if (!m.unpack(name)) {
+        r = invalid_args(m);
+      } else {
+        r.pack(!owner_name(name).empty());
+      }
+    } else if (member == "ListNames") {
+      std::vector<std::string> names{DBUS_SERVICE_DBUS};
+      for (auto& u : unique_) {
+        names.push_back(u.first);
+      }
+      for (auto& n : names_) {
+        names.push_back(n.first);
+      }
+      r.pack(names);
+    } else if (member == "GetId") {
+      r.pack(id_);
+    } else if (member == "GetConnectionUnixUser" ||
+               member == "GetConnectionUnixProcessID" ||
+               member == "GetConnectionCredentials") {
+      DBusConnection* of = nullptr;
+      if (!m.unpack(name)) {
+        r = invalid_args(m);
+      } else if ((of = owner(name)) == nullptr) {
+        r = no_owner(m, name);
+      } else {
+        r = credentials(m, member, of);
+      }
+    } else {
+      r = unknown_method(m);
+    }
+    from_driver(r);
+    flush_signals();
+  }
+
+  message credentials(message& m, const std::string& member,
+                      DBusConnection* of) {
+    unsigned long uid = 0, pid = 0;
+    bool has_uid = dbus_connection_get_unix_user(of, &uid);
+    bool has_pid = dbus_connection_get_unix_process_id(of, &pid);
+    message r = message::new_return(m);
+    if (member == "GetConnectionCredentials") {
+      std::vector<std::pair<std::string, dbus_variant>> v;
+      if (has_uid) {
+        v.emplace_back("UnixUserID", static_cast<uint32>(uid));
+      }
+      if (has_pid) {
+        v.emplace_back("ProcessID", static_cast<uint32>(pid));
+      }
+      r.pack(v);
+    } else if (member == "GetConnectionUnixUser" && has_uid) {
+      r.pack(static_cast<uint32>(uid));
+    } else if (member == "GetConnectionUnixProcessID" && has_pid) {
+      r.pack(static_cast<uint32>(pid));
+    } else {
+      r = message::new_error(m, DBUS_ERROR_FAILED,
+                             "Could not determine the peer's credentials");
+    }
+    return r;
+  }
+
+  uint32 request_name(DBusConnection* conn, peer& p, const std::string& name,
+                      uint32 flags) {
+    bool allow_replacement = flags & DBUS_NAME_FLAG_ALLOW_REPLACEMENT;
+    auto it = names_.find(name);
+    if (it == names_.end()) {
+      names_[name] = owned_name{conn, allow_replacement};
+      signal("", "NameOwnerChanged", name, std::string(), p.unique_name);
+      signal(p.unique_name, "NameAcquired", name);
+      return DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER;
+    }
+    if (it->second.conn == conn) {
+      it->second.allow_replacement = allow_replacement;
+      return DBUS_REQUEST_NAME_REPLY_ALREADY_OWNER;
+    }
+    if (!(flags & DBUS_NAME_FLAG_REPLACE_EXISTING) ||
+        !it->second.allow_replacement) {
+      return DBUS_REQUEST_NAME_REPLY_EXISTS;
+    }
+    std::string old_owner = peers_[it->second.conn].unique_name;
+    it->second = owned_name{conn, allow_replacement};
+    signal(old_owner, "NameLost", name);
+    signal("", "NameOwnerChanged", name, old_owner, p.unique_name);
+    signal(p.unique_name, "NameAcquired", name);
+    return DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER;
+  }
+
+  uint32 release_name(DBusConnection* conn, peer& p,
+                      const std::string& name) {
+    auto it = names_.find(name);
+    if (it == names_.end()) {
+      return DBUS_RELEASE_NAME_REPLY_NON_EXISTENT;
+    }
+    if (it->second.conn != conn) {
+      return DBUS_RELEASE_NAME_REPLY_NOT_OWNER;
+    }
+    names_.erase(it);
+    signal(p.unique_name, "NameLost", name);
+    signal("", "NameOwnerChanged", name, p.unique_name, std::string());
+    return DBUS_RELEASE_NAME_REPLY_RELEASED;
+  }
+
+  // A client went away: its names go with it
+  void drop(DBusConnection* conn) {
+    auto it = peers_.find(conn);
+    if (it == peers_.end()) {
+      return;
+    }
+    std::string unique_name = it->second.unique_name;
+    peers_.erase(it);
+    unique_.erase(unique_name);
+    for (auto n = names_.begin(); n != names_.end();) {
+      if (n->second.conn == conn) {
+        signal("", "NameOwnerChanged", n->first, unique_name, std::string());
+        n = names_.erase(n);
+      } else {
+        ++n;
+      }
+    }
+    if (!unique_name.empty()) {
+      signal("", "NameOwnerChanged", unique_name, unique_name,
+             std::string());
+    }
+    flush_signals();
+    dbus_connection_unref(conn);
+  }
+
+  DBusConnection* owner(const std::string& name) {
+    if (!name.empty() && name[0] == ':') {
+      auto it = unique_.find(name);
+      return it == unique_.end() ? nullptr : it->second;
+    }
+    auto it = names_.find(name);
+    return it == names_.end() ? nullptr : it->second.conn;
+  }
+
+  std::string owner_name(const std::string& name) {
+    if (name == DBUS_SERVICE_DBUS) {
+      return name;
+    }
+    DBusConnection* conn = owner(name);
+    return conn == nullptr ? std::string() : peers_[conn].unique_name;
+  }
+
+  // Queue a signal from the bus, to destination or, if that's empty, to
+  // every connection with a matching rule
+  template <typename... Args>
+  void signal(const std::string& destination, const std::string& member,
+              const Args&... args) {
+    message s = message::new_signal(
+        endpoint(DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS),
+        member);
+    s.pack(args...);
+    if (!destination.empty()) {
+      s.set_destination(destination);
+    }
+    signals_.push_back(s);
+  }
+
+  void flush_signals() {
+    std::vector<message> signals;
+    signals.swap(signals_);
+    for (auto& s : signals) {
+      from_driver(s);
+    }
+  }
+
+  void from_driver(message m) {
+    dbus_message_set_sender(m, DBUS_SERVICE_DBUS);
+    route(m);
+  }
+
+  static bool valid_well_known(const std::string& name) {
+    return !name.empty() && name[0] != ':' && name != DBUS_SERVICE_DBUS &&
+           dbus_validate_bus_name(name.c_str(), nullptr);
+  }
+
+  static message invalid_args(message& m) {
+    return message::new_error(m, DBUS_ERROR_INVALID_ARGS,
+                              "Invalid arguments for " + m.get_member());
+  }
+
+  static message no_owner(message& m, const std::string& name) {
+    return message::new_error(
+        m, DBUS_ERROR_NAME_HAS_NO_OWNER,
+        "Could not get owner of name '" + name + "': no such name");
+  }
+
+  static message unknown_method(message& m) {
+    return message::new_error(
+        m, DBUS_ERROR_UNKNOWN_METHOD,
+        "org.freedesktop.DBus does not understand message " + m.get_member());
+  }
+
+  boost::asio::io_service io_;
+  boost::asio::io_service::work work_;
+  DBusServer* server_;
+  std::string address_;
+  std::string id_;
+  std::thread thread_;
+  std::atomic<bool> stamp_senders_;
+
+  // Everything below belongs to the broker's thread
+  std::map<DBusConnection*, peer> peers_;
+  std::map<std::string, DBusConnection*> unique_;
+  std::map<std::string, owned_name> names_;
+  std::vector<message> signals_;
+  unsigned next_id_;
+};
+
+}  // namespace dbus
+
+#endif  // DBUS_MOCK_BUS_HPP
@@ -0,0 +1,202 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_NAME_WATCHER_HPP
+#define DBUS_NAME_WATCHER_HPP
+
+#include <dbus/connection.hpp>
+#include <dbus/endpoint.hpp>
+#include <dbus/message.hpp>
+#include <dbus/signal_subscription.hpp>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/utility/string_view.hpp>
+
+namespace dbus {
+
+/// Cache of well-known name owners, kept current by NameOwnerChanged.
+/**
+ * Each watched name costs one match rule and one GetNameOwner call up front;
+ * after that, has_owner() and get_owner() answer from memory, and resolve()
+ * lets calls be addressed to the owner's unique name so the bus doesn't have
+ * to look the name up for every message.
+ *
+ * Handlers are called from the connection's io_service.  Destroying the
+ * watcher drops any waiters that haven't been called.
+ */
+class name_watcher {
+ public:
+  typedef std::function<void(boost::system::error_code, const std::string&)>
+      wait_handler;
+  typedef std::function<void(const std::string&)> vanish_handler;
+
+  explicit name_watcher(connection_ptr c)
+      : state_(std::make_shared<state>(c)) {}
+
+  name_watcher(const name_watcher&) = delete;
+  name_watcher& operator=(const name_watcher&) = delete;
+
+  /// Start tracking a name.  Watching a name twice is harmless.
+  void watch(const std::string& name) { state_->watch(name); }
+
+  /// Stop tracking a name, dropping its waiters and vanish handlers.
+  void unwatch(const std::string& name) { state_->names.erase(name); }
+
+  /// Whether the name is known to be owned right now.
+  bool has_owner(const std::string& name) const {
+    return !get_owner(name).empty();
+  }
+
+  /// The unique name owning a watched name; empty if unowned or unknown.
+  const std::string& get_owner(const std::string& name) const {
+    static const std::string none;
+    auto it = state_->names.find(name);
+    return it == state_->names.end() ? none : it->second.owner;
+  }
+
+  /// An endpoint addressed to the current owner of e's well-known name.
+  /**
+   * Returns e unchanged when its name is not watched or not owned.
+   */
+  endpoint resolve(const endpoint& e) const {
+    const std::string& owner = get_owner(e.get_process_name());
+    if (owner.empty()) {
+      return e;
+    }
+    return endpoint(owner, e.get_path(), e.get_interface(), e.get_member());
+  }
+
+  /// Call handler(error_code, owner) once the name has an owner.
+  /**
+   * Watches the name if it isn't already.  If the owner is already known the
+   * handler is posted straight away.
+   */
+  void async_wait_for_name(const std::string& name, wait_handler handler) {
+    entry& e = state_->watch(name);
+    if (!e.owner.empty()) {
+      std::string owner = e.owner;
+      state_->connection->get_io_service().post([handler, owner]() {
+        handler(boost::system::error_code(), owner);
+      });
+      return;
+    }
+    e.waiters.emplace_back(std::move(handler));
+  }
+
+  /// Call handler(name) every time the name loses its owner.
+  void on_vanished(const std::string& name, vanish_handler handler) {
+    state_->watch(name).vanish_handlers.emplace_back(std::move(handler));
+  }
+
+ private:
+  struct entry {
+    std::string owner;
+    // Set once a NameOwnerChanged has been seen, after which the initial
+    // GetNameOwner reply is out of date
+    bool changed = false;
+    std::vector<wait_handler> waiters;
+    std::vector<vanish_handler> vanish_handlers;
+    std::unique_ptr<signal_subscription> subscription;
+  };
+
+  struct state : std::enable_shared_from_this<state> {
+    explicit state(connection_ptr c) : connection(c) {}
+
+    entry& watch(const std::string& name) {
+      auto inserted = names.emplace(name, entry());
+      entry& e = inserted.first->second;
+      if (!inserted.second) {
+        return e;
+      }
+
+      std::weak_ptr<state> weak = shared_from_this();
+      e.subscription.reset(new signal_subscription(
+          connection,
+          "type='signal',sender='org.freedesktop.DBus',"
+          "interface='org.freedesktop.DBus',member='NameOwnerChanged',"
+          "arg0='" +
+              name + "'",
+          [name](message& m) {
+            return dbus_message_is_signal(m, "org.freedesktop.DBus",
+                                          "NameOwnerChanged") &&
+                   dbus_message_has_sender(m, "org.freedesktop.DBus") &&
+                   dbus_message_has_signature(m, "sss") &&
+                   arg0(m) == name;
+          },
+          [weak](message& m) {
+            std::string name, old_owner, new_owner;
+            auto s = weak.lock();
+            if (s && m.unpack(name, old_owner, new_owner)) {
+              s->update(name, new_owner, true);
+            }
+          }));
+
+      dbus::endpoint get_name_owner("org.freedesktop.DBus",
+                                    "/org/freedesktop/DBus",
+                                    "org.freedesktop.DBus", "GetNameOwner");
+      connection->async_method_call(
+          [weak, name](boost::system::error_code ec, std::string owner) {
+            auto s = weak.lock();
+            // NameHasNoOwner comes back as an error
+            if (s) s->update(name, ec ? std::string() : owner, false);
+          },
+          get_name_owner, name);
+      return e;
+    }
+
+    void update(const std::string& name, const std::string& owner,
+                bool from_signal) {
+      auto it = names.find(name);
+      if (it == names.end()) {
+        return;
+      }
+      entry& e = it->second;
+      if (!from_signal && e.changed) {
+        return;
+      }
+      e.changed = e.changed || from_signal;
+      bool vanished = !e.owner.empty() && owner.empty();
+      e.owner = owner;
+
+      // Handlers may watch or unwatch names, so run them from copies
+      if (!owner.empty() && !e.waiters.empty()) {
+        std::vector<wait_handler> waiters;
+        waiters.swap(e.waiters);
+        for (auto& waiter : waiters) {
+          waiter(boost::system::error_code(), owner);
+        }
+      } else if (vanished) {
+        std::vector<vanish_handler> handlers = e.vanish_handlers;
+        for (auto& handler : handlers) {
+          handler(name);
+        }
+      }
+    }
+
+    // The first argument of a message, without unpacking the rest
+    static boost::string_view arg0(message& m) {
+      const char* s = "";
+      DBusMessageIter it;
+      if (dbus_message_iter_init(m, &it) &&
+          dbus_message_iter_get_arg_type(&it) == DBUS_TYPE_STRING) {
+        dbus_message_iter_get_basic(&it, &s);
+      }
+      return s;
+    }
+
+    connection_ptr connection;
+    std::map<std::string, entry> names;
+  };
+
+  std::shared_ptr<state> state_;
+};
+
+}  // namespace dbus
+
+#endif  // DBUS_NAME_WATCHER_HPP
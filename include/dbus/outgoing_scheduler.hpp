@@ -0,0 +1,429 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_OUTGOING_SCHEDULER_HPP
+#define DBUS_OUTGOING_SCHEDULER_HPP
+
+#include <dbus/dbus.h>
+#include <dbus/message.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+namespace dbus {
+
+/// Holds a connection's outgoing messages and sends them by priority.
+/**
+ * Without a scheduler, messages reach libdbus, and so the bus, in the order
+ * they were sent.  With one (see connection::enable_scheduler()), every
+ * message sent without blocking is queued by priority class and released
+ * from the io_service: replies first, then method calls, then signals,
+ * oldest first within a class.  At most batch_size() messages go out per
+ * turn of the io_service, so a flood of signals yields to the handlers
+ * whose replies should overtake it.
+ *
+ * Classes and individual signals or methods (by interface and member) can
+ * be given token-bucket rate limits; a message over its limit waits in the
+ * queue without holding up the messages behind it that aren't.
+ *
+ * Reordering across classes means a reply can overtake a signal sent before
+ * it, which is the point, but matters to peers that rely on that order.
+ * Blocking sends bypass the queue.
+ *
+ * submit() queues a copy of the message, so the caller may reuse or change
+ * its own afterwards.  That copy gets its serial when it is released, which
+ * leaves the caller's message with a serial of 0.  Every member may be
+ * called from any thread; one mutex guards the queues, and messages are
+ * handed to libdbus with it held, so they leave in the order chosen here.
+ */
+class outgoing_scheduler {
+ public:
+  typedef std::chrono::steady_clock clock;
+
+  enum class priority { reply, method_call, signal };
+  static const std::size_t priority_count = 3;
+
+  /// Queueing delay and throughput for one priority class.
+  struct class_stats {
+    std::uint64_t enqueued = 0;
+    std::uint64_t sent = 0;
+    std::size_t queued = 0;
+    clock::duration total_delay = clock::duration::zero();
+    clock::duration max_delay = clock::duration::zero();
+
+    clock::duration mean_delay() const {
+      return sent == 0 ? clock::duration::zero()
+                       : total_delay / static_cast<clock::rep>(sent);
+    }
+  };
+
+  typedef std::function<void(message&)> send_function;
+
+  outgoing_scheduler(boost::asio::io_service& io, DBusConnection* c)
+      : state_(std::make_shared<state>(io, c)) {}
+
+  outgoing_scheduler(const outgoing_scheduler&) = delete;
+  outgoing_scheduler& operator=(const outgoing_scheduler&) = delete;
+
+  /// Give one message a priority class, overriding every other rule.
+  static void set_priority(message& m, priority p) {
+    dbus_message_set_data(m, priority_slot(),
+                          reinterpret_cast<void*>(
+                              static_cast<std::intptr_t>(p) + 1),
+                          nullptr);
+  }
+
+  /// Give every message to or from interface.member a priority class.
+  void set_priority(const std::string& interface, const std::string& member,
+                    priority p) {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->priorities[std::make_pair(interface, member)] = p;
+  }
+
+  /// Limit a class to per_second messages, with bursts of up to burst.
+  /**
+   * A per_second of zero removes the limit.
+   */
+  void set_rate_limit(priority p, double per_second, std::size_t burst = 1) {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->classes[index(p)].bucket.configure(per_second, burst);
+    state_->schedule();
+  }
+
+  /// Limit the messages to or from interface.member, usually a signal.
+  void set_rate_limit(const std::string& interface, const std::string& member,
+                      double per_second, std::size_t burst = 1) {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    auto key = std::make_pair(interface, member);
+    if (per_second <= 0) {
+      auto it = state_->throttles.find(key);
+      if (it != state_->throttles.end()) {
+        // Anything still held back goes out with the rest of its class
+        for (auto& q : it->second.items) {
+          state_->classes[index(q.p)].items.emplace_back(std::move(q));
+        }
+        state_->throttles.erase(it);
+        state_->schedule();
+      }
+      return;
+    }
+    state_->throttles[key].bucket.configure(per_second, burst);
+  }
+
+  /// The most messages released per turn of the io_service.
+  void set_batch_size(std::size_t n) {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->batch_size = std::max<std::size_t>(n, 1);
+  }
+
+  std::size_t batch_size() const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->batch_size;
+  }
+
+  /// Hold everything back while libdbus has more than this many bytes
+  /// waiting to be written, so the ordering is ours rather than its queue's.
+  void set_high_water(long bytes) {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->high_water = bytes;
+  }
+
+  class_stats stats(priority p) const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->classes[index(p)].stats;
+  }
+
+  /// Messages waiting to be released, throttled ones included.
+  std::size_t queued() const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    std::size_t n = 0;
+    for (auto& c : state_->classes) {
+      n += c.items.size();
+    }
+    for (auto& t : state_->throttles) {
+      n += t.second.items.size();
+    }
+    return n;
+  }
+
+  /// The class m will be queued in.
+  priority classify(message& m) const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return classify_locked(m);
+  }
+
+  /// Queue a copy of m; send(copy) is called when it's m's turn.
+  void submit(message& m, send_function send) {
+    message copy = message::new_copy(m);
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    // The copy doesn't carry over a priority given by set_priority(m)
+    priority p = classify_locked(m);
+    class_state& c = state_->classes[index(p)];
+    c.stats.enqueued++;
+
+    queued_message q{copy, std::move(send), clock::now(), p};
+    auto throttle = state_->throttles.end();
+    if (!state_->throttles.empty() &&
+        dbus_message_get_type(copy) != DBUS_MESSAGE_TYPE_METHOD_RETURN &&
+        dbus_message_get_type(copy) != DBUS_MESSAGE_TYPE_ERROR) {
+      throttle = state_->throttles.find(
+          std::make_pair(copy.get_interface(), copy.get_member()));
+    }
+    if (throttle != state_->throttles.end()) {
+      throttle->second.items.emplace_back(std::move(q));
+    } else {
+      c.items.emplace_back(std::move(q));
+    }
+    c.stats.queued++;
+    state_->schedule();
+  }
+
+  /// Send everything queued now, ignoring rate limits.
+  void flush() {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->release_all();
+  }
+
+ private:
+  priority classify_locked(message& m) const {
+    void* explicit_priority = dbus_message_get_data(m, priority_slot());
+    if (explicit_priority != nullptr) {
+      return static_cast<priority>(
+          reinterpret_cast<std::intptr_t>(explicit_priority) - 1);
+    }
+    if (!state_->priorities.empty()) {
+      auto it = state_->priorities.find(
+          std::make_pair(m.get_interface(), m.get_member()));
+      if (it != state_->priorities.end()) {
+        return it->second;
+      }
+    }
+    switch (dbus_message_get_type(m)) {
+      case DBUS_MESSAGE_TYPE_METHOD_RETURN:
+      case DBUS_MESSAGE_TYPE_ERROR:
+        return priority::reply;
+      case DBUS_MESSAGE_TYPE_METHOD_CALL:
+        return priority::method_call;
+      default:
+        return priority::signal;
+    }
+  }
+
+  struct queued_message {
+    message m;
+    send_function send;
+    clock::time_point queued_at;
+    priority p;
+  };
+
+  struct token_bucket {
+    double rate = 0;
+    double burst = 0;
+    double tokens = 0;
+    clock::time_point updated;
+
+    void configure(double per_second, std::size_t max_burst) {
+      rate = std::max(per_second, 0.0);
+      burst = std::max<double>(max_burst, 1);
+      tokens = burst;
+      updated = clock::now();
+    }
+
+    bool take(clock::time_point now) {
+      if (rate == 0) {
+        return true;
+      }
+      refill(now);
+      if (tokens < 1) {
+        return false;
+      }
+      tokens -= 1;
+      return true;
+    }
+
+    // How long until take() can succeed
+    clock::duration wait(clock::time_point now) {
+      if (rate == 0) {
+        return clock::duration::zero();
+      }
+      refill(now);
+      if (tokens >= 1) {
+        return clock::duration::zero();
+      }
+      return std::chrono::duration_cast<clock::duration>(
+          std::chrono::duration<double>((1 - tokens) / rate));
+    }
+
+    void refill(clock::time_point now) {
+      std::chrono::duration<double> elapsed = now - updated;
+      tokens = std::min(burst, tokens + elapsed.count() * rate);
+      updated = now;
+    }
+  };
+
+  struct class_state {
+    std::deque<queued_message> items;
+    token_bucket bucket;
+    class_stats stats;
+  };
+
+  struct throttle_state {
+    std::deque<queued_message> items;
+    token_bucket bucket;
+  };
+
+  struct state : std::enable_shared_from_this<state> {
+    state(boost::asio::io_service& io, DBusConnection* c)
+        : io(io), connection(c), timer(io) {}
+
+    void schedule() {
+      if (pump_posted) {
+        return;
+      }
+      pump_posted = true;
+      std::weak_ptr<state> weak = shared_from_this();
+      io.post([weak]() {
+        if (auto s = weak.lock()) {
+          std::lock_guard<std::mutex> lock(s->mutex);
+          s->pump();
+        }
+      });
+    }
+
+    void schedule_at(clock::duration wait) {
+      auto when = clock::now() + wait;
+      if (timer_armed && timer.expires_at() <= when) {
+        return;
+      }
+      timer_armed = true;
+      timer.expires_at(when);
+      std::weak_ptr<state> weak = shared_from_this();
+      timer.async_wait([weak](boost::system::error_code ec) {
+        if (ec) return;
+        if (auto s = weak.lock()) {
+          std::lock_guard<std::mutex> lock(s->mutex);
+          s->timer_armed = false;
+          s->pump();
+        }
+      });
+    }
+
+    void pump() {
+      pump_posted = false;
+      clock::time_point now = clock::now();
+
+      for (auto& t : throttles) {
+        auto& items = t.second.items;
+        while (!items.empty() && t.second.bucket.take(now)) {
+          classes[index(items.front().p)].items.emplace_back(
+              std::move(items.front()));
+          items.pop_front();
+        }
+      }
+
+      if (high_water > 0 &&
+          dbus_connection_get_outgoing_size(connection) > high_water) {
+        // libdbus doesn't say when its queue drains, so look again shortly
+        schedule_at(std::chrono::milliseconds(1));
+        return;
+      }
+
+      std::size_t budget = batch_size;
+      for (auto& c : classes) {
+        while (budget > 0 && !c.items.empty() && c.bucket.take(now)) {
+          release(c, now);
+          budget--;
+        }
+      }
+
+      // Whatever's left is waiting on the batch size or a rate limit
+      clock::duration wait = clock::duration::max();
+      bool ready = false;
+      for (auto& c : classes) {
+        if (!c.items.empty()) {
+          clock::duration w = c.bucket.wait(now);
+          ready = ready || w == clock::duration::zero();
+          wait = std::min(wait, w);
+        }
+      }
+      for (auto& t : throttles) {
+        if (!t.second.items.empty()) {
+          wait = std::min(wait, t.second.bucket.wait(now));
+        }
+      }
+      if (ready) {
+        schedule();
+      } else if (wait != clock::duration::max()) {
+        schedule_at(std::max<clock::duration>(wait,
+                                              std::chrono::milliseconds(1)));
+      }
+    }
+
+    void release(class_state& c, clock::time_point now) {
+      queued_message q = std::move(c.items.front());
+      c.items.pop_front();
+      clock::duration delay = now - q.queued_at;
+      c.stats.queued--;
+      c.stats.sent++;
+      c.stats.total_delay += delay;
+      c.stats.max_delay = std::max(c.stats.max_delay, delay);
+      q.send(q.m);
+    }
+
+    void release_all() {
+      for (auto& t : throttles) {
+        for (auto& q : t.second.items) {
+          classes[index(q.p)].items.emplace_back(std::move(q));
+        }
+        t.second.items.clear();
+      }
+      clock::time_point now = clock::now();
+      for (auto& c : classes) {
+        while (!c.items.empty()) {
+          release(c, now);
+        }
+      }
+    }
+
+    // Held by every member above and the outgoing_scheduler methods that
+    // reach them
+    std::mutex mutex;
+    boost::asio::io_service& io;
+    DBusConnection* connection;
+    boost::asio::steady_timer timer;
+    bool pump_posted = false;
+    bool timer_armed = false;
+    std::size_t batch_size = 64;
+    long high_water = 64 * 1024;
+    class_state classes[priority_count];
+    std::map<std::pair<std::string, std::string>, throttle_state> throttles;
+    std::map<std::pair<std::string, std::string>, priority> priorities;
+  };
+
+  static std::size_t index(priority p) { return static_cast<std::size_t>(p); }
+
+  static dbus_int32_t priority_slot() {
+    // libdbus keeps a pointer to the slot, so it has to stay put
+    static dbus_int32_t slot = -1;
+    static bool allocated = dbus_message_allocate_data_slot(&slot);
+    (void)allocated;
+    return slot;
+  }
+
+  std::shared_ptr<state> state_;
+};
+
+}  // namespace dbus
+
+#endif  // DBUS_OUTGOING_SCHEDULER_HPP
@@ -2,11 +2,21 @@
 #define DBUS_PROPERTIES_HPP
 
 #include <dbus/connection.hpp>
+#include <dbus/credentials_cache.hpp>
+#include <dbus/detail/dispatch_table.hpp>
 #include <dbus/filter.hpp>
 #include <dbus/match.hpp>
+#include <dbus/method_profiler.hpp>
+#include <dbus/signal_subscription.hpp>
+#include <algorithm>
 #include <functional>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
 #include <tuple>
 #include <type_traits>
+#include <vector>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/container/flat_map.hpp>
 #include <boost/container/flat_set.hpp>
@@ -21,6 +31,16 @@ struct DbusArgument {
   std::string type;
 };
 
+/// Thrown from a method handler to answer with a particular D-Bus error.
+/**
+ * Any other exception is answered with org.freedesktop.DBus.Error.Failed.
+ */
+struct method_error : std::runtime_error {
+  method_error(const std::string& name, const std::string& message)
+      : std::runtime_error(message), name(name) {}
+  std::string name;
+};
+
 class DbusMethod {
  public:
   DbusMethod(const std::string& name, std::shared_ptr<dbus::connection>& conn)
@@ -33,6 +53,11 @@ class DbusMethod {
 
 enum class UpdateType { VALUE_CHANGE_ONLY, FORCE };
 
+// IMMEDIATE sends InterfacesAdded as each interface is registered.  DEFERRED
+// holds them back until DbusObject::commit(), which sends a single signal
+// covering every interface registered in between.
+enum class RegistrationMode { IMMEDIATE, DEFERRED };
+
 // Base case for when I == the size of the tuple args.  Does nothing, as we
 // should be done
 template <std::size_t TupleIndex = 0, typename... Tp>
@@ -82,19 +107,40 @@ void arg_types(bool in, Element& t, std::vector<DbusArgument>& v,
   v.emplace_back(in ? "in" : "out", name, &sig[0]);
 }
 
+// Handlers whose first parameter is a peer_credentials are given the
+// caller's credentials ahead of the message arguments
+template <typename ArgTuple>
+struct credentials_args {
+  typedef std::false_type wants_credentials;
+  typedef ArgTuple message_args;
+};
+
+template <typename... Args>
+struct credentials_args<std::tuple<peer_credentials, Args...>> {
+  typedef std::true_type wants_credentials;
+  typedef std::tuple<Args...> message_args;
+};
+
 template <typename Handler>
-class LambdaDbusMethod : public DbusMethod {
+class LambdaDbusMethod
+    : public DbusMethod,
+      public std::enable_shared_from_this<LambdaDbusMethod<Handler>> {
  public:
   typedef function_traits<Handler> traits;
-  typedef typename traits::decayed_arg_types InputTupleType;
+  typedef credentials_args<typename traits::decayed_arg_types>
+      credentials_traits;
+  typedef typename credentials_traits::message_args InputTupleType;
+  // Handlers may return a const reference to state they own, in which case
+  // the result is packed in place rather than copied
   typedef typename traits::result_type ResultType;
+  typedef typename std::decay<ResultType>::type DecayedResultType;
   LambdaDbusMethod(const std::string name,
                    std::shared_ptr<dbus::connection>& conn, Handler h)
       : DbusMethod(name, conn), h(std::move(h)) {
     InputTupleType t;
     arg_types(true, t, args);
 
-    ResultType o;
+    DecayedResultType o;
     arg_types(false, o, args);
   }
 
@@ -106,38 +152,81 @@ class LambdaDbusMethod : public DbusMethod {
     InputTupleType t;
     arg_types(true, t, args, &input_arg_names);
 
-    ResultType o;
+    DecayedResultType o;
     arg_types(false, o, args, &output_arg_names);
   }
   void call(dbus::message& m) override {
+    call(m, typename credentials_traits::wants_credentials());
+  }
+
+  std::vector<DbusArgument> get_args() override { return args; };
+  Handler h;
+  std::vector<DbusArgument> args;
+
+ private:
+  void call(dbus::message& m, std::false_type) {
+    invoke(m, [this](auto&... a) -> decltype(auto) { return h(a...); });
+  }
+
+  // Answers straight away when the caller's credentials are cached, and
+  // otherwise once the bus has reported them, unless the method has been
+  // dropped from its interface by then
+  void call(dbus::message& m, std::true_type) {
+    if (!credentials) {
+      credentials = credentials_cache::get(conn);
+    }
+    std::string sender = m.get_sender();
+    if (const peer_credentials* c = credentials->find(sender)) {
+      invoke(m, [&](auto&... a) -> decltype(auto) { return h(*c, a...); });
+      return;
+    }
+    std::weak_ptr<LambdaDbusMethod> weak = this->shared_from_this();
+    credentials->async_get(sender, [weak, m](boost::system::error_code ec,
+                                             const peer_credentials& c) {
+      auto self = weak.lock();
+      if (!self) {
+        return;
+      }
+      dbus::message call = m;
+      if (ec) {
+        detail::send_error(*self->conn, call, DBUS_ERROR_ACCESS_DENIED,
+                           "Caller credentials unavailable");
+        return;
+      }
+      self->invoke(call, [&](auto&... a) -> decltype(auto) {
+        return self->h(c, a...);
+      });
+    });
+  }
+
+  // The connection only keeps a weak reference to its cache, so the methods
+  // that use it keep it alive
+  std::shared_ptr<credentials_cache> credentials;
+
+  template <typename Invoker>
+  void invoke(dbus::message& m, Invoker invoker) {
     InputTupleType input_args;
     if (unpack_into_tuple(input_args, m) == false) {
-      auto err = dbus::message::new_error(m, DBUS_ERROR_INVALID_ARGS, "");
-      conn->send(err, std::chrono::seconds(0));
+      detail::send_error(*conn, m, DBUS_ERROR_INVALID_ARGS, "");
       return;
     }
     try {
-      ResultType r = apply(h, input_args);
+      ResultType r = apply(invoker, input_args);
       auto ret = dbus::message::new_return(m);
       if (pack_tuple_into_msg(r, ret) == false) {
-        auto err = dbus::message::new_error(
-            m, DBUS_ERROR_FAILED, "Handler had issue when packing response");
-        conn->send(err, std::chrono::seconds(0));
+        detail::send_error(*conn, m, DBUS_ERROR_FAILED,
+                           "Handler had issue when packing response");
         return;
       }
       conn->send(ret, std::chrono::seconds(0));
+    } catch (const method_error& e) {
+      detail::send_error(*conn, m, e.name, e.what());
     } catch (...) {
-      auto err = dbus::message::new_error(
-          m, DBUS_ERROR_FAILED,
-          "Handler threw exception while handling request.");
-      conn->send(err, std::chrono::seconds(0));
+      detail::send_error(*conn, m, DBUS_ERROR_FAILED,
+                         "Handler threw exception while handling request.");
       return;
     }
   };
-
-  std::vector<DbusArgument> get_args() override { return args; };
-  Handler h;
-  std::vector<DbusArgument> args;
 };
 
 class DbusSignal {
@@ -146,26 +235,67 @@ class DbusSignal {
   virtual std::vector<DbusArgument> get_args() { return {}; }
 };
 
+// Unique names of the peers an interface's signals are addressed to
+typedef boost::container::flat_set<std::string> subscriber_set;
+
+// Where an interface's signals go; shared with its DbusTemplateSignals
+struct signal_routing {
+  subscriber_set subscribers;
+  // Set by DbusInterface::set_unicast_signals()
+  bool unicast = false;
+};
+
+// Sends a signal to the given peer, marked no-reply so the bus drops it
+// quietly if the peer has gone away
+inline void send_signal_to(dbus::connection& conn,
+                           const std::string& destination, message& m) {
+  m.set_destination(destination).set_no_reply();
+  conn.send(m, std::chrono::seconds(0));
+}
+
+// Sends a signal to each subscriber when unicast, or otherwise, or when there
+// are no subscribers, broadcasts it
+inline void send_signal(dbus::connection& conn, const signal_routing& routing,
+                        message& m) {
+  if (!routing.unicast || routing.subscribers.empty()) {
+    conn.send(m, std::chrono::seconds(0));
+    return;
+  }
+  for (auto& subscriber : routing.subscribers) {
+    auto copy = message::new_copy(m);
+    send_signal_to(conn, subscriber, copy);
+  }
+}
+
 template <typename... Args>
 class DbusTemplateSignal : public DbusSignal {
  public:
   DbusTemplateSignal(const std::string& name, const std::string& object_name,
                      const std::string& interface_name,
                      const std::vector<std::string>& names,
-                     std::shared_ptr<dbus::connection>& conn)
+                     std::shared_ptr<dbus::connection>& conn,
+                     std::shared_ptr<const signal_routing> routing =
+                         std::make_shared<signal_routing>())
       : DbusSignal(),
         name(name),
         object_name(object_name),
         interface_name(interface_name),
-        conn(conn) {
+        conn(conn),
+        routing(std::move(routing)) {
     std::tuple<Args...> tu;
     arg_types(true, tu, args, &names);
   };
 
-  void send(const Args&...) {
-    dbus::endpoint endpoint("", object_name, interface_name);
-    auto m = dbus::message::new_signal(endpoint, name);
-    conn->send(m, std::chrono::seconds(0));
+  // Sends as the interface routes its signals; see signal_routing
+  void send(const Args&... a) {
+    auto m = new_signal(a...);
+    send_signal(*conn, *routing, m);
+  }
+
+  // Sends to one peer only, whatever the interface's subscribers
+  void send_to(const std::string& destination, const Args&... a) {
+    auto m = new_signal(a...);
+    send_signal_to(*conn, destination, m);
   }
 
   std::vector<DbusArgument> get_args() override { return args; };
@@ -175,28 +305,41 @@ class DbusTemplateSignal : public DbusSignal {
   std::string object_name;
   std::string interface_name;
   std::shared_ptr<dbus::connection> conn;
+  std::shared_ptr<const signal_routing> routing;
+
+ private:
+  message new_signal(const Args&... a) {
+    dbus::endpoint endpoint("", object_name, interface_name);
+    auto m = dbus::message::new_signal(endpoint, name);
+    m.pack(a...);
+    return m;
+  }
 };
 
 class DbusInterface {
  public:
+  typedef boost::container::flat_map<std::string, dbus_variant>
+      properties_map_type;
+
   DbusInterface(std::string interface_name,
                 std::shared_ptr<dbus::connection>& conn)
       : interface_name(std::move(interface_name)), conn(conn) {}
-  virtual boost::container::flat_map<std::string, std::shared_ptr<DbusSignal>>
+  virtual const boost::container::flat_map<std::string,
+                                           std::shared_ptr<DbusSignal>>&
   get_signals() {
     return dbus_signals;
   };
-  virtual boost::container::flat_map<std::string, std::shared_ptr<DbusMethod>>
+  virtual const boost::container::flat_map<std::string,
+                                           std::shared_ptr<DbusMethod>>&
   get_methods() {
     return dbus_methods;
   };
-  virtual std::string get_interface_name() { return interface_name; };
-  virtual const boost::container::flat_map<std::string, dbus_variant>
-  get_properties_map() {
+  virtual const std::string& get_interface_name() { return interface_name; };
+  virtual const properties_map_type& get_properties_map() {
     return properties_map;
   };
 
-  dbus_variant get_property(const std::string& property_name) {
+  const dbus_variant& get_property(const std::string& property_name) {
     auto property = properties_map.find(property_name);
     if (property == properties_map.end()) {
       // TODO(ed) property not found error
@@ -253,19 +396,64 @@ class DbusInterface {
 
     static const std::vector<std::string> empty;
     m.pack(get_interface_name(), updates, empty);
-    // TODO(ed) make sure this doesn't block
-    conn->async_send(
-        m, [](const boost::system::error_code ec, dbus::message r) {});
+    send_signal(m);
+  }
+
+  /// Apply a peer's Properties.Set.
+  /**
+   * Runtime registered properties may be set to any value.  Throws
+   * method_error to refuse the change.
+   */
+  virtual void set_property_from_peer(const std::string& property_name,
+                                      const dbus_variant& value) {
+    std::vector<std::pair<std::string, dbus_variant>> v;
+    v.emplace_back(property_name, value);
+    set_properties(v);
+  }
+
+  /// Address this interface's signals to its subscribers only.
+  /**
+   * Off by default, so signals are broadcast and any peer with a matching
+   * rule receives them.  Once on, while the interface has subscribers, its
+   * signals (including PropertiesChanged) are sent to each of them by unique
+   * name instead, so the bus only wakes the processes that asked for them;
+   * peers that merely added a match rule stop receiving them.  With no
+   * subscribers, signals are still broadcast.
+   */
+  void set_unicast_signals(bool unicast = true) { routing->unicast = unicast; }
+
+  /// Add a peer to address unicast signals to.
+  /**
+   * The peer is dropped again when it leaves the bus.
+   */
+  void add_subscriber(const std::string& unique_name) {
+    routing->subscribers.insert(unique_name);
+    if (!departures) {
+      watch_departures(unique_name);
+    }
+  }
+
+  void remove_subscriber(const std::string& unique_name) {
+    routing->subscribers.erase(unique_name);
   }
 
+  const subscriber_set& get_subscribers() const {
+    return routing->subscribers;
+  }
+
+  // Sends a signal originating from this interface as it routes signals
+  void send_signal(message& m) { dbus::send_signal(*conn, *routing, m); }
+
   void register_method(std::shared_ptr<DbusMethod> method) {
     dbus_methods.emplace(method->name, method);
+    method_table_stale = true;
   }
 
   template <typename Handler>
   void register_method(const std::string& name, Handler method) {
     dbus_methods.emplace(name,
                          new LambdaDbusMethod<Handler>(name, conn, method));
+    method_table_stale = true;
   }
 
   template <typename Handler>
@@ -276,45 +464,295 @@ class DbusInterface {
     dbus_methods.emplace(
         name, new LambdaDbusMethod<Handler>(name, input_arg_names,
                                             output_arg_names, conn, method));
+    method_table_stale = true;
   }
 
   template <typename... Args>
   std::shared_ptr<DbusTemplateSignal<Args...>> register_signal(
       const std::string& name, const std::vector<std::string> arg_names) {
     auto sig = std::make_shared<DbusTemplateSignal<Args...>>(
-        name, object_name, interface_name, arg_names, conn);
+        name, object_name, interface_name, arg_names, conn, routing);
     dbus_signals.emplace(name, sig);
     return sig;
   }
 
-  void call(dbus::message& m) {
-    std::string method_name = m.get_member();
-    auto method = dbus_methods.find(method_name);
-    if (method != dbus_methods.end()) {
-      method->second->call(m);
-    }  // TODO(ed) send something when method doesn't exist?
+  // Appends this interface's introspection <interface> element
+  virtual void append_introspection(std::string& xml) {
+    xml += "<interface name=\"";
+    xml += interface_name;
+    xml += "\">";
+    for (auto& method : get_methods()) {
+      xml += "<method name=\"";
+      xml += method.first;
+      xml += "\">";
+      for (auto& arg : method.second->get_args()) {
+        xml += "<arg name=\"";
+        xml += arg.name;
+        xml += "\" type=\"";
+        xml += arg.type;
+        xml += "\" direction=\"";
+        xml += arg.direction;
+        xml += "\"/>";
+      }
+      xml += "</method>";
+    }
+
+    for (auto& signal : get_signals()) {
+      xml += "<signal name=\"";
+      xml += signal.first;
+      xml += "\">";
+      for (auto& arg : signal.second->get_args()) {
+        xml += "<arg name=\"";
+        xml += arg.name;
+        xml += "\" type=\"";
+        xml += arg.type;
+        xml += "\"/>";
+      }
+
+      xml += "</signal>";
+    }
+
+    for (auto& property : get_properties_map()) {
+      xml += "<property name=\"";
+      xml += property.first;
+      xml += "\" type=\"";
+
+      std::string type = std::string(boost::apply_visitor(
+          [&](auto val) {
+            static const auto constexpr sig =
+                element_signature<decltype(val)>::code;
+            return &sig[0];
+          },
+          property.second));
+      xml += type;
+      xml += "\" access=\"";
+      // TODO direction can be readwrite, read, or write.  Need to
+      // make this configurable
+      xml += "readwrite";
+      xml += "\"/>";
+    }
+    xml += "</interface>";
+  }
+
+  // Returns false if the method doesn't exist, so the caller can let libdbus
+  // answer with UnknownMethod
+  virtual bool call(dbus::message& m) {
+    // Registration usually finishes before the first call arrives, so the
+    // lookup table is only built once
+    if (method_table_stale) {
+      method_table.assign(dbus_methods);
+      method_table_stale = false;
+    }
+    DbusMethod* method = method_table.find(m.get_member_view());
+    if (method == nullptr) {
+      return false;
+    }
+    method->call(m);
+    return true;
   }
 
   std::string object_name;
   std::string interface_name;
-  boost::container::flat_map<std::string, std::shared_ptr<DbusMethod>>
-      dbus_methods;
   boost::container::flat_map<std::string, std::shared_ptr<DbusSignal>>
       dbus_signals;
-  boost::container::flat_map<std::string, dbus_variant> properties_map;
+  properties_map_type properties_map;
   std::shared_ptr<dbus::connection> conn;
+  // Shared with this interface's DbusTemplateSignals
+  std::shared_ptr<signal_routing> routing = std::make_shared<signal_routing>();
+
+ private:
+  // Subscribers that leave the bus are dropped, or they would hold the
+  // signals back from everyone else for good.  Unique names are never
+  // reused, so all we need to hear about is one going away, which is when
+  // arg2 (the new owner) is empty.
+  void watch_departures(const std::string& first_subscriber) {
+    std::weak_ptr<signal_routing> weak = routing;
+    departures.reset(new signal_subscription(
+        conn,
+        "type='signal',sender='org.freedesktop.DBus',"
+        "interface='org.freedesktop.DBus',member='NameOwnerChanged',"
+        "arg2=''",
+        [](message& m) {
+          return dbus_message_is_signal(m, "org.freedesktop.DBus",
+                                        "NameOwnerChanged") &&
+                 dbus_message_has_sender(m, "org.freedesktop.DBus");
+        },
+        [weak](message& m) {
+          std::string name, old_owner, new_owner;
+          auto r = weak.lock();
+          if (r && m.unpack(name, old_owner, new_owner) &&
+              new_owner.empty()) {
+            r->subscribers.erase(name);
+          }
+        }));
+
+    // The first subscriber may have gone before the rule was in place
+    dbus::endpoint name_has_owner("org.freedesktop.DBus",
+                                  "/org/freedesktop/DBus",
+                                  "org.freedesktop.DBus", "NameHasOwner");
+    conn->async_method_call(
+        [weak, first_subscriber](boost::system::error_code ec, bool owned) {
+          auto r = weak.lock();
+          if (r && !ec && !owned) {
+            r->subscribers.erase(first_subscriber);
+          }
+        },
+        name_has_owner, first_subscriber);
+  }
+
+  std::unique_ptr<signal_subscription> departures;
+  // Only changed through register_method(), which marks method_table stale
+  boost::container::flat_map<std::string, std::shared_ptr<DbusMethod>>
+      dbus_methods;
+  detail::dispatch_table<DbusMethod> method_table;
+  bool method_table_stale = true;
+};
+
+/// Lets peers ask for an object's signals to be addressed to them.
+/**
+ * Subscribe(s interface_name) adds the caller's unique name to that
+ * interface's subscribers, and Unsubscribe removes it.  Interfaces that have
+ * opted in with DbusInterface::set_unicast_signals() then address their
+ * signals to their subscribers instead of broadcasting them.
+ */
+class SubscriptionsInterface : public DbusInterface {
+ public:
+  typedef boost::container::flat_map<std::string,
+                                     std::shared_ptr<DbusInterface>>
+      interfaces_map_type;
+
+  SubscriptionsInterface(std::shared_ptr<dbus::connection>& conn,
+                         const interfaces_map_type& interfaces)
+      : DbusInterface("org.boost.dbus.Subscriptions", conn),
+        interfaces(interfaces) {}
+
+  bool call(dbus::message& m) override {
+    boost::string_view member = m.get_member_view();
+    bool subscribe = member == "Subscribe";
+    if (!subscribe && member != "Unsubscribe") {
+      return false;
+    }
+    std::string interface_name;
+    auto interface = interfaces.end();
+    if (m.unpack(interface_name)) {
+      interface = interfaces.find(interface_name);
+    }
+    if (interface == interfaces.end()) {
+      detail::send_error(*conn, m, DBUS_ERROR_INVALID_ARGS,
+                         "No such interface");
+      return true;
+    }
+    if (subscribe) {
+      interface->second->add_subscriber(m.get_sender());
+    } else {
+      interface->second->remove_subscriber(m.get_sender());
+    }
+    auto ret = dbus::message::new_return(m);
+    conn->send(ret, std::chrono::seconds(0));
+    return true;
+  }
+
+  void append_introspection(std::string& xml) override {
+    xml +=
+        "<interface name=\"org.boost.dbus.Subscriptions\">"
+        "<method name=\"Subscribe\">"
+        "<arg name=\"interface_name\" type=\"s\" direction=\"in\"/>"
+        "</method>"
+        "<method name=\"Unsubscribe\">"
+        "<arg name=\"interface_name\" type=\"s\" direction=\"in\"/>"
+        "</method>"
+        "</interface>";
+  }
+
+ private:
+  const interfaces_map_type& interfaces;
+};
+
+/// Exports the serving connection's transport metrics.
+/**
+ * GetMetrics returns connection::metrics() as a{st}, one entry per counter
+ * or gauge.  GetReplyLatency returns the reply latency histogram as at:
+ * element i counts the replies that took under 2^i microseconds and no
+ * less than the bound of element i - 1.
+ */
+class MetricsInterface : public DbusInterface {
+ public:
+  explicit MetricsInterface(std::shared_ptr<dbus::connection>& conn)
+      : DbusInterface("org.boost.dbus.Metrics", conn) {}
+
+  static std::vector<std::pair<std::string, uint64>> flatten(
+      const connection_metrics& s) {
+    std::vector<std::pair<std::string, uint64>> v;
+    auto add_by_type = [&v](const std::string& prefix,
+                            const connection_metrics::by_type& t) {
+      v.emplace_back(prefix + ".method_calls", t.method_calls);
+      v.emplace_back(prefix + ".method_returns", t.method_returns);
+      v.emplace_back(prefix + ".errors", t.errors);
+      v.emplace_back(prefix + ".signals", t.signals);
+    };
+    add_by_type("messages_in", s.messages_in);
+    add_by_type("messages_out", s.messages_out);
+    add_by_type("bytes_in", s.bytes_in);
+    add_by_type("bytes_out", s.bytes_out);
+    v.emplace_back("dispatches", s.dispatches);
+    v.emplace_back("dispatch_turns", s.dispatch_turns);
+    v.emplace_back("max_dispatches_per_turn", s.max_dispatches_per_turn);
+    v.emplace_back("calls_in_flight", s.calls_in_flight);
+    v.emplace_back("call_timeouts", s.call_timeouts);
+    v.emplace_back("outgoing_bytes", s.outgoing_bytes);
+    v.emplace_back("outgoing_messages", s.outgoing_messages);
+    v.emplace_back("dispatch_pending", s.dispatch_pending);
+    v.emplace_back("filter_queued", s.filter_queued);
+    v.emplace_back("max_filter_queued", s.max_filter_queued);
+    v.emplace_back("replies", s.replies());
+    return v;
+  }
+
+  bool call(dbus::message& m) override {
+    boost::string_view member = m.get_member_view();
+    auto ret = dbus::message::new_return(m);
+    if (member == "GetMetrics") {
+      ret.pack(flatten(conn->metrics()));
+    } else if (member == "GetReplyLatency") {
+      auto histogram = conn->metrics().reply_latency;
+      ret.pack(std::vector<uint64>(histogram.begin(), histogram.end()));
+    } else {
+      return false;
+    }
+    conn->send(ret, std::chrono::seconds(0));
+    return true;
+  }
+
+  void append_introspection(std::string& xml) override {
+    xml +=
+        "<interface name=\"org.boost.dbus.Metrics\">"
+        "<method name=\"GetMetrics\">"
+        "<arg name=\"metrics\" type=\"a{st}\" direction=\"out\"/>"
+        "</method>"
+        "<method name=\"GetReplyLatency\">"
+        "<arg name=\"buckets\" type=\"at\" direction=\"out\"/>"
+        "</method>"
+        "</interface>";
+  }
 };
 
 class DbusObject {
  public:
-  DbusObject(std::shared_ptr<dbus::connection> conn, std::string object_name)
-      : object_name(std::move(object_name)), conn(conn) {
+  typedef boost::container::flat_map<std::string,
+                                     std::shared_ptr<DbusInterface>>
+      interfaces_map_type;
+
+  DbusObject(std::shared_ptr<dbus::connection> conn, std::string object_name,
+             RegistrationMode mode = RegistrationMode::IMMEDIATE)
+      : object_name(std::move(object_name)),
+        conn(conn),
+        registration_mode(mode) {
     properties_iface = add_interface("org.freedesktop.DBus.Properties");
 
     properties_iface->register_method(
         "Get", {"interface_name", "properties_name"}, {"value"},
         [&](const std::string& interface_name,
-            const std::string& property_name) {
+            const std::string& property_name) -> const dbus_variant& {
           auto interface_it = interfaces.find(interface_name);
           if (interface_it == interfaces.end()) {
             // Interface not found error
@@ -326,14 +764,15 @@ class DbusObject {
               // TODO(ed) property not found error
               throw std::runtime_error("property not found");
             } else {
-              return std::tuple<dbus_variant>(property->second);
+              return property->second;
             }
           }
         });
 
     properties_iface->register_method(
         "GetAll", {"interface_name"}, {"properties"},
-        [&](const std::string& interface_name) {
+        [&](const std::string& interface_name)
+            -> const DbusInterface::properties_map_type& {
           auto interface_it = interfaces.find(interface_name);
           if (interface_it == interfaces.end()) {
             // Interface not found error
@@ -351,11 +790,8 @@ class DbusObject {
             // Interface not found error
             throw std::runtime_error("interface not found");
           } else {
-            // Todo, the set propery (signular) interface should support
-            // handing a variant.  The below is expensive
-            std::vector<std::pair<std::string, dbus_variant>> v;
-            v.emplace_back(property_name, value);
-            interface_it->second->set_properties(v);
+            interface_it->second->set_property_from_peer(property_name,
+                                                         value);
             return std::tuple<>();
           }
         });
@@ -373,33 +809,90 @@ class DbusObject {
     return x;
   }
 
-  void register_interface(std::shared_ptr<DbusInterface>& interface) {
+  void register_interface(std::shared_ptr<DbusInterface> interface) {
     interfaces[interface->get_interface_name()] = interface;
+    interface_table_stale = true;
     interface->object_name = object_name;
-    const static dbus::endpoint endpoint("", object_name,
-                                         "org.freedesktop.DBus.ObjectManager");
+    pending_interfaces[interface->get_interface_name()] = interface;
+    if (registration_mode == RegistrationMode::IMMEDIATE) {
+      send_interfaces_added();
+    }
+  }
 
-    auto m = message::new_signal(endpoint, "InterfacesAdded");
-    typedef std::vector<std::pair<std::string, dbus_variant>> properties_dict;
-    std::vector<std::pair<std::string, properties_dict>> sig;
-    sig.emplace_back(interface->get_interface_name(), properties_dict());
-    auto& prop_dict = sig.back().second;
-    for (auto& property : interface->get_properties_map()) {
-      prop_dict.emplace_back(property);
+  // Adds org.boost.dbus.Subscriptions, through which peers can have this
+  // object's signals addressed to them instead of broadcast
+  void enable_subscriptions() {
+    if (interfaces.find("org.boost.dbus.Subscriptions") == interfaces.end()) {
+      register_interface(
+          std::make_shared<SubscriptionsInterface>(conn, interfaces));
     }
+  }
+
+  // Adds org.boost.dbus.Metrics, through which peers can read the transport
+  // metrics of the connection this object is served on
+  void enable_metrics() {
+    if (interfaces.find("org.boost.dbus.Metrics") == interfaces.end()) {
+      register_interface(std::make_shared<MetricsInterface>(conn));
+    }
+  }
 
-    m.pack(object_name, sig);
+  // Hold back InterfacesAdded signals until commit() is called
+  void defer_interfaces_added() {
+    registration_mode = RegistrationMode::DEFERRED;
+  }
 
-    conn->send(m, std::chrono::seconds(0));
+  // Send one InterfacesAdded for everything registered since the object was
+  // deferred, and go back to signalling each registration as it happens
+  void commit() {
+    registration_mode = RegistrationMode::IMMEDIATE;
+    send_interfaces_added();
   }
 
-  auto get_interfaces() { return interfaces; }
+  void send_interfaces_added() {
+    if (pending_interfaces.empty()) {
+      return;
+    }
+    dbus::endpoint endpoint("", object_name,
+                            "org.freedesktop.DBus.ObjectManager");
+    auto m = message::new_signal(endpoint, "InterfacesAdded");
+    message::packer p(m);
+    bool packed = p.pack(object_path{object_name}) &&
+                  pack_interfaces(p, pending_interfaces);
+    pending_interfaces.clear();
+
+    if (packed) {
+      conn->send(m, std::chrono::seconds(0));
+    }
+  }
 
-  void call(dbus::message& m) {
-    auto interface = interfaces.find(m.get_interface());
-    if (interface != interfaces.end()) {
-      interface->second->call(m);
-    }  // TODO(ed) send something when interface doesn't exist?
+  // Packs an a{sa{sv}} straight out of each interface's property map, rather
+  // than copying the properties into an intermediate vector first
+  static bool pack_interfaces(message::packer& p,
+                              const interfaces_map_type& interfaces) {
+    typedef std::pair<std::string, DbusInterface::properties_map_type>
+        interface_entry;
+    static const constexpr auto signature =
+        element_signature<interface_entry>::code;
+    message::packer sub;
+    if (!p.iter_.open_container(DBUS_TYPE_ARRAY, &signature[0], sub.iter_)) {
+      return false;
+    }
+    for (auto& interface : interfaces) {
+      if (!sub.pack_dict_entry(interface.first,
+                               interface.second->get_properties_map())) {
+        return false;
+      }
+    }
+    return p.iter_.close_container(sub.iter_);
+  }
+
+  const interfaces_map_type& get_interfaces() { return interfaces; }
+
+  bool call(dbus::message& m) {
+    if (profiler) {
+      return profiler->record(m, [&]() { return call_interface(m); });
+    }
+    return call_interface(m);
   }
 
   std::string object_name;
@@ -411,130 +904,177 @@ class DbusObject {
   std::shared_ptr<DbusInterface> object_manager_iface;
 
   std::function<void(boost::system::error_code, message)> callback;
-  boost::container::flat_map<std::string, std::shared_ptr<DbusInterface>>
-      interfaces;
+
+  RegistrationMode registration_mode;
+  interfaces_map_type pending_interfaces;
+
+  // Set by DbusObjectServer::enable_profiling()
+  std::shared_ptr<method_profiler> profiler;
+
+ private:
+  // Only changed through register_interface(), which marks interface_table
+  // stale
+  interfaces_map_type interfaces;
+
+  bool call_interface(dbus::message& m) {
+    if (interface_table_stale) {
+      interface_table.assign(interfaces);
+      interface_table_stale = false;
+    }
+    DbusInterface* interface = interface_table.find(m.get_interface_view());
+    if (interface == nullptr) {
+      return false;
+    }
+    return interface->call(m);
+  }
+
+  detail::dispatch_table<DbusInterface> interface_table;
+  bool interface_table_stale = true;
 };
 
-class DbusObjectServer {
+class DbusObjectServer;
+
+namespace detail {
+
+/// The fallback registration on / shared by a connection's object servers.
+/**
+ * libdbus takes one handler per path, so the first DbusObjectServer on a
+ * connection registers the fallback and later ones join it.  It serves the
+ * root object, and answers Introspect and GetManagedObjects for every node,
+ * across all the servers on the connection.  The last server to go removes
+ * the registration.
+ */
+class object_server_root {
  public:
-  DbusObjectServer(std::shared_ptr<dbus::connection>& conn) : conn(conn) {
-    introspect_filter =
-        std::make_unique<dbus::filter>(conn, [](dbus::message m) {
-          if (m.get_type() != "method_call") {
-            return false;
-          }
-          if (m.get_interface() != "org.freedesktop.DBus.Introspectable") {
-            return false;
-          }
-          if (m.get_member() != "Introspect") {
-            return false;
-          };
-          return true;
-        });
+  static std::shared_ptr<object_server_root> get(const connection_ptr& c) {
+    auto root = c->object_server_root_.lock();
+    if (!root) {
+      root.reset(new object_server_root(c));
+      c->object_server_root_ = root;
+    }
+    return root;
+  }
 
-    introspect_filter->async_dispatch(
-        [&](const boost::system::error_code ec, dbus::message m) {
-          on_introspect(ec, m);
-        });
+  object_server_root(const object_server_root&) = delete;
+  object_server_root& operator=(const object_server_root&) = delete;
 
-    object_manager_filter =
-        std::make_unique<dbus::filter>(conn, [](dbus::message m) {
+  ~object_server_root() { connection_->unregister_object_path("/"); }
 
-          if (m.get_type() != "method_call") {
-            return false;
-          }
-          if (m.get_interface() != "org.freedesktop.DBus.ObjectManager") {
-            return false;
-          }
-          if (m.get_member() != "GetManagedObjects") {
-            return false;
-          };
-          return true;
-        });
+  void add(DbusObjectServer* server) { servers_.push_back(server); }
 
-    object_manager_filter->async_dispatch(
-        [&](const boost::system::error_code ec, dbus::message m) {
-          on_get_managed_objects(ec, m);
-        });
+  void remove(DbusObjectServer* server) {
+    servers_.erase(std::remove(servers_.begin(), servers_.end(), server),
+                   servers_.end());
+  }
 
-    method_filter = std::make_unique<dbus::filter>(conn, [](dbus::message m) {
+  /// The servers on the connection, oldest first.
+  const std::vector<DbusObjectServer*>& servers() const { return servers_; }
 
-      if (m.get_type() != "method_call") {
-        return false;
-      }
-      return true;
-    });
+ private:
+  explicit object_server_root(const connection_ptr& c) : connection_(c) {
+    static const DBusObjectPathVTable vtable = {nullptr, &message_function};
+    connection_->register_object_path("/", vtable, this, true);
+  }
 
-    method_filter->async_dispatch(
-        [&](const boost::system::error_code ec, dbus::message m) {
-          on_method_call(ec, m);
-        });
-  };
+  static DBusHandlerResult message_function(DBusConnection* c, DBusMessage* m,
+                                            void* userdata);
 
-  std::shared_ptr<dbus::connection>& get_connection() { return conn; }
-  void on_introspect(const boost::system::error_code ec, dbus::message m) {
-    auto xml = get_xml_for_path(m.get_path());
-    auto ret = dbus::message::new_return(m);
-    ret.pack(xml);
-    conn->async_send(
-        ret, [](const boost::system::error_code ec, dbus::message r) {});
+  connection_ptr connection_;
+  std::vector<DbusObjectServer*> servers_;
+};
 
-    introspect_filter->async_dispatch(
-        [&](const boost::system::error_code ec, dbus::message m) {
-          on_introspect(ec, m);
-        });
-  }
+}  // namespace detail
 
-  void on_method_call(const boost::system::error_code ec, dbus::message m) {
-    if (ec) {
-      std::cerr << "on_method_call error: " << ec << "\n";
-    } else {
-      auto path = m.get_path();
-      // TODO(ed) objects should be a map
+class DbusObjectServer {
+ public:
+  /// Batches object registration.
+  /**
+   * Objects added through a transaction can be called and introspected right
+   * away, but their InterfacesAdded signals are held back.  On commit (or
+   * destruction) each object sends one InterfacesAdded covering all of its
+   * interfaces, so populating many objects costs one signal per object rather
+   * than one per interface.
+   */
+  class transaction {
+   public:
+    explicit transaction(DbusObjectServer& server) : server(server) {}
+    transaction(const transaction&) = delete;
+    transaction& operator=(const transaction&) = delete;
+    ~transaction() { commit(); }
+
+    std::shared_ptr<DbusObject> add_object(const std::string& name) {
+      auto x = std::make_shared<DbusObject>(server.conn, name,
+                                            RegistrationMode::DEFERRED);
+      server.register_object(x);
+      objects.emplace_back(x);
+      return x;
+    }
+
+    void register_object(std::shared_ptr<DbusObject> object) {
+      object->defer_interfaces_added();
+      server.register_object(object);
+      objects.emplace_back(std::move(object));
+    }
+
+    void commit() {
       for (auto& object : objects) {
-        if (object->object_name == path) {
-          object->call(m);
-          break;
-        }
+        object->commit();
       }
+      objects.clear();
     }
-    method_filter->async_dispatch(
-        [&](const boost::system::error_code ec, dbus::message m) {
-          on_method_call(ec, m);
-        });
-  }
-
-  void on_get_managed_objects(const boost::system::error_code ec,
-                              dbus::message m) {
-    typedef std::vector<std::pair<std::string, dbus::dbus_variant>>
-        properties_dict;
 
-    typedef std::vector<std::pair<std::string, properties_dict>>
-        interfaces_dict;
+   private:
+    DbusObjectServer& server;
+    std::vector<std::shared_ptr<DbusObject>> objects;
+  };
 
-    std::vector<std::pair<object_path, interfaces_dict>> dict;
+  /// Serve objects on a connection.
+  /**
+   * Every object gets its own path registration, so libdbus routes its
+   * method calls straight to it.  The fallback on /, shared with any other
+   * server on the connection, picks up whatever the objects decline, which
+   * is where Introspect and GetManagedObjects are answered for any node in
+   * the tree.  Servers sharing a connection can't register the same path.
+   */
+  DbusObjectServer(std::shared_ptr<dbus::connection>& conn)
+      : conn(conn), root(detail::object_server_root::get(conn)) {
+    root->add(this);
+  };
 
+  ~DbusObjectServer() {
     for (auto& object : objects) {
-      interfaces_dict i;
-      for (auto& interface : object->get_interfaces()) {
-        properties_dict p;
-
-        for (auto& property : interface.second->get_properties_map()) {
-          p.push_back(property);
-        }
-        i.emplace_back(interface.second->get_interface_name(), std::move(p));
+      if (object.first != "/") {
+        conn->unregister_object_path(object.first);
       }
-      dict.emplace_back(object_path{object->object_name}, std::move(i));
     }
+    root->remove(this);
+  }
+
+  DbusObjectServer(const DbusObjectServer&) = delete;
+  DbusObjectServer& operator=(const DbusObjectServer&) = delete;
+
+  std::shared_ptr<dbus::connection>& get_connection() { return conn; }
+
+  // Answers for every server on the connection
+  void on_introspect(dbus::message& m) {
+    auto xml = xml_for_path(root->servers(), m.get_path());
     auto ret = dbus::message::new_return(m);
-    ret.pack(dict);
+    ret.pack(xml);
     conn->async_send(
         ret, [](const boost::system::error_code ec, dbus::message r) {});
+  }
 
-    object_manager_filter->async_dispatch(
-        [&](const boost::system::error_code ec, dbus::message m) {
-          on_get_managed_objects(ec, m);
-        });
+  // Answers for every server on the connection
+  void on_get_managed_objects(dbus::message& m) {
+    auto ret = dbus::message::new_return(m);
+    message::packer p(ret);
+    if (!pack_managed_objects(p, root->servers())) {
+      detail::send_error(*conn, m, DBUS_ERROR_FAILED,
+                         "Failed to pack managed objects");
+      return;
+    }
+    conn->async_send(
+        ret, [](const boost::system::error_code ec, dbus::message r) {});
   }
 
   std::shared_ptr<DbusObject> add_object(const std::string& name) {
@@ -544,16 +1084,59 @@ class DbusObjectServer {
   }
 
   void register_object(std::shared_ptr<DbusObject> object) {
-    objects.emplace_back(object);
+    const std::string& path = object->object_name;
+    // The root object shares the fallback registration on /
+    if (path != "/") {
+      if (objects.find(path) != objects.end()) {
+        conn->unregister_object_path(path);
+      }
+      conn->register_object_path(path, object_vtable(), object.get());
+    }
+    object->profiler = profiler;
+    objects[path] = object;
   }
 
   void remove_object(std::shared_ptr<DbusObject> object) {
-    std::remove(objects.begin(), objects.end(), object);
+    auto it = objects.find(object->object_name);
+    if (it == objects.end() || it->second != object) {
+      return;
+    }
+    if (it->first != "/") {
+      conn->unregister_object_path(it->first);
+    }
+    objects.erase(it);
   }
 
   void flush(void) { conn->flush(); }
 
+  /// Time every method call the server's objects handle.
+  /**
+   * Applies to objects already registered and to those registered later.
+   * Calling it again returns the same profiler.
+   */
+  method_profiler& enable_profiling() {
+    if (!profiler) {
+      profiler = std::make_shared<method_profiler>(conn);
+      for (auto& object : objects) {
+        object.second->profiler = profiler;
+      }
+    }
+    return *profiler;
+  }
+
+  /// The profiler installed by enable_profiling(), or nullptr.
+  method_profiler* get_profiler() { return profiler.get(); }
+
   std::string get_xml_for_path(const std::string& path) {
+    return xml_for_path({this}, path);
+  }
+
+ private:
+  friend class detail::object_server_root;
+
+  // Introspection data for a path, covering the objects of every server
+  static std::string xml_for_path(
+      const std::vector<DbusObjectServer*>& servers, const std::string& path) {
     std::string newpath(path);
 
     if (newpath == "/") {
@@ -566,7 +1149,17 @@ class DbusObjectServer {
         "\"-//freedesktop//DTD D-BUS Object Introspection 1.0//EN\" "
         "\"http://www.freedesktop.org/standards/dbus/1.0/"
         "introspect.dtd\">\n<node>");
-    for (auto& object : objects) {
+    for (DbusObjectServer* server : servers) {
+      server->append_xml_for_path(newpath, xml, node_names);
+    }
+    xml += "</node>";
+    return xml;
+  }
+
+  void append_xml_for_path(const std::string& newpath, std::string& xml,
+                           boost::container::flat_set<std::string>& node_names) {
+    for (auto& object_pair : objects) {
+      auto& object = object_pair.second;
       std::string& object_name = object->object_name;
       // exact match
       if (object->object_name == newpath) {
@@ -603,61 +1196,8 @@ class DbusObjectServer {
             "    </method>"
             "</interface>";
 
-        for (auto& interface_pair : object->interfaces) {
-          xml += "<interface name=\"";
-          xml += interface_pair.first;
-          xml += "\">";
-          for (auto& method : interface_pair.second->get_methods()) {
-            xml += "<method name=\"";
-            xml += method.first;
-            xml += "\">";
-            for (auto& arg : method.second->get_args()) {
-              xml += "<arg name=\"";
-              xml += arg.name;
-              xml += "\" type=\"";
-              xml += arg.type;
-              xml += "\" direction=\"";
-              xml += arg.direction;
-              xml += "\"/>";
-            }
-            xml += "</method>";
-          }
-
-          for (auto& signal : interface_pair.second->get_signals()) {
-            xml += "<signal name=\"";
-            xml += signal.first;
-            xml += "\">";
-            for (auto& arg : signal.second->get_args()) {
-              xml += "<arg name=\"";
-              xml += arg.name;
-              xml += "\" type=\"";
-              xml += arg.type;
-              xml += "\"/>";
-            }
-
-            xml += "</signal>";
-          }
-
-          for (auto& property : interface_pair.second->get_properties_map()) {
-            xml += "<property name=\"";
-            xml += property.first;
-            xml += "\" type=\"";
-
-            std::string type = std::string(boost::apply_visitor(
-                [&](auto val) {
-                  static const auto constexpr sig =
-                      element_signature<decltype(val)>::code;
-                  return &sig[0];
-                },
-                property.second));
-            xml += type;
-            xml += "\" access=\"";
-            // TODO direction can be readwrite, read, or write.  Need to
-            // make this configurable
-            xml += "readwrite";
-            xml += "\"/>";
-          }
-          xml += "</interface>";
+        for (auto& interface_pair : object->get_interfaces()) {
+          interface_pair.second->append_introspection(xml);
         }
       } else if (boost::starts_with(object_name, newpath)) {
         auto slash_index = object_name.find("/", newpath.size() + 1);
@@ -672,17 +1212,107 @@ class DbusObjectServer {
         }
       }
     }
-    xml += "</node>";
-    return xml;
   }
 
- private:
+  // Packs the a{oa{sa{sv}}} of GetManagedObjects from every server
+  static bool pack_managed_objects(
+      message::packer& p, const std::vector<DbusObjectServer*>& servers) {
+    message::packer dict;
+    if (!p.iter_.open_container(DBUS_TYPE_ARRAY, "{oa{sa{sv}}}",
+                                dict.iter_)) {
+      return false;
+    }
+    for (DbusObjectServer* server : servers) {
+      for (auto& object : server->objects) {
+        message::packer entry;
+        if (!dict.iter_.open_container(DBUS_TYPE_DICT_ENTRY, NULL,
+                                       entry.iter_) ||
+            !entry.pack(object_path{object.first}) ||
+            !DbusObject::pack_interfaces(entry,
+                                         object.second->get_interfaces()) ||
+            !dict.iter_.close_container(entry.iter_)) {
+          return false;
+        }
+      }
+    }
+    return p.iter_.close_container(dict.iter_);
+  }
+
+  // Hands a call to / to this server's root object, if it has one
+  bool call_root_object(dbus::message& m) {
+    auto it = objects.find("/");
+    return it != objects.end() && it->second->call(m);
+  }
+
+  static DBusHandlerResult object_message_function(DBusConnection* c,
+                                                   DBusMessage* m,
+                                                   void* userdata) {
+    if (dbus_message_get_type(m) != DBUS_MESSAGE_TYPE_METHOD_CALL) {
+      return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+    try {
+      DbusObject& object = *static_cast<DbusObject*>(userdata);
+      message m_(m);
+      if (object.call(m_)) {
+        return DBUS_HANDLER_RESULT_HANDLED;
+      }
+    } catch (...) {
+      // do not throw in C callbacks. Just don't.
+    }
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+  }
+
+  static const DBusObjectPathVTable& object_vtable() {
+    static const DBusObjectPathVTable vtable = {nullptr,
+                                                &object_message_function};
+    return vtable;
+  }
+
   std::shared_ptr<dbus::connection> conn;
-  std::vector<std::shared_ptr<DbusObject>> objects;
-  std::unique_ptr<dbus::filter> introspect_filter;
-  std::unique_ptr<dbus::filter> object_manager_filter;
-  std::unique_ptr<dbus::filter> method_filter;
+  std::shared_ptr<detail::object_server_root> root;
+  // Ordered by path, so GetManagedObjects and introspection are stable
+  std::map<std::string, std::shared_ptr<DbusObject>> objects;
+  std::shared_ptr<method_profiler> profiler;
 };
+
+namespace detail {
+
+inline DBusHandlerResult object_server_root::message_function(
+    DBusConnection* c, DBusMessage* m, void* userdata) {
+  if (dbus_message_get_type(m) != DBUS_MESSAGE_TYPE_METHOD_CALL) {
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+  }
+  try {
+    object_server_root& root = *static_cast<object_server_root*>(userdata);
+    if (root.servers_.empty()) {
+      return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+    message m_(m);
+    if (dbus_message_has_path(m, "/")) {
+      for (DbusObjectServer* server : root.servers_) {
+        if (server->call_root_object(m_)) {
+          return DBUS_HANDLER_RESULT_HANDLED;
+        }
+      }
+    }
+    if (dbus_message_is_method_call(m, "org.freedesktop.DBus.Introspectable",
+                                    "Introspect")) {
+      root.servers_.front()->on_introspect(m_);
+      return DBUS_HANDLER_RESULT_HANDLED;
+    }
+    if (dbus_message_is_method_call(m, "org.freedesktop.DBus.ObjectManager",
+                                    "GetManagedObjects")) {
+      root.servers_.front()->on_get_managed_objects(m_);
+      return DBUS_HANDLER_RESULT_HANDLED;
+    }
+  } catch (...) {
+    // do not throw in C callbacks. Just don't.
+  }
+  // libdbus answers unhandled method calls with UnknownMethod
+  return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+}  // namespace detail
 }
 
 #endif /* DBUS_PROPERTIES_HPP */
@@ -0,0 +1,182 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_PROXY_HPP
+#define DBUS_PROXY_HPP
+
+#include <dbus/connection.hpp>
+#include <dbus/endpoint.hpp>
+#include <dbus/message.hpp>
+#include <dbus/name_watcher.hpp>
+#include <dbus/signal_subscription.hpp>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <boost/asio.hpp>
+
+namespace dbus {
+
+/// Base class for client proxies generated from introspection XML.
+/**
+ * A proxy is bound to one interface on one remote object.  Generated
+ * subclasses build a call message per method up front and copy it for each
+ * call, and check replies and signals against signatures that were worked
+ * out when the proxy was generated.
+ */
+class proxy {
+  connection_ptr connection_;
+  endpoint endpoint_;
+  // Tracks who owns a well-known destination, for subscribe()
+  std::shared_ptr<name_watcher> owners_;
+
+ public:
+  proxy(connection_ptr c, const std::string& destination,
+        const std::string& path, const std::string& interface)
+      : connection_(c), endpoint_(destination, path, interface) {}
+
+  const connection_ptr& get_connection() const { return connection_; }
+
+  const endpoint& get_endpoint() const { return endpoint_; }
+
+ protected:
+  /// Build the call message that async_call will copy for each call.
+  message new_call(const std::string& member) const {
+    return message::new_call(endpoint_, member);
+  }
+
+  /// Call a method, checking the reply against the expected signature.
+  /**
+   * The handler is invoked as handler(error_code, Outputs...); the error code
+   * is set to invalid_argument if the reply has the wrong signature.
+   */
+  template <typename... Outputs, typename Handler, typename... Inputs>
+  void async_call(const message& prototype, const char* reply_signature,
+                  Handler handler, const Inputs&... inputs) {
+    message m = message::new_copy(prototype);
+    if (!m.pack(inputs...)) {
+      connection_->get_io_service().post([handler]() mutable {
+        std::tuple<Outputs...> outputs;
+        index_apply<sizeof...(Outputs)>([&](auto... Is) {
+          handler(boost::system::errc::make_error_code(
+                      boost::system::errc::invalid_argument),
+                  std::get<Is>(outputs)...);
+        });
+      });
+      return;
+    }
+    connection_->async_send(m, [handler, reply_signature](
+                                   boost::system::error_code ec,
+                                   message r) mutable {
+      std::tuple<Outputs...> outputs;
+      if (!ec && (!dbus_message_has_signature(r, reply_signature) ||
+                  !unpack_into_tuple(outputs, r))) {
+        ec = boost::system::errc::make_error_code(
+            boost::system::errc::invalid_argument);
+      }
+      index_apply<sizeof...(Outputs)>(
+          [&](auto... Is) { handler(ec, std::get<Is>(outputs)...); });
+    });
+  }
+
+  /// Read a property through org.freedesktop.DBus.Properties.Get.
+  template <typename T, typename Handler>
+  void async_get_property(const char* name, Handler handler) {
+    message m = message::new_call(
+        endpoint(endpoint_.get_process_name(), endpoint_.get_path(),
+                 "org.freedesktop.DBus.Properties"),
+        "Get");
+    m.pack(endpoint_.get_interface(), name);
+    connection_->async_send(
+        m, [handler](boost::system::error_code ec, message r) mutable {
+          dbus_variant v;
+          T value{};
+          if (!ec) {
+            const T* p = nullptr;
+            if (dbus_message_has_signature(r, "v") && r.unpack(v)) {
+              p = boost::get<T>(&v);
+            }
+            if (p == nullptr) {
+              ec = boost::system::errc::make_error_code(
+                  boost::system::errc::invalid_argument);
+            } else {
+              value = *p;
+            }
+          }
+          handler(ec, value);
+        });
+  }
+
+  /// Write a property through org.freedesktop.DBus.Properties.Set.
+  template <typename T, typename Handler>
+  void async_set_property(const char* name, const T& value, Handler handler) {
+    message m = message::new_call(
+        endpoint(endpoint_.get_process_name(), endpoint_.get_path(),
+                 "org.freedesktop.DBus.Properties"),
+        "Set");
+    m.pack(endpoint_.get_interface(), name, dbus_variant(value));
+    connection_->async_send(
+        m, [handler](boost::system::error_code ec, message) mutable {
+          handler(ec);
+        });
+  }
+
+  /// Subscribe to a signal on this object, typed by its arguments.
+  /**
+   * Signals whose body does not have the expected signature are ignored, as
+   * are those not sent by the destination.  When that is a well-known name,
+   * signals count as the destination's if they come from its owner at the
+   * time, so none are delivered until the owner has been looked up.
+   */
+  template <typename... Args, typename Handler>
+  std::unique_ptr<signal_subscription> subscribe(const char* member,
+                                                 const char* signature,
+                                                 Handler handler) {
+    std::string path = endpoint_.get_path();
+    std::string interface = endpoint_.get_interface();
+    std::string name = member;
+    std::string types = signature;
+    std::string rule = "type='signal',sender='" +
+                       endpoint_.get_process_name() + "',path='" + path +
+                       "',interface='" + interface + "',member='" + name +
+                       "'";
+    std::string destination = endpoint_.get_process_name();
+    if (!destination.empty() && destination[0] != ':' && !owners_) {
+      owners_ = std::make_shared<name_watcher>(connection_);
+      owners_->watch(destination);
+    }
+    std::shared_ptr<name_watcher> owners = owners_;
+    return std::unique_ptr<signal_subscription>(new signal_subscription(
+        connection_, rule,
+        [path, interface, name, types, destination, owners](message& m) {
+          return dbus_message_is_signal(m, interface.c_str(), name.c_str()) &&
+                 dbus_message_has_path(m, path.c_str()) &&
+                 dbus_message_has_signature(m, types.c_str()) &&
+                 sent_by(m, destination, owners.get());
+        },
+        [handler](message& m) mutable {
+          std::tuple<Args...> args;
+          if (!unpack_into_tuple(args, m)) return;
+          index_apply<sizeof...(Args)>(
+              [&](auto... Is) { handler(std::get<Is>(args)...); });
+        }));
+  }
+
+ private:
+  // Whether m came from the destination, or its current owner if owners is
+  // tracking it.  Peer-to-peer connections have no names to check.
+  static bool sent_by(message& m, const std::string& destination,
+                      const name_watcher* owners) {
+    if (owners == nullptr) {
+      return destination.empty() ||
+             dbus_message_has_sender(m, destination.c_str());
+    }
+    const std::string& owner = owners->get_owner(destination);
+    return !owner.empty() && dbus_message_has_sender(m, owner.c_str());
+  }
+};
+
+}  // namespace dbus
+
+#endif  // DBUS_PROXY_HPP
@@ -0,0 +1,322 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_REPLY_CACHE_HPP
+#define DBUS_REPLY_CACHE_HPP
+
+#include <dbus/connection.hpp>
+#include <dbus/endpoint.hpp>
+#include <dbus/message.hpp>
+#include <dbus/signal_subscription.hpp>
+#include <dbus/single_flight.hpp>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <boost/asio.hpp>
+
+namespace dbus {
+
+/// Client-side cache of method replies, for methods whose answers rarely
+/// change.
+/**
+ * Caching is opt-in per method: set_ttl() names the methods whose replies
+ * may be reused, and calls to any other method go straight to the bus.
+ * Replies are keyed by the whole marshalled call, so destination, path,
+ * interface, member and every argument byte have to match for a hit.
+ *
+ * A hit is answered from the decoded reply without touching the bus, posted
+ * to the connection's io_service like any other reply.  Concurrent misses
+ * for the same call share one round trip (see single_flight).  Error
+ * replies are never cached.  Entries expire after their method's TTL, the
+ * least recently used ones are evicted beyond max_entries(), and all of a
+ * destination's entries are dropped when NameOwnerChanged reports that its
+ * owner changed.
+ */
+class reply_cache {
+ public:
+  typedef std::chrono::steady_clock clock;
+
+  explicit reply_cache(connection_ptr c, std::size_t max_entries = 256)
+      : state_(std::make_shared<state>(c, max_entries)) {
+    state_->watch_owners();
+  }
+
+  reply_cache(const reply_cache&) = delete;
+  reply_cache& operator=(const reply_cache&) = delete;
+
+  /// Cache replies to interface.member for ttl.  A zero ttl stops caching
+  /// the method and drops nothing already cached.
+  void set_ttl(const std::string& interface, const std::string& member,
+               clock::duration ttl) {
+    if (ttl <= clock::duration::zero()) {
+      state_->ttls.erase(std::make_pair(interface, member));
+    } else {
+      state_->ttls[std::make_pair(interface, member)] = ttl;
+    }
+  }
+
+  /// The most replies kept at once.  Shrinking evicts straight away.
+  void set_max_entries(std::size_t n) {
+    state_->max_entries = n;
+    state_->trim();
+  }
+
+  std::size_t max_entries() const { return state_->max_entries; }
+
+  /// Read the time from now() instead of the steady clock, so tests can
+  /// expire entries without waiting for them.
+  void set_clock(std::function<clock::time_point()> now) {
+    state_->now = std::move(now);
+  }
+
+  /// Replies currently held, including expired ones not yet evicted.
+  std::size_t size() const { return state_->entries.size(); }
+
+  /// Drop every reply from one destination.
+  void invalidate(const std::string& destination) {
+    state_->invalidate(destination);
+  }
+
+  void clear() {
+    state_->entries.clear();
+    state_->lru.clear();
+    state_->destinations.clear();
+  }
+
+  /// connection::async_method_call, answered from the cache when possible.
+  template <typename MessageHandler, typename... InputArgs>
+  void async_method_call(MessageHandler handler, const endpoint& e,
+                         const InputArgs&... a) {
+    typedef typename function_traits<MessageHandler>::decayed_arg_types
+        function_tuple;
+    typedef typename connection::strip_first_arg<function_tuple>::type
+        unpack_type;
+
+    auto ttl = state_->ttls.find(
+        std::make_pair(e.get_interface(), e.get_member()));
+    if (ttl == state_->ttls.end() || state_->max_entries == 0) {
+      state_->connection->async_method_call(handler, e, a...);
+      return;
+    }
+
+    message m = message::new_call(e);
+    if (!m.pack(a...)) {
+      state_->connection->async_method_call(handler, e, a...);
+      return;
+    }
+    std::string key = single_flight::key_of(m);
+
+    auto hit = state_->lookup(key);
+    if (hit != nullptr) {
+      unpack_type result;
+      if (state::decoded<unpack_type>(*hit, result)) {
+        state_->connection->get_io_service().post(
+            [handler, result]() mutable {
+              index_apply<std::tuple_size<unpack_type>{}>([&](auto... Is) {
+                handler(boost::system::error_code(), std::get<Is>(result)...);
+              });
+            });
+        return;
+      }
+      // Cached for a handler that decodes it differently, and this one
+      // can't; ask again rather than answer with an error
+      state_->erase(key);
+    }
+
+    std::weak_ptr<state> weak = state_;
+    clock::duration lifetime = ttl->second;
+    std::string destination = e.get_process_name();
+    state_->flights.async_send(
+        m, [handler, weak, key, lifetime, destination](
+               boost::system::error_code ec, message r) mutable {
+          unpack_type result;
+          if (!ec) {
+            if (!unpack_into_tuple(result, r)) {
+              ec = boost::system::errc::make_error_code(
+                  boost::system::errc::invalid_argument);
+            } else if (auto s = weak.lock()) {
+              s->insert(key, destination, r, lifetime,
+                        std::make_shared<unpack_type>(result),
+                        state::type_tag<unpack_type>());
+            }
+          }
+          index_apply<std::tuple_size<unpack_type>{}>(
+              [&](auto... Is) { handler(ec, std::get<Is>(result)...); });
+        });
+  }
+
+ private:
+  struct entry {
+    entry(const std::string& destination, const message& reply,
+          clock::time_point expires)
+        : destination(destination), reply(reply), expires(expires) {}
+
+    std::string destination;
+    message reply;
+    clock::time_point expires;
+    // The reply as last decoded, tagged with the tuple type it was decoded
+    // into, so repeat hits from the same call site skip unpacking
+    const void* decoded_type = nullptr;
+    std::shared_ptr<const void> decoded;
+    std::list<const std::string*>::iterator lru;
+  };
+
+  struct state : std::enable_shared_from_this<state> {
+    state(connection_ptr c, std::size_t max_entries)
+        : connection(c), flights(c), max_entries(max_entries) {}
+
+    template <typename T>
+    static const void* type_tag() {
+      static const char tag = 0;
+      return &tag;
+    }
+
+    template <typename Tuple>
+    static bool decoded(entry& e, Tuple& result) {
+      if (e.decoded_type == type_tag<Tuple>()) {
+        result = *std::static_pointer_cast<const Tuple>(e.decoded);
+        return true;
+      }
+      if (!unpack_into_tuple(result, e.reply)) {
+        return false;
+      }
+      e.decoded = std::make_shared<Tuple>(result);
+      e.decoded_type = type_tag<Tuple>();
+      return true;
+    }
+
+    entry* lookup(const std::string& key) {
+      auto it = entries.find(key);
+      if (it == entries.end()) {
+        return nullptr;
+      }
+      if (it->second.expires <= now()) {
+        erase(key);
+        return nullptr;
+      }
+      lru.splice(lru.begin(), lru, it->second.lru);
+      return &it->second;
+    }
+
+    void insert(const std::string& key, const std::string& destination,
+                const message& reply, clock::duration ttl,
+                std::shared_ptr<const void> decoded, const void* decoded_type) {
+      if (max_entries == 0 || key.empty()) {
+        return;
+      }
+      auto it = entries.find(key);
+      if (it == entries.end()) {
+        it = entries
+                 .emplace(std::piecewise_construct, std::forward_as_tuple(key),
+                          std::forward_as_tuple(destination, reply,
+                                                now() + ttl))
+                 .first;
+        lru.push_front(&it->first);
+        it->second.lru = lru.begin();
+        watch(destination);
+      } else {
+        // Every waiter on a shared miss lands here; refresh, don't count
+        // the destination twice
+        it->second.reply = reply;
+        it->second.expires = now() + ttl;
+        lru.splice(lru.begin(), lru, it->second.lru);
+      }
+      it->second.decoded = std::move(decoded);
+      it->second.decoded_type = decoded_type;
+      trim();
+    }
+
+    void erase(const std::string& key) {
+      auto it = entries.find(key);
+      if (it == entries.end()) {
+        return;
+      }
+      std::string destination = it->second.destination;
+      lru.erase(it->second.lru);
+      entries.erase(it);
+      unwatch(destination);
+    }
+
+    void trim() {
+      while (entries.size() > max_entries) {
+        erase(*lru.back());
+      }
+    }
+
+    void invalidate(const std::string& destination) {
+      for (auto it = entries.begin(); it != entries.end();) {
+        if (it->second.destination == destination) {
+          lru.erase(it->second.lru);
+          it = entries.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      destinations.erase(destination);
+    }
+
+    // One NameOwnerChanged match for the cache's lifetime, added once here
+    // rather than per destination, so caching and evicting replies never
+    // wait on AddMatch or RemoveMatch.  Changes to names without cached
+    // replies are ignored.
+    void watch_owners() {
+      std::weak_ptr<state> weak = shared_from_this();
+      owner_changes.reset(new signal_subscription(
+          connection,
+          "type='signal',sender='org.freedesktop.DBus',"
+          "interface='org.freedesktop.DBus',member='NameOwnerChanged'",
+          [](message& m) {
+            return dbus_message_is_signal(m, "org.freedesktop.DBus",
+                                          "NameOwnerChanged") &&
+                   dbus_message_has_sender(m, "org.freedesktop.DBus");
+          },
+          [weak](message& m) {
+            const char* name = nullptr;
+            auto s = weak.lock();
+            if (s && dbus_message_get_args(m, nullptr, DBUS_TYPE_STRING,
+                                           &name, DBUS_TYPE_INVALID) &&
+                s->destinations.count(name) > 0) {
+              s->invalidate(name);
+            }
+          }));
+    }
+
+    // Counts the cached replies from each destination
+    void watch(const std::string& destination) {
+      if (!destination.empty()) {
+        destinations[destination]++;
+      }
+    }
+
+    void unwatch(const std::string& destination) {
+      auto it = destinations.find(destination);
+      if (it != destinations.end() && --it->second == 0) {
+        destinations.erase(it);
+      }
+    }
+
+    connection_ptr connection;
+    std::function<clock::time_point()> now = &clock::now;
+    single_flight flights;
+    std::size_t max_entries;
+    std::map<std::pair<std::string, std::string>, clock::duration> ttls;
+    std::unordered_map<std::string, entry> entries;
+    // Most recently used first; points at the keys in entries
+    std::list<const std::string*> lru;
+    std::map<std::string, std::size_t> destinations;
+    std::unique_ptr<signal_subscription> owner_changes;
+  };
+
+  std::shared_ptr<state> state_;
+};
+
+}  // namespace dbus
+
+#endif  // DBUS_REPLY_CACHE_HPP
@@ -0,0 +1,66 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_SIGNAL_SUBSCRIPTION_HPP
+#define DBUS_SIGNAL_SUBSCRIPTION_HPP
+
+#include <dbus/connection.hpp>
+#include <dbus/filter.hpp>
+#include <dbus/match.hpp>
+#include <dbus/message.hpp>
+#include <functional>
+#include <memory>
+#include <string>
+#include <boost/asio.hpp>
+
+namespace dbus {
+
+/// A signal handler installed on a connection.
+/**
+ * Holds the match rule and filter for one signal; destroying the
+ * subscription removes both.  Matching signals are not claimed, so other
+ * filters and subscriptions still see them, and any already posted for
+ * dispatch when the subscription goes away are dropped.
+ */
+class signal_subscription {
+  struct state {
+    std::function<void(message&)> handler;
+    std::unique_ptr<filter> signal_filter;
+    std::unique_ptr<match> rule_match;
+  };
+
+  std::shared_ptr<state> state_;
+
+ public:
+  signal_subscription(connection_ptr c, const std::string& rule,
+                      std::function<bool(message&)> predicate,
+                      std::function<void(message&)> handler)
+      : state_(std::make_shared<state>()) {
+    state_->handler = std::move(handler);
+    std::weak_ptr<state> weak = state_;
+    // Handlers wait their turn behind replies; see detail::dispatch_queue
+    std::weak_ptr<detail::dispatch_queue> dispatch =
+        c->get_implementation().dispatch;
+    state_->signal_filter.reset(
+        new filter(c, [weak, predicate, dispatch](message& m) {
+          auto d = dispatch.lock();
+          if (d && predicate(m)) {
+            d->push([weak, m]() mutable {
+              if (auto s = weak.lock()) s->handler(m);
+            });
+          }
+          return false;
+        }));
+    state_->rule_match.reset(new match(c, std::string(rule)));
+    c->get_implementation().start(c->get_io_service());
+  }
+
+  signal_subscription(const signal_subscription&) = delete;
+  signal_subscription& operator=(const signal_subscription&) = delete;
+};
+
+}  // namespace dbus
+
+#endif  // DBUS_SIGNAL_SUBSCRIPTION_HPP
@@ -0,0 +1,130 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_SINGLE_FLIGHT_HPP
+#define DBUS_SINGLE_FLIGHT_HPP
+
+#include <dbus/connection.hpp>
+#include <dbus/endpoint.hpp>
+#include <dbus/message.hpp>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/asio.hpp>
+
+namespace dbus {
+
+/// Coalesces identical method calls that are in flight at the same time.
+/**
+ * A call made while an identical one (same destination, path, interface,
+ * member and argument bytes) is still waiting for its reply is not sent;
+ * its handler joins the first call's, and the one reply is handed to both.
+ * Once the reply arrives the next identical call goes to the bus again, so
+ * nothing is cached.
+ *
+ * Only route calls through here that are safe to answer once for several
+ * callers: reads, not calls with side effects each caller expects.
+ * Handlers are always called, even if the single_flight is destroyed first.
+ */
+class single_flight {
+ public:
+  typedef std::function<void(boost::system::error_code, message)>
+      reply_handler;
+
+  explicit single_flight(connection_ptr c)
+      : state_(std::make_shared<state>(c)) {}
+
+  single_flight(const single_flight&) = delete;
+  single_flight& operator=(const single_flight&) = delete;
+
+  /// Identifies a call by its marshalled header and body, serial unset.
+  static std::string key_of(message& m) {
+    message copy = message::new_copy(m);
+    char* bytes = nullptr;
+    int size = 0;
+    std::string key;
+    if (dbus_message_marshal(copy, &bytes, &size)) {
+      key.assign(bytes, size);
+      dbus_free(bytes);
+    }
+    return key;
+  }
+
+  /// Distinct calls waiting for a reply.
+  std::size_t in_flight() const { return state_->flights.size(); }
+
+  /// Send a call, or wait on an identical one already sent.
+  void async_send(message& m, reply_handler handler) {
+    std::string key = key_of(m);
+    if (key.empty()) {
+      state_->connection->async_send(m, std::move(handler));
+      return;
+    }
+    auto& flight = state_->flights[key];
+    if (flight) {
+      flight->emplace_back(std::move(handler));
+      return;
+    }
+    flight = std::make_shared<std::vector<reply_handler>>();
+    flight->emplace_back(std::move(handler));
+
+    std::weak_ptr<state> weak = state_;
+    auto waiters = flight;
+    state_->connection->async_send(
+        m, [weak, key, waiters](boost::system::error_code ec, message r) {
+          if (auto s = weak.lock()) {
+            s->flights.erase(key);
+          }
+          for (auto& waiter : *waiters) {
+            waiter(ec, r);
+          }
+        });
+  }
+
+  /// connection::async_method_call, sharing replies with identical calls.
+  template <typename MessageHandler, typename... InputArgs>
+  void async_method_call(MessageHandler handler, const endpoint& e,
+                         const InputArgs&... a) {
+    message m = message::new_call(e);
+    if (!m.pack(a...)) {
+      state_->connection->async_method_call(handler, e, a...);
+      return;
+    }
+    async_send(m, [handler](boost::system::error_code ec, message r) mutable {
+      typedef typename function_traits<MessageHandler>::decayed_arg_types
+          function_tuple;
+      typedef typename connection::strip_first_arg<function_tuple>::type
+          unpack_type;
+      // Every waiter unpacks for itself, into whatever types its handler
+      // takes
+      unpack_type response_args;
+      if (!ec && !unpack_into_tuple(response_args, r)) {
+        ec = boost::system::errc::make_error_code(
+            boost::system::errc::invalid_argument);
+      }
+      index_apply<std::tuple_size<unpack_type>{}>([&](auto... Is) {
+        handler(ec, std::get<Is>(response_args)...);
+      });
+    });
+  }
+
+ private:
+  struct state {
+    explicit state(connection_ptr c) : connection(c) {}
+
+    connection_ptr connection;
+    std::unordered_map<std::string,
+                       std::shared_ptr<std::vector<reply_handler>>>
+        flights;
+  };
+
+  std::shared_ptr<state> state_;
+};
+
+}  // namespace dbus
+
+#endif  // DBUS_SINGLE_FLIGHT_HPP
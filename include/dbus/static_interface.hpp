@@ -0,0 +1,546 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_STATIC_INTERFACE_HPP
+#define DBUS_STATIC_INTERFACE_HPP
+
+#include <dbus/element.hpp>
+#include <dbus/properties.hpp>
+#include <cstring>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace dbus {
+
+enum class PropertyAccess { READ, WRITE, READWRITE };
+
+namespace detail {
+
+template <typename... Types>
+struct type_list {};
+
+// The output arguments of a handler returning R.  Tuples are spread into one
+// argument per element, like LambdaDbusMethod does.
+template <typename R>
+struct result_types {
+  typedef type_list<R> type;
+};
+
+template <typename... Types>
+struct result_types<std::tuple<Types...>> {
+  typedef type_list<Types...> type;
+};
+
+template <>
+struct result_types<void> {
+  typedef type_list<> type;
+};
+
+constexpr std::size_t ct_strlen(const char* s) {
+  std::size_t n = 0;
+  while (s[n] != 0) {
+    n++;
+  }
+  return n;
+}
+
+// Counts what would be appended, for sizing a ct_buffer
+struct ct_counter {
+  std::size_t size = 0;
+  constexpr void append(const char* s, std::size_t n) { size += n; }
+};
+
+// Character buffer filled in at compile time
+template <std::size_t N>
+struct ct_buffer {
+  char data[N + 1] = {};
+  std::size_t size = 0;
+  constexpr void append(const char* s, std::size_t n) {
+    for (std::size_t i = 0; i < n; i++) {
+      data[size++] = s[i];
+    }
+  }
+};
+
+template <typename Out>
+constexpr void append(Out& out, const char* s) {
+  out.append(s, ct_strlen(s));
+}
+
+template <typename Out>
+constexpr void append_number(Out& out, std::size_t n) {
+  char digits[20] = {};
+  std::size_t count = 0;
+  do {
+    digits[count++] = '0' + n % 10;
+    n /= 10;
+  } while (n != 0);
+  while (count > 0) {
+    out.append(&digits[--count], 1);
+  }
+}
+
+// Appends the index'th entry of a comma separated name list, or the same
+// prefix + index default as arg_types when the list is too short
+template <typename Out>
+constexpr void append_arg_name(Out& out, const char* names, std::size_t index,
+                               const char* prefix) {
+  std::size_t field = 0;
+  const char* p = names;
+  while (field < index && *p != 0) {
+    if (*p == ',') {
+      field++;
+    }
+    p++;
+  }
+  std::size_t n = 0;
+  while (p[n] != 0 && p[n] != ',') {
+    n++;
+  }
+  if (field == index && n > 0) {
+    out.append(p, n);
+  } else {
+    append(out, prefix);
+    append_number(out, index);
+  }
+}
+
+template <typename Out, typename... Args, std::size_t... Is>
+constexpr void append_args(Out& out, type_list<Args...>,
+                           std::index_sequence<Is...>, const char* names,
+                           const char* prefix, const char* direction) {
+  int expand[] = {
+      0, (append(out, "<arg name=\""),
+          append_arg_name(out, names, Is, prefix), append(out, "\" type=\""),
+          append(out, &element_signature<Args>::code[0]),
+          direction == nullptr ? void()
+                               : (append(out, "\" direction=\""),
+                                  append(out, direction)),
+          append(out, "\"/>"), 0)...};
+  (void)expand;
+}
+
+template <typename Out, typename... Args>
+constexpr void append_args(Out& out, type_list<Args...> args,
+                           const char* names, const char* prefix,
+                           const char* direction) {
+  append_args(out, args, std::index_sequence_for<Args...>{}, names, prefix,
+              direction);
+}
+
+}  // namespace detail
+
+/// Compile time description of a method.
+/**
+ * Created with dbus::method() from a pointer to the member function that
+ * handles the call.  Argument names are comma separated; unnamed arguments
+ * get the same arg_N / out_N names as runtime registered methods.
+ */
+template <typename Handler>
+struct static_method;
+
+template <typename Class, typename R, typename... Args>
+struct static_method<R (Class::*)(Args...)> {
+  typedef R (Class::*handler_type)(Args...);
+  typedef R result_type;
+  typedef std::tuple<typename std::decay<Args>::type...> input_tuple;
+  typedef detail::type_list<typename std::decay<Args>::type...> inputs;
+  typedef typename detail::result_types<typename std::decay<R>::type>::type
+      outputs;
+
+  const char* name;
+  handler_type handler;
+  const char* in_names;
+  const char* out_names;
+};
+
+template <typename Class, typename R, typename... Args>
+struct static_method<R (Class::*)(Args...) const> {
+  typedef R (Class::*handler_type)(Args...) const;
+  typedef R result_type;
+  typedef std::tuple<typename std::decay<Args>::type...> input_tuple;
+  typedef detail::type_list<typename std::decay<Args>::type...> inputs;
+  typedef typename detail::result_types<typename std::decay<R>::type>::type
+      outputs;
+
+  const char* name;
+  handler_type handler;
+  const char* in_names;
+  const char* out_names;
+};
+
+template <typename... Args>
+struct static_signal {
+  typedef std::tuple<Args...> args_tuple;
+  typedef detail::type_list<Args...> args;
+
+  const char* name;
+  const char* arg_names;
+};
+
+template <typename T>
+struct static_property {
+  typedef T value_type;
+
+  const char* name;
+  PropertyAccess access;
+};
+
+template <typename Handler>
+constexpr static_method<Handler> method(const char* name, Handler handler,
+                                        const char* in_names = "",
+                                        const char* out_names = "") {
+  return {name, handler, in_names, out_names};
+}
+
+template <typename... Args>
+constexpr static_signal<Args...> signal(const char* name,
+                                        const char* arg_names = "") {
+  return {name, arg_names};
+}
+
+template <typename T>
+constexpr static_property<T> property(
+    const char* name, PropertyAccess access = PropertyAccess::READ) {
+  return {name, access};
+}
+
+namespace detail {
+
+template <typename Out, typename Handler>
+constexpr void append_member(Out& out, const static_method<Handler>& m) {
+  append(out, "<method name=\"");
+  append(out, m.name);
+  append(out, "\">");
+  append_args(out, typename static_method<Handler>::inputs(), m.in_names,
+              "arg_", "in");
+  append_args(out, typename static_method<Handler>::outputs(), m.out_names,
+              "out_", "out");
+  append(out, "</method>");
+}
+
+template <typename Out, typename... Args>
+constexpr void append_member(Out& out, const static_signal<Args...>& s) {
+  append(out, "<signal name=\"");
+  append(out, s.name);
+  append(out, "\">");
+  append_args(out, type_list<Args...>(), s.arg_names, "arg_", nullptr);
+  append(out, "</signal>");
+}
+
+template <typename Out, typename T>
+constexpr void append_member(Out& out, const static_property<T>& p) {
+  append(out, "<property name=\"");
+  append(out, p.name);
+  append(out, "\" type=\"");
+  append(out, &element_signature<T>::code[0]);
+  append(out, "\" access=\"");
+  append(out, p.access == PropertyAccess::READ
+                  ? "read"
+                  : p.access == PropertyAccess::WRITE ? "write" : "readwrite");
+  append(out, "\"/>");
+}
+
+template <typename Out, typename Tuple, std::size_t... Is>
+constexpr void append_members(Out& out, const Tuple& members,
+                              std::index_sequence<Is...>) {
+  int expand[] = {0, (append_member(out, std::get<Is>(members)), 0)...};
+  (void)expand;
+}
+
+template <typename Out, typename... Members>
+constexpr void append_members(Out& out, const std::tuple<Members...>& members) {
+  append_members(out, members, std::index_sequence_for<Members...>{});
+}
+
+template <typename Description, typename Out>
+constexpr void append_interface(Out& out) {
+  append(out, "<interface name=\"");
+  append(out, Description::name());
+  append(out, "\">");
+  append_members(out, Description::methods());
+  append_members(out, Description::signals());
+  append_members(out, Description::properties());
+  append(out, "</interface>");
+}
+
+template <typename Description>
+constexpr std::size_t introspection_size() {
+  ct_counter counter;
+  append_interface<Description>(counter);
+  return counter.size;
+}
+
+// The interface's introspection XML, built entirely at compile time
+template <typename Description>
+constexpr ct_buffer<introspection_size<Description>()> introspection_xml() {
+  ct_buffer<introspection_size<Description>()> xml;
+  append_interface<Description>(xml);
+  return xml;
+}
+
+}  // namespace detail
+
+/// Base for interfaces declared as C++ types.
+/**
+ * Derive from StaticDbusInterface<Derived> and declare the interface with
+ * static constexpr functions returning tuples of descriptions:
+ *
+ * @code
+ * struct Calculator : dbus::StaticDbusInterface<Calculator> {
+ *   Calculator(std::shared_ptr<dbus::connection>& c)
+ *       : StaticDbusInterface(c) {}
+ *
+ *   static constexpr const char* name() { return "com.example.Calculator"; }
+ *   static constexpr auto methods() {
+ *     return std::make_tuple(
+ *         dbus::method("Add", &Calculator::add, "a,b", "sum"));
+ *   }
+ *   static constexpr auto properties() {
+ *     return std::make_tuple(dbus::property<uint32_t>("Count"));
+ *   }
+ *
+ *   int32_t add(int32_t a, int32_t b) { return a + b; }
+ * };
+ * @endcode
+ *
+ * Signatures and introspection XML are generated at compile time from
+ * element_signature, and method calls are resolved through a static table of
+ * non-virtual invokers, so constructing an object builds no per-method
+ * metadata.  Signals and properties are addressed by their index in the
+ * declaration, through emit<I>() and set<I>().  Every declared property
+ * holds a value-initialized one until it is set or initialized.
+ */
+template <typename Derived>
+class StaticDbusInterface : public DbusInterface {
+ public:
+  explicit StaticDbusInterface(std::shared_ptr<dbus::connection>& conn)
+      : DbusInterface(Derived::name(), conn) {
+    initialize_all(std::make_index_sequence<
+                   std::tuple_size<decltype(Derived::properties())>::value>{});
+  }
+
+  // Defaults for interfaces without one kind of member
+  static constexpr std::tuple<> methods() { return std::tuple<>(); }
+  static constexpr std::tuple<> signals() { return std::tuple<>(); }
+  static constexpr std::tuple<> properties() { return std::tuple<>(); }
+
+  bool call(dbus::message& m) override {
+    boost::string_view member = m.get_member_view();
+    for (const method_entry* e = method_table(); e->invoke != nullptr; e++) {
+      if (member.size() == e->size &&
+          std::memcmp(member.data(), e->name, e->size) == 0) {
+        e->invoke(static_cast<Derived&>(*this), m);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void append_introspection(std::string& xml) override {
+    static constexpr auto fragment = detail::introspection_xml<Derived>();
+    xml.append(fragment.data, fragment.size);
+  }
+
+  /// Emit the I'th declared signal to the interface's subscribers.
+  template <std::size_t I, typename... Args>
+  void emit(const Args&... args) {
+    auto m = new_signal<I>(args...);
+    send_signal(m);
+  }
+
+  /// Emit the I'th declared signal to one peer only.
+  template <std::size_t I, typename... Args>
+  void emit_to(const std::string& destination, const Args&... args) {
+    auto m = new_signal<I>(args...);
+    send_signal_to(*conn, destination, m);
+  }
+
+  /// Set the I'th declared property, sending PropertiesChanged.
+  // D only delays looking into Derived until it is complete
+  template <std::size_t I, typename D = Derived>
+  void set(const typename std::tuple_element<
+               I, decltype(D::properties())>::type::value_type& value,
+           UpdateType update_mode = UpdateType::VALUE_CHANGE_ONLY) {
+    constexpr auto p = std::get<I>(D::properties());
+    set_property(p.name, value, update_mode);
+  }
+
+  /// Give the I'th declared property its initial value, without signalling.
+  template <std::size_t I, typename D = Derived>
+  void initialize(const typename std::tuple_element<
+                  I, decltype(D::properties())>::type::value_type& value) {
+    constexpr auto p = std::get<I>(D::properties());
+    properties_map[p.name] = value;
+  }
+
+  /// Apply a peer's Properties.Set to a declared, writable property.
+  /**
+   * Answers UnknownProperty for undeclared properties, PropertyReadOnly for
+   * read only ones and InvalidArgs for a value of the wrong type, so the
+   * typed accessors can rely on the value they find.
+   */
+  void set_property_from_peer(const std::string& property_name,
+                              const dbus_variant& value) override {
+    settable result = settable::unknown;
+    check_settable(property_name, value, result,
+                   std::make_index_sequence<std::tuple_size<
+                       decltype(Derived::properties())>::value>{});
+    switch (result) {
+      case settable::unknown:
+        throw method_error(DBUS_ERROR_UNKNOWN_PROPERTY, "No such property");
+      case settable::read_only:
+        throw method_error(DBUS_ERROR_PROPERTY_READ_ONLY,
+                           "Property is read only");
+      case settable::wrong_type:
+        throw method_error(DBUS_ERROR_INVALID_ARGS,
+                           "Property value has the wrong type");
+      case settable::yes:
+        break;
+    }
+    DbusInterface::set_property_from_peer(property_name, value);
+  }
+
+  /// The I'th declared property's current value.
+  template <std::size_t I, typename D = Derived>
+  const typename std::tuple_element<I, decltype(D::properties())>::type::
+      value_type&
+      get() const {
+    constexpr auto p = std::get<I>(D::properties());
+    typedef typename std::remove_const<decltype(p)>::type::value_type T;
+    return boost::get<T>(properties_map.find(p.name)->second);
+  }
+
+ private:
+  enum class settable { unknown, read_only, wrong_type, yes };
+
+  // So that get<I>() always finds a value of its type
+  template <std::size_t... Is>
+  void initialize_all(std::index_sequence<Is...>) {
+    int expand[] = {
+        0, (initialize_default(std::get<Is>(Derived::properties())), 0)...};
+    (void)expand;
+  }
+
+  template <typename T>
+  void initialize_default(const static_property<T>& p) {
+    properties_map[p.name] = T();
+  }
+
+  // Whether a peer may give the named property this value
+  template <std::size_t... Is>
+  static void check_settable(const std::string& property_name,
+                             const dbus_variant& value, settable& result,
+                             std::index_sequence<Is...>) {
+    int expand[] = {0, (check_settable(std::get<Is>(Derived::properties()),
+                                       property_name, value, result),
+                        0)...};
+    (void)expand;
+  }
+
+  template <typename T>
+  static void check_settable(const static_property<T>& p,
+                             const std::string& property_name,
+                             const dbus_variant& value, settable& result) {
+    if (property_name != p.name) {
+      return;
+    }
+    if (p.access == PropertyAccess::READ) {
+      result = settable::read_only;
+    } else if (boost::get<T>(&value) == nullptr) {
+      result = settable::wrong_type;
+    } else {
+      result = settable::yes;
+    }
+  }
+
+  template <std::size_t I, typename... Args>
+  message new_signal(const Args&... args) {
+    constexpr auto s = std::get<I>(Derived::signals());
+    typedef typename std::remove_const<decltype(s)>::type::args_tuple
+        args_tuple;
+    static_assert(sizeof...(Args) == std::tuple_size<args_tuple>::value,
+                  "wrong number of signal arguments");
+    args_tuple t(args...);
+
+    dbus::endpoint endpoint("", object_name, interface_name);
+    auto m = dbus::message::new_signal(endpoint, s.name);
+    pack_tuple_into_msg(t, m);
+    return m;
+  }
+
+  struct method_entry {
+    const char* name;
+    std::size_t size;
+    void (*invoke)(Derived&, dbus::message&);
+  };
+
+  template <std::size_t... Is>
+  static const method_entry* method_table(std::index_sequence<Is...>) {
+    // Terminated by an empty entry, which also keeps the array non-empty for
+    // interfaces without methods
+    static constexpr method_entry table[] = {
+        {std::get<Is>(Derived::methods()).name,
+         detail::ct_strlen(std::get<Is>(Derived::methods()).name),
+         &invoke<Is>}...,
+        {nullptr, 0, nullptr}};
+    return table;
+  }
+
+  static const method_entry* method_table() {
+    return method_table(std::make_index_sequence<
+                        std::tuple_size<decltype(Derived::methods())>::value>{});
+  }
+
+  template <std::size_t I>
+  static void invoke(Derived& self, dbus::message& m) {
+    constexpr auto method = std::get<I>(Derived::methods());
+    typedef typename std::remove_const<decltype(method)>::type method_type;
+    typename method_type::input_tuple input_args;
+    if (unpack_into_tuple(input_args, m) == false) {
+      detail::send_error(*self.conn, m, DBUS_ERROR_INVALID_ARGS, "");
+      return;
+    }
+    try {
+      auto handler = [&](auto&... args) -> decltype(auto) {
+        return (self.*method.handler)(args...);
+      };
+      reply(self, m, handler, input_args,
+            std::is_void<typename method_type::result_type>());
+    } catch (const method_error& e) {
+      detail::send_error(*self.conn, m, e.name, e.what());
+    } catch (...) {
+      detail::send_error(*self.conn, m, DBUS_ERROR_FAILED,
+                         "Handler threw exception while handling request.");
+    }
+  }
+
+  template <typename Handler, typename Tuple>
+  static void reply(Derived& self, dbus::message& m, Handler& handler,
+                    Tuple& input_args, std::true_type /* void result */) {
+    apply(handler, input_args);
+    auto ret = dbus::message::new_return(m);
+    self.conn->send(ret, std::chrono::seconds(0));
+  }
+
+  template <typename Handler, typename Tuple>
+  static void reply(Derived& self, dbus::message& m, Handler& handler,
+                    Tuple& input_args, std::false_type) {
+    decltype(auto) r = apply(handler, input_args);
+    auto ret = dbus::message::new_return(m);
+    if (pack_tuple_into_msg(r, ret) == false) {
+      detail::send_error(*self.conn, m, DBUS_ERROR_FAILED,
+                         "Handler had issue when packing response");
+      return;
+    }
+    self.conn->send(ret, std::chrono::seconds(0));
+  }
+};
+
+}  // namespace dbus
+
+#endif  // DBUS_STATIC_INTERFACE_HPP
@@ -0,0 +1,161 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_TRACE_HPP
+#define DBUS_TRACE_HPP
+
+#include <dbus/dbus.h>
+#include <dbus/element.hpp>
+#include <atomic>
+#include <chrono>
+
+#ifdef BOOST_DBUS_TRACING
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define BOOST_DBUS_HAVE_USDT
+#endif
+#endif
+#endif
+
+namespace dbus {
+
+/// Trace points along the send, receive and dispatch paths.
+/**
+ * Compiled in only when BOOST_DBUS_TRACING is defined (the CMake option of
+ * the same name does that); otherwise every trace point expands to
+ * nothing.  When compiled in, each point fires a USDT probe in the
+ * "boost_dbus" provider, if <sys/sdt.h> is available, and calls the hook
+ * set with set_hook(), if any.
+ *
+ * Probes take the arguments serial, reply_serial, value and a
+ * steady_clock timestamp in nanoseconds.  A method call can be followed
+ * from async_send through sent (which has its serial), to reply_received
+ * and reply_handler (whose reply_serial is that serial).  For example:
+ *
+ *   bpftrace -e 'usdt:./app:boost_dbus:reply_received { ... }'
+ */
+namespace trace {
+
+typedef std::chrono::steady_clock clock;
+
+enum class point {
+  /// connection::async_send was called; value identifies the message.
+  async_send,
+  /// libdbus took the message and gave it a serial; value as above.
+  sent,
+  /// A pending call completed; serial is the reply's.
+  reply_received,
+  /// The reply's handler is about to run.
+  reply_handler,
+  /// A dispatch turn started and ended; value counts the messages taken
+  /// off libdbus's incoming queue, at the end.
+  dispatch_begin,
+  dispatch_end,
+  /// A filter was offered a message; value is 1 if it matched.
+  filter_offer,
+  /// A matched message was queued, or handed to an async_dispatch
+  /// handler; value is the queue's length afterwards.
+  queue_push,
+  queue_pop,
+};
+
+inline const char* name(point p) {
+  switch (p) {
+    case point::async_send:
+      return "async_send";
+    case point::sent:
+      return "sent";
+    case point::reply_received:
+      return "reply_received";
+    case point::reply_handler:
+      return "reply_handler";
+    case point::dispatch_begin:
+      return "dispatch_begin";
+    case point::dispatch_end:
+      return "dispatch_end";
+    case point::filter_offer:
+      return "filter_offer";
+    case point::queue_push:
+      return "queue_push";
+    case point::queue_pop:
+      return "queue_pop";
+  }
+  return "unknown";
+}
+
+struct event {
+  point where;
+  uint32 serial;
+  uint32 reply_serial;
+  uint64 value;
+  clock::time_point time;
+};
+
+/// Called on whichever thread reached the trace point; keep it short.
+typedef void (*hook_function)(const event&);
+
+namespace detail {
+inline std::atomic<hook_function>& hook() {
+  static std::atomic<hook_function> h{nullptr};
+  return h;
+}
+}  // namespace detail
+
+/// Call h at every trace point, or stop calling anything if h is null.
+inline void set_hook(hook_function h) {
+  detail::hook().store(h, std::memory_order_release);
+}
+
+inline void emit(const event& e) {
+  hook_function h = detail::hook().load(std::memory_order_acquire);
+  if (h != nullptr) {
+    h(e);
+  }
+}
+
+inline uint32 serial_of(DBusMessage* m) {
+  return m == nullptr ? 0 : dbus_message_get_serial(m);
+}
+
+inline uint32 reply_serial_of(DBusMessage* m) {
+  return m == nullptr ? 0 : dbus_message_get_reply_serial(m);
+}
+
+inline uint64 nanoseconds(clock::time_point t) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             t.time_since_epoch())
+      .count();
+}
+
+}  // namespace trace
+}  // namespace dbus
+
+#ifdef BOOST_DBUS_HAVE_USDT
+#define BOOST_DBUS_TRACE_PROBE(where, e)                                      \
+  DTRACE_PROBE4(boost_dbus, where, (e).serial, (e).reply_serial, (e).value,   \
+                ::dbus::trace::nanoseconds((e).time))
+#else
+#define BOOST_DBUS_TRACE_PROBE(where, e) ((void)0)
+#endif
+
+#ifdef BOOST_DBUS_TRACING
+/// Fire trace point where for the DBusMessage* m (which may be null).
+#define BOOST_DBUS_TRACE(where, m, value)                                     \
+  do {                                                                        \
+    DBusMessage* dbus_trace_message_ = (m);                                   \
+    const ::dbus::trace::event dbus_trace_event_ = {                          \
+        ::dbus::trace::point::where,                                          \
+        ::dbus::trace::serial_of(dbus_trace_message_),                        \
+        ::dbus::trace::reply_serial_of(dbus_trace_message_),                  \
+        static_cast<::dbus::uint64>(value), ::dbus::trace::clock::now()};     \
+    BOOST_DBUS_TRACE_PROBE(where, dbus_trace_event_);                         \
+    ::dbus::trace::emit(dbus_trace_event_);                                   \
+  } while (0)
+#else
+#define BOOST_DBUS_TRACE(where, m, value) ((void)0)
+#endif
+
+#endif  // DBUS_TRACE_HPP
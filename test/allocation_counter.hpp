@@ -0,0 +1,117 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_TEST_ALLOCATION_COUNTER_HPP
+#define DBUS_TEST_ALLOCATION_COUNTER_HPP
+
+// Counts heap allocations by interposing the C library's allocator, so
+// libdbus's own mallocs are seen along with operator new (which calls
+// malloc).  It defines malloc and friends, so include it from exactly one
+// translation unit of an executable.
+//
+// Sanitizers bring allocators of their own; under them nothing is counted
+// and enabled is false.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#define DBUS_TEST_ALLOCATIONS_UNCOUNTED
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer) || \
+    __has_feature(memory_sanitizer)
+#define DBUS_TEST_ALLOCATIONS_UNCOUNTED
+#endif
+#endif
+
+namespace allocation_counter {
+
+#ifdef DBUS_TEST_ALLOCATIONS_UNCOUNTED
+constexpr bool enabled = false;
+#else
+constexpr bool enabled = true;
+#endif
+
+struct totals {
+  std::uint64_t allocations;
+  std::uint64_t bytes;
+};
+
+namespace detail {
+inline totals& counts() {
+  // Plain thread_local PODs: reaching them never allocates
+  static thread_local totals t = {0, 0};
+  return t;
+}
+
+inline void count(std::size_t n) {
+  totals& t = counts();
+  t.allocations++;
+  t.bytes += n;
+}
+}  // namespace detail
+
+/// Allocations made by the calling thread since it started.
+inline totals now() { return detail::counts(); }
+
+/// Counts what the calling thread allocates while it's in scope.
+/**
+ * Other threads' allocations aren't counted, so run whatever is being
+ * measured (the io_service included) on the thread that made the scope.
+ */
+class scope {
+ public:
+  scope() : start_(now()) {}
+
+  std::uint64_t allocations() const {
+    return now().allocations - start_.allocations;
+  }
+
+  std::uint64_t bytes() const { return now().bytes - start_.bytes; }
+
+ private:
+  totals start_;
+};
+
+}  // namespace allocation_counter
+
+#if defined(DBUS_TEST_ALLOCATIONS_UNCOUNTED)
+#elif defined(__GLIBC__)
+extern "C" {
+void* __libc_malloc(std::size_t);
+void* __libc_calloc(std::size_t, std::size_t);
+void* __libc_realloc(void*, std::size_t);
+
+void* malloc(std::size_t n) noexcept {
+  allocation_counter::detail::count(n);
+  return __libc_malloc(n);
+}
+
+void* calloc(std::size_t count, std::size_t n) noexcept {
+  allocation_counter::detail::count(count * n);
+  return __libc_calloc(count, n);
+}
+
+void* realloc(void* p, std::size_t n) noexcept {
+  allocation_counter::detail::count(n);
+  return __libc_realloc(p, n);
+}
+}
+#else
+// Elsewhere only operator new is counted
+void* operator new(std::size_t n) {
+  allocation_counter::detail::count(n);
+  if (void* p = std::malloc(n == 0 ? 1 : n)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+#endif
+
+#endif  // DBUS_TEST_ALLOCATION_COUNTER_HPP
@@ -0,0 +1,204 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include <dbus/connection.hpp>
+#include <dbus/filter.hpp>
+#include <dbus/match.hpp>
+#include <dbus/properties.hpp>
+#include <allocation_counter.hpp>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+#include <gtest/gtest.h>
+
+// Allocation budgets for steady-state hot paths.  Each test warms its path
+// up, then checks the average allocations per operation against a budget
+// of what it costs today, libdbus's allocations included.  A change that
+// adds an allocation to one of these paths fails here; one that removes
+// some should lower the budget to match.
+
+namespace {
+
+const int warm_up = 20;
+const int iterations = 200;
+
+typedef std::vector<std::pair<std::string, dbus::dbus_variant>> properties;
+
+/// Average allocations per call of op, after warming it up.
+template <typename Operation>
+double allocations_per(Operation op) {
+  for (int i = 0; i < warm_up; i++) {
+    op();
+  }
+  std::uint64_t total = 0;
+  for (int i = 0; i < iterations; i++) {
+    total += op();
+  }
+  return static_cast<double>(total) / iterations;
+}
+
+/// How many allocations f makes.
+template <typename F>
+std::uint64_t counted(F f) {
+  allocation_counter::scope scope;
+  f();
+  return scope.allocations();
+}
+
+}  // namespace
+
+TEST(Allocations, PackAndUnpack) {
+  if (!allocation_counter::enabled) {
+    SUCCEED() << "allocations aren't counted under sanitizers";
+    return;
+  }
+  const dbus::endpoint e("org.boost.test", "/org/boost/test",
+                         "org.boost.Test", "Method");
+  const std::string s("a short string");
+  const std::vector<std::string> as(10, s);
+  const properties a_sv = {{"Name", std::string("value")},
+                           {"Count", dbus::uint32(7)},
+                           {"Enabled", true},
+                           {"Ratio", 0.5}};
+
+  // Building the call is part of each pack; libdbus caches freed messages
+  EXPECT_LE(allocations_per([&]() {
+              return counted([&]() { dbus::message::new_call(e); });
+            }),
+            0);
+
+  auto pack = [&](auto value) {
+    return allocations_per([&]() {
+      return counted([&]() {
+        dbus::message m = dbus::message::new_call(e);
+        m.pack(value);
+      });
+    });
+  };
+  EXPECT_LE(pack(dbus::uint32(7)), 2);
+  EXPECT_LE(pack(s), 2);
+  EXPECT_LE(pack(as), 6);
+  EXPECT_LE(pack(a_sv), 21);
+
+  auto unpack = [&](auto value) {
+    dbus::message m = dbus::message::new_call(e);
+    m.pack(value);
+    return allocations_per([&]() {
+      return counted([&]() {
+        decltype(value) out;
+        m.unpack(out);
+      });
+    });
+  };
+  EXPECT_LE(unpack(dbus::uint32(7)), 0);
+  EXPECT_LE(unpack(s), 0);
+  EXPECT_LE(unpack(as), 5);
+  EXPECT_LE(unpack(a_sv), 3);
+}
+
+TEST(Allocations, AsyncSendRoundTrip) {
+  if (!allocation_counter::enabled) {
+    SUCCEED() << "allocations aren't counted under sanitizers";
+    return;
+  }
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  auto service = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  dbus::DbusObjectServer server(service);
+  server.add_object("/org/boost/test")
+      ->add_interface("org.boost.Echo")
+      ->register_method("Echo", [](uint32_t x) { return x; });
+
+  dbus::message call = dbus::message::new_call(
+      dbus::endpoint(service->get_unique_name(), "/org/boost/test",
+                     "org.boost.Echo", "Echo"));
+  call.pack(uint32_t(7));
+
+  // Both ends of the call, but not the daemon between them
+  double per_call = allocations_per([&]() {
+    return counted([&]() {
+      bool replied = false;
+      dbus::message m = dbus::message::new_copy(call);
+      bus->async_send(m, [&](boost::system::error_code ec, dbus::message) {
+        EXPECT_FALSE(ec);
+        replied = true;
+      });
+      while (!replied && io.run_one()) {
+      }
+    });
+  });
+  EXPECT_LE(per_call, 29);
+}
+
+TEST(Allocations, FilterDelivery) {
+  if (!allocation_counter::enabled) {
+    SUCCEED() << "allocations aren't counted under sanitizers";
+    return;
+  }
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  boost::asio::io_service peer_io;
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  auto peer = std::make_shared<dbus::connection>(peer_io, dbus::bus::session);
+  dbus::filter f(bus, [](dbus::message& m) {
+    return dbus_message_is_signal(m, "org.boost.Test", "Tick");
+  });
+
+  dbus::message tick = dbus::message::new_signal(
+      dbus::endpoint(peer->get_unique_name(), "/org/boost/test",
+                     "org.boost.Test"),
+      "Tick");
+  tick.set_destination(bus->get_unique_name());
+
+  // From the bus's socket becoming readable to the filter's handler
+  double per_signal = allocations_per([&]() {
+    dbus::message m = dbus::message::new_copy(tick);
+    peer->send(m, std::chrono::seconds(0));
+    peer->flush();
+    return counted([&]() {
+      bool delivered = false;
+      f.async_dispatch([&](boost::system::error_code ec, dbus::message) {
+        EXPECT_FALSE(ec);
+        delivered = true;
+      });
+      while (!delivered && io.run_one()) {
+      }
+    });
+  });
+  EXPECT_LE(per_signal, 3);
+}
+
+TEST(Allocations, SetPropertyWithSignal) {
+  if (!allocation_counter::enabled) {
+    SUCCEED() << "allocations aren't counted under sanitizers";
+    return;
+  }
+  boost::asio::io_service io;
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  dbus::DbusObjectServer server(bus);
+  auto iface = server.add_object("/org/boost/test")
+                   ->add_interface("org.boost.Test");
+  iface->set_property("Value", dbus::uint32(0));
+
+  // Every call changes the value, so every call sends PropertiesChanged
+  dbus::uint32 value = 0;
+  double per_set = allocations_per([&]() {
+    std::uint64_t n =
+        counted([&]() { iface->set_property("Value", ++value); });
+    bus->flush();
+    return n;
+  });
+  EXPECT_LE(per_set, 23);
+}
@@ -0,0 +1,257 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include <dbus/bridge.hpp>
+#include <dbus/connection.hpp>
+#include <dbus/filter.hpp>
+#include <dbus/mock_bus.hpp>
+#include <dbus/properties.hpp>
+#include <dbus/signal_subscription.hpp>
+#include <run_until.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+namespace {
+
+/// Call method on the bridge's org.boost.Relay, and wait for the reply.
+template <typename... Args>
+std::pair<boost::system::error_code, dbus::message> call(
+    boost::asio::io_service& io, std::shared_ptr<dbus::connection>& client,
+    const std::string& method, const Args&... args) {
+  dbus::message m = dbus::message::new_call(dbus::endpoint(
+      "org.boost.Relay", "/org/boost/test", "org.boost.Test", method));
+  m.pack(args...);
+  bool done = false;
+  std::pair<boost::system::error_code, dbus::message> result(
+      boost::system::error_code(), dbus::message(nullptr));
+  client->async_send(m, [&](boost::system::error_code ec, dbus::message r) {
+    result = std::make_pair(ec, r);
+    done = true;
+  });
+  run_until(io, done);
+  return result;
+}
+
+}  // namespace
+
+// Each test puts a service on one bus and reaches it from a client on
+// another, through a bridge between connections a and b
+
+TEST(Bridge, RelaysCallsAndReplies) {
+  dbus::mock_bus outside;
+  dbus::mock_bus inside;
+  boost::asio::io_service io;
+  auto client = std::make_shared<dbus::connection>(io, outside.address());
+  auto a = std::make_shared<dbus::connection>(io, outside.address());
+  auto b = std::make_shared<dbus::connection>(io, inside.address());
+  auto service = std::make_shared<dbus::connection>(io, inside.address());
+  dbus::DbusObjectServer server(service);
+  server.add_object("/org/boost/test")
+      ->add_interface("org.boost.Test")
+      ->register_method("Echo", [](uint32_t x) { return x; });
+  service->request_name("org.boost.Test");
+  a->request_name("org.boost.Relay");
+  dbus::bridge relay(a, b);
+  relay.forward(dbus::bridge::a_to_b,
+                "type='method_call',interface='org.boost.Test'",
+                "org.boost.Test");
+
+  for (uint32_t i = 0; i < 3; i++) {
+    auto reply = call(io, client, "Echo", i);
+    ASSERT_FALSE(reply.first);
+    uint32_t x = 100;
+    ASSERT_TRUE(reply.second.unpack(x));
+    EXPECT_EQ(x, i);
+    EXPECT_EQ(reply.second.get_sender(), a->get_unique_name());
+  }
+  EXPECT_EQ(relay.forwarded(dbus::bridge::a_to_b), 3);
+}
+
+TEST(Bridge, RelaysErrors) {
+  dbus::mock_bus outside;
+  dbus::mock_bus inside;
+  boost::asio::io_service io;
+  auto client = std::make_shared<dbus::connection>(io, outside.address());
+  auto a = std::make_shared<dbus::connection>(io, outside.address());
+  auto b = std::make_shared<dbus::connection>(io, inside.address());
+  auto service = std::make_shared<dbus::connection>(io, inside.address());
+  dbus::DbusObjectServer server(service);
+  server.add_object("/org/boost/test")
+      ->add_interface("org.boost.Test")
+      ->register_method("Echo", [](uint32_t x) { return x; });
+  service->request_name("org.boost.Test");
+  a->request_name("org.boost.Relay");
+  dbus::bridge relay(a, b);
+  relay.forward(dbus::bridge::a_to_b,
+                "type='method_call',interface='org.boost.Test'",
+                "org.boost.Test");
+
+  auto reply = call(io, client, "Missing", uint32_t(7));
+  EXPECT_TRUE(reply.first);
+  EXPECT_STREQ(dbus_message_get_error_name(reply.second),
+               DBUS_ERROR_UNKNOWN_METHOD);
+
+  // Calls the routes don't select are left to a's own object paths
+  dbus::message m = dbus::message::new_call(dbus::endpoint(
+      "org.boost.Relay", "/org/boost/test", "org.boost.Other", "Echo"));
+  bool done = false;
+  client->async_send(m, [&](boost::system::error_code ec, dbus::message r) {
+    EXPECT_TRUE(ec);
+    done = true;
+  });
+  run_until(io, done);
+  EXPECT_EQ(relay.forwarded(dbus::bridge::a_to_b), 1);
+}
+
+TEST(Bridge, RelaysSignals) {
+  dbus::mock_bus outside;
+  dbus::mock_bus inside;
+  boost::asio::io_service io;
+  auto client = std::make_shared<dbus::connection>(io, outside.address());
+  auto a = std::make_shared<dbus::connection>(io, outside.address());
+  auto b = std::make_shared<dbus::connection>(io, inside.address());
+  auto service = std::make_shared<dbus::connection>(io, inside.address());
+  dbus::bridge relay(a, b);
+  relay.forward(dbus::bridge::b_to_a,
+                "type='signal',interface='org.boost.Test',member='Changed'");
+
+  bool heard = false;
+  dbus::signal_subscription subscription(
+      client, "type='signal',interface='org.boost.Test',member='Changed'",
+      [](dbus::message& m) {
+        return dbus_message_is_signal(m, "org.boost.Test", "Changed");
+      },
+      [&](dbus::message& m) {
+        EXPECT_EQ(m.get_sender(), a->get_unique_name());
+        EXPECT_EQ(m.get_path(), "/org/boost/test");
+        std::string value;
+        EXPECT_TRUE(m.unpack(value));
+        EXPECT_EQ(value, "relayed");
+        heard = true;
+      });
+
+  dbus::message changed = dbus::message::new_signal(
+      dbus::endpoint("", "/org/boost/test", "org.boost.Test"), "Changed");
+  changed.pack(std::string("relayed"));
+  service->send(changed, std::chrono::seconds(0));
+  run_until(io, heard);
+  EXPECT_EQ(relay.forwarded(dbus::bridge::b_to_a), 1);
+}
+
+TEST(Bridge, RelayedMessagesDropTheirSender) {
+  // Nothing on the inside rewrites senders, as on a peer-to-peer link
+  dbus::mock_bus outside;
+  dbus::mock_bus inside;
+  inside.set_stamp_senders(false);
+  boost::asio::io_service io;
+  auto client = std::make_shared<dbus::connection>(io, outside.address());
+  auto a = std::make_shared<dbus::connection>(io, outside.address());
+  auto b = std::make_shared<dbus::connection>(io, inside.address());
+  auto service = std::make_shared<dbus::connection>(io, inside.address());
+  service->request_name("org.boost.Test");
+  a->request_name("org.boost.Relay");
+  dbus::bridge relay(a, b);
+  relay.forward(dbus::bridge::a_to_b,
+                "type='method_call',interface='org.boost.Test'",
+                "org.boost.Test");
+
+  // Records the sender the call arrived with.  Replies are routed by the
+  // sender, so there's no asking for one here.
+  dbus::filter who_sent(service, [](dbus::message& m) {
+    return dbus_message_is_method_call(m, "org.boost.Test", "WhoSent");
+  });
+  bool arrived = false;
+  std::string sender;
+  who_sent.async_dispatch([&](boost::system::error_code ec, dbus::message m) {
+    EXPECT_FALSE(ec);
+    sender = m.get_sender();
+    arrived = true;
+  });
+
+  dbus::message m = dbus::message::new_call(dbus::endpoint(
+      "org.boost.Relay", "/org/boost/test", "org.boost.Test", "WhoSent"));
+  dbus_message_set_no_reply(m, true);
+  client->send(m, std::chrono::seconds(0));
+  run_until(io, arrived);
+  // Nothing on the way set one, so the client's is gone and none is left
+  EXPECT_EQ(sender, "(null)");
+  EXPECT_EQ(relay.forwarded(dbus::bridge::a_to_b), 1);
+}
+
+TEST(Bridge, RoutesByWellKnownSender) {
+  dbus::mock_bus outside;
+  dbus::mock_bus inside;
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto client = std::make_shared<dbus::connection>(io, outside.address());
+  auto a = std::make_shared<dbus::connection>(io, outside.address());
+  auto b = std::make_shared<dbus::connection>(io, inside.address());
+  auto service = std::make_shared<dbus::connection>(io, inside.address());
+  auto impostor = std::make_shared<dbus::connection>(io, inside.address());
+  service->request_name("org.boost.Test");
+
+  // Counts the signals that reach b, before the bridge can claim them
+  std::size_t arrived = 0;
+  dbus::filter arrivals(b, [&](dbus::message& m) {
+    if (dbus_message_is_signal(m, "org.boost.Test", "Changed")) {
+      arrived++;
+    }
+    return false;
+  });
+  dbus::bridge relay(a, b);
+  relay.forward(dbus::bridge::b_to_a,
+                "type='signal',sender='org.boost.Test',"
+                "interface='org.boost.Test',member='Changed'");
+
+  // b's replies come in order, so once this one is back the bridge has
+  // learned who owns the name
+  bool resolved = false;
+  b->async_method_call(
+      [&](boost::system::error_code ec, std::string owner) {
+        EXPECT_FALSE(ec);
+        EXPECT_EQ(owner, service->get_unique_name());
+        resolved = true;
+      },
+      dbus::endpoint("org.freedesktop.DBus", "/org/freedesktop/DBus",
+                     "org.freedesktop.DBus", "GetNameOwner"),
+      std::string("org.boost.Test"));
+  run_until(io, resolved);
+
+  std::vector<std::string> heard;
+  dbus::signal_subscription subscription(
+      client, "type='signal',interface='org.boost.Test',member='Changed'",
+      [](dbus::message& m) {
+        return dbus_message_is_signal(m, "org.boost.Test", "Changed");
+      },
+      [&](dbus::message& m) {
+        std::string value;
+        EXPECT_TRUE(m.unpack(value));
+        heard.push_back(value);
+      });
+
+  // The impostor's signal is addressed to b, so the bus delivers it even
+  // though b's rule names another sender
+  for (auto& c : {impostor, service}) {
+    dbus::message changed = dbus::message::new_signal(
+        dbus::endpoint("", "/org/boost/test", "org.boost.Test"), "Changed");
+    changed.set_destination(b->get_unique_name());
+    changed.pack(c == service ? std::string("relayed")
+                              : std::string("impostor"));
+    c->send(changed, std::chrono::seconds(0));
+  }
+  bool done = false;
+  while (!done && io.run_one()) {
+    done = arrived == 2 && !heard.empty();
+  }
+  EXPECT_EQ(heard, std::vector<std::string>{"relayed"});
+  EXPECT_EQ(relay.forwarded(dbus::bridge::b_to_a), 1);
+}
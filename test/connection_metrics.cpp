@@ -0,0 +1,138 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include <dbus/connection.hpp>
+#include <dbus/properties.hpp>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+
+class ConnectionMetricsTest : public ::testing::Test {
+ protected:
+  ConnectionMetricsTest()
+      : bus(std::make_shared<dbus::connection>(io, dbus::bus::session)),
+        service(std::make_shared<dbus::connection>(io, dbus::bus::session)),
+        server(service),
+        echo(service->get_unique_name(), "/org/boost/test", "org.boost.Echo",
+             "Echo"),
+        metrics(service->get_unique_name(), "/org/boost/test",
+                "org.boost.dbus.Metrics", "GetMetrics") {
+    auto object = server.add_object("/org/boost/test");
+    object->add_interface("org.boost.Echo")
+        ->register_method("Echo", [](uint32_t x) { return x; });
+    object->enable_metrics();
+  }
+
+  boost::asio::io_service io;
+  std::shared_ptr<dbus::connection> bus;
+  std::shared_ptr<dbus::connection> service;
+  dbus::DbusObjectServer server;
+  dbus::endpoint echo;
+  dbus::endpoint metrics;
+};
+
+TEST_F(ConnectionMetricsTest, CountsCallsAndReplies) {
+  bus->count_message_bytes(true);
+  bus->async_method_call(
+      [&](boost::system::error_code ec, uint32_t x) {
+        EXPECT_FALSE(ec);
+        dbus::connection_metrics m = bus->metrics();
+        EXPECT_EQ(m.messages_out.method_calls, 1);
+        EXPECT_EQ(m.messages_in.method_returns, 1);
+        EXPECT_GT(m.bytes_out.method_calls, 0);
+        EXPECT_GT(m.bytes_in.method_returns, 0);
+        EXPECT_EQ(m.calls_in_flight, 0);
+        EXPECT_EQ(m.replies(), 1);
+        EXPECT_GT(m.latency_percentile(1.0).count(), 0);
+
+        dbus::connection_metrics s = service->metrics();
+        EXPECT_EQ(s.messages_in.method_calls, 1);
+        EXPECT_EQ(s.messages_out.method_returns, 1);
+        EXPECT_GE(s.dispatches, 1);
+        EXPECT_GE(s.dispatch_turns, 1);
+        // Bytes weren't asked for on this one
+        EXPECT_EQ(s.bytes_in.total(), 0);
+        io.stop();
+      },
+      echo, (uint32_t)7);
+  EXPECT_EQ(bus->metrics().calls_in_flight, 1);
+
+  io.run();
+}
+
+TEST_F(ConnectionMetricsTest, BlockingTimeoutsAreCounted) {
+  // Nothing runs the service while the caller blocks, so it never answers
+  auto m = dbus::message::new_call(echo);
+  m.pack((uint32_t)1);
+  EXPECT_THROW(bus->send(m, std::chrono::milliseconds(50)),
+               boost::system::system_error);
+
+  dbus::connection_metrics s = bus->metrics();
+  EXPECT_EQ(s.call_timeouts, 1);
+  EXPECT_EQ(s.calls_in_flight, 0);
+  EXPECT_EQ(s.replies(), 1);
+}
+
+TEST_F(ConnectionMetricsTest, ExportedOverDbus) {
+  bus->async_method_call(
+      [&](boost::system::error_code ec,
+          const std::vector<std::pair<std::string, dbus::uint64>>& values) {
+        EXPECT_FALSE(ec);
+        auto calls_in = std::find_if(
+            values.begin(), values.end(),
+            [](const std::pair<std::string, dbus::uint64>& v) {
+              return v.first == "messages_in.method_calls";
+            });
+        ASSERT_NE(calls_in, values.end());
+        // This call, at least
+        EXPECT_GE(calls_in->second, 1);
+        io.stop();
+      },
+      metrics);
+
+  io.run();
+}
+
+TEST_F(ConnectionMetricsTest, CountsFromEveryThread) {
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+
+  // More threads than there are shards, so some share one
+  dbus::endpoint origin("", "/org/boost/test", "org.boost.Echo");
+  std::vector<std::thread> senders;
+  for (int i = 0; i < 12; i++) {
+    senders.emplace_back([&]() {
+      for (int j = 0; j < 50; j++) {
+        auto m = dbus::message::new_signal(origin, "Tick");
+        m.set_destination(service->get_unique_name());
+        bus->send(m, std::chrono::seconds(0));
+      }
+    });
+  }
+  for (auto& s : senders) {
+    s.join();
+  }
+  EXPECT_EQ(bus->metrics().messages_out.signals, 600);
+
+  // Counted in on this thread and out on the io_service's
+  std::thread caller([&]() {
+    bus->async_method_call(
+        [&](boost::system::error_code ec, uint32_t x) {
+          EXPECT_FALSE(ec);
+          EXPECT_EQ(bus->metrics().calls_in_flight, 0);
+          io.stop();
+        },
+        echo, (uint32_t)7);
+  });
+  caller.join();
+  EXPECT_EQ(bus->metrics().calls_in_flight, 1);
+
+  io.run();
+  EXPECT_EQ(bus->metrics().messages_out.method_calls, 1);
+}
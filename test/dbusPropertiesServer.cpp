@@ -373,3 +373,428 @@ TEST(DbusPropertiesInterface, PropertiesInterface) {
 
   io.run();
 }
+
+TEST(DbusPropertiesInterface, TransactionBatchesInterfacesAdded) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  dbus::match ma(bus,
+                 "type='signal',interface='org.freedesktop.DBus."
+                 "ObjectManager',member='InterfacesAdded'");
+  dbus::filter f(bus, [](dbus::message& m) {
+    return m.get_member() == "InterfacesAdded";
+  });
+
+  dbus::DbusObjectServer foo(bus);
+  {
+    dbus::DbusObjectServer::transaction tx(foo);
+    for (auto& path : {"/org/freedesktop/test1", "/org/freedesktop/test2"}) {
+      auto object = tx.add_object(path);
+      auto iface = object->add_interface("org.freedesktop.My.Interface");
+      iface->set_property("foo", (uint32_t)26);
+    }
+  }
+
+  typedef std::vector<std::pair<std::string, dbus::dbus_variant>>
+      properties_dict;
+  int count = 0;
+  std::function<void(boost::system::error_code, dbus::message)> callback =
+      [&](boost::system::error_code ec, dbus::message s) {
+        dbus::object_path path;
+        std::vector<std::pair<std::string, properties_dict>> interfaces;
+        EXPECT_TRUE(s.unpack(path, interfaces));
+        EXPECT_EQ(path.value, count == 0 ? "/org/freedesktop/test1"
+                                         : "/org/freedesktop/test2");
+        ASSERT_EQ(interfaces.size(), 2);
+        EXPECT_EQ(interfaces[0].first, "org.freedesktop.DBus.Properties");
+        EXPECT_EQ(interfaces[1].first, "org.freedesktop.My.Interface");
+        ASSERT_EQ(interfaces[1].second.size(), 1);
+        EXPECT_EQ(interfaces[1].second[0].second,
+                  dbus::dbus_variant((uint32_t)26));
+        if (++count == 2) {
+          io.stop();
+        } else {
+          f.async_dispatch(callback);
+        }
+      };
+  f.async_dispatch(callback);
+
+  io.run();
+  EXPECT_EQ(count, 2);
+}
+
+TEST(DbusPropertiesInterface, GetManagedObjects) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+
+  dbus::DbusObjectServer foo(bus);
+  auto object = foo.add_object("/org/freedesktop/test1");
+  auto iface = object->add_interface("org.freedesktop.My.Interface");
+  iface->set_property("foo", (uint32_t)26);
+
+  typedef std::vector<std::pair<std::string, dbus::dbus_variant>>
+      properties_dict;
+  typedef std::vector<std::pair<std::string, properties_dict>>
+      interfaces_dict;
+
+  dbus::endpoint get_managed_objects(bus->get_unique_name(), "/",
+                                     "org.freedesktop.DBus.ObjectManager",
+                                     "GetManagedObjects");
+  bus->async_method_call(
+      [&](const boost::system::error_code ec,
+          std::vector<std::pair<dbus::object_path, interfaces_dict>> value) {
+        if (ec) {
+          FAIL() << ec;
+        } else {
+          ASSERT_EQ(value.size(), 1);
+          EXPECT_EQ(value[0].first.value, "/org/freedesktop/test1");
+          ASSERT_EQ(value[0].second.size(), 2);
+          EXPECT_EQ(value[0].second[1].first, "org.freedesktop.My.Interface");
+          ASSERT_EQ(value[0].second[1].second.size(), 1);
+          EXPECT_EQ(value[0].second[1].second[0].second,
+                    dbus::dbus_variant((uint32_t)26));
+        }
+        io.stop();
+      },
+      get_managed_objects);
+
+  io.run();
+}
+
+TEST(DbusPropertiesInterface, UnknownMethodReturnsError) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+
+  dbus::DbusObjectServer foo(bus);
+  auto object = foo.add_object("/org/freedesktop/test1");
+  auto iface = object->add_interface("org.freedesktop.My.Interface");
+  iface->register_method("Known", []() { return std::make_tuple<int>(42); });
+
+  dbus::endpoint unknown(bus->get_unique_name(), "/org/freedesktop/test1",
+                         "org.freedesktop.My.Interface", "Unknown");
+  dbus::message m = dbus::message::new_call(unknown);
+  bus->async_send(m, [&](const boost::system::error_code ec, dbus::message r) {
+    EXPECT_TRUE(ec);
+    EXPECT_EQ(r.get_type(), "error");
+    io.stop();
+  });
+
+  io.run();
+}
+
+TEST(DbusPropertiesInterface, ServersShareConnection) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+
+  dbus::DbusObjectServer first(bus);
+  first.add_object("/org/freedesktop/test1");
+  {
+    // Joining and leaving the shared fallback leaves the first server be
+    dbus::DbusObjectServer gone(bus);
+    gone.add_object("/org/freedesktop/test3");
+  }
+  dbus::DbusObjectServer second(bus);
+  second.add_object("/org/freedesktop/test2")
+      ->add_interface("org.freedesktop.My.Interface")
+      ->register_method("Known", []() { return std::make_tuple<int>(42); });
+  EXPECT_THROW(second.add_object("/org/freedesktop/test1"),
+               boost::system::system_error);
+
+  typedef std::vector<std::pair<std::string, dbus::dbus_variant>>
+      properties_dict;
+  typedef std::vector<std::pair<std::string, properties_dict>>
+      interfaces_dict;
+  int outstanding = 3;
+  auto done = [&]() {
+    if (--outstanding == 0) {
+      io.stop();
+    }
+  };
+
+  dbus::endpoint get_managed_objects(bus->get_unique_name(), "/",
+                                     "org.freedesktop.DBus.ObjectManager",
+                                     "GetManagedObjects");
+  bus->async_method_call(
+      [&](const boost::system::error_code ec,
+          std::vector<std::pair<dbus::object_path, interfaces_dict>> value) {
+        EXPECT_FALSE(ec);
+        ASSERT_EQ(value.size(), 2);
+        EXPECT_EQ(value[0].first.value, "/org/freedesktop/test1");
+        EXPECT_EQ(value[1].first.value, "/org/freedesktop/test2");
+        done();
+      },
+      get_managed_objects);
+
+  dbus::endpoint introspect(bus->get_unique_name(), "/org/freedesktop",
+                            "org.freedesktop.DBus.Introspectable",
+                            "Introspect");
+  bus->async_method_call(
+      [&](const boost::system::error_code ec, std::string xml) {
+        EXPECT_FALSE(ec);
+        EXPECT_EQ(xml, dbus_boilerplate +
+                           "<node><node name=\"test1\"></node><node "
+                           "name=\"test2\"></node></node>");
+        done();
+      },
+      introspect);
+
+  dbus::endpoint known(bus->get_unique_name(), "/org/freedesktop/test2",
+                       "org.freedesktop.My.Interface", "Known");
+  bus->async_method_call(
+      [&](const boost::system::error_code ec, int value) {
+        EXPECT_FALSE(ec);
+        EXPECT_EQ(value, 42);
+        done();
+      },
+      known);
+
+  io.run();
+  EXPECT_EQ(outstanding, 0);
+}
+
+TEST(DbusPropertiesInterface, SubscribedSignalsAreUnicast) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  auto client = std::make_shared<dbus::connection>(io, dbus::bus::session);
+
+  dbus::DbusObjectServer foo(bus);
+  auto object = foo.add_object("/org/freedesktop/test1");
+  auto iface = object->add_interface("org.freedesktop.My.Interface");
+  auto changed = iface->register_signal<uint32_t>("Changed", {"value"});
+  iface->set_unicast_signals();
+  object->enable_subscriptions();
+
+  dbus::match m(client,
+                "type='signal',path='/org/freedesktop/test1',"
+                "interface='org.freedesktop.My.Interface'");
+  dbus::filter f(client, [](dbus::message& m) {
+    return m.get_member() == "Changed";
+  });
+  f.async_dispatch([&](boost::system::error_code ec, dbus::message s) {
+    EXPECT_FALSE(ec);
+    EXPECT_EQ(s.get_destination(), client->get_unique_name());
+    uint32_t value = 0;
+    EXPECT_TRUE(s.unpack(value));
+    EXPECT_EQ(value, 7);
+    io.stop();
+  });
+
+  dbus::endpoint subscribe(bus->get_unique_name(), "/org/freedesktop/test1",
+                           "org.boost.dbus.Subscriptions", "Subscribe");
+  client->async_method_call(
+      [&](boost::system::error_code ec) {
+        EXPECT_FALSE(ec);
+        EXPECT_EQ(iface->get_subscribers().size(), 1);
+        changed->send(7);
+      },
+      subscribe, "org.freedesktop.My.Interface");
+
+  io.run();
+}
+
+TEST(DbusPropertiesInterface, SubscribersDoNotSilenceOthers) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  auto listener = std::make_shared<dbus::connection>(io, dbus::bus::session);
+
+  dbus::DbusObjectServer foo(bus);
+  auto object = foo.add_object("/org/freedesktop/test1");
+  auto iface = object->add_interface("org.freedesktop.My.Interface");
+  auto changed = iface->register_signal<uint32_t>("Changed", {"value"});
+  object->enable_subscriptions();
+
+  // Listens with a match rule only, never subscribing
+  dbus::match m(listener,
+                "type='signal',path='/org/freedesktop/test1',"
+                "interface='org.freedesktop.My.Interface'");
+  dbus::filter f(listener, [](dbus::message& m) {
+    return m.get_member() == "Changed";
+  });
+
+  boost::asio::deadline_timer poll(io);
+  std::function<void(boost::system::error_code)> wait_for_prune =
+      [&](boost::system::error_code) {
+        if (iface->get_subscribers().empty()) {
+          io.stop();
+          return;
+        }
+        poll.expires_from_now(boost::posix_time::milliseconds(1));
+        poll.async_wait(wait_for_prune);
+      };
+
+  auto subscriber = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  f.async_dispatch([&](boost::system::error_code ec, dbus::message s) {
+    EXPECT_FALSE(ec);
+    EXPECT_EQ(s.get_destination(), "(null)");
+    // A subscriber that leaves the bus is forgotten
+    subscriber.reset();
+    wait_for_prune(boost::system::error_code());
+  });
+
+  dbus::endpoint subscribe(bus->get_unique_name(), "/org/freedesktop/test1",
+                           "org.boost.dbus.Subscriptions", "Subscribe");
+  subscriber->async_method_call(
+      [&](boost::system::error_code ec) {
+        EXPECT_FALSE(ec);
+        EXPECT_EQ(iface->get_subscribers().size(), 1);
+        changed->send(7);
+      },
+      subscribe, "org.freedesktop.My.Interface");
+
+  io.run();
+  EXPECT_TRUE(iface->get_subscribers().empty());
+}
+
+TEST(DbusPropertiesInterface, HandlersReceiveCallerCredentials) {
+  boost::asio::io_service io;
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+
+  dbus::DbusObjectServer foo(bus);
+  auto object = foo.add_object("/org/freedesktop/test1");
+  auto iface = object->add_interface("org.freedesktop.My.Interface");
+  iface->register_method(
+      "WhoAmI", [](const dbus::peer_credentials& c, uint32_t x) {
+        EXPECT_TRUE(c.has_pid);
+        EXPECT_EQ(c.pid, (uint32_t)getpid());
+        return std::make_tuple(c.uid + x, c.unique_name);
+      });
+  // The credentials aren't part of the method's D-Bus signature
+  EXPECT_EQ(iface->get_methods().begin()->second->get_args().size(), 3);
+
+  auto cache = dbus::credentials_cache::get(bus);
+  EXPECT_EQ(cache, dbus::credentials_cache::get(bus));
+
+  dbus::endpoint who_am_i(bus->get_unique_name(), "/org/freedesktop/test1",
+                          "org.freedesktop.My.Interface", "WhoAmI");
+  int outstanding = 2;
+  auto check = [&](boost::system::error_code ec, uint32_t uid,
+                   std::string name) {
+    EXPECT_FALSE(ec);
+    EXPECT_EQ(uid, (uint32_t)getuid() + 1);
+    EXPECT_EQ(name, bus->get_unique_name());
+    if (--outstanding == 0) {
+      EXPECT_EQ(cache->size(), 1);
+      EXPECT_NE(cache->find(bus->get_unique_name()), nullptr);
+      io.stop();
+    }
+  };
+  bus->async_method_call(check, who_am_i, (uint32_t)1);
+  bus->async_method_call(check, who_am_i, (uint32_t)1);
+
+  io.run();
+}
+
+TEST(DbusPropertiesInterface, CredentialsCachedWithoutHoldingTheCache) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+
+  dbus::DbusObjectServer foo(bus);
+  auto object = foo.add_object("/org/freedesktop/test1");
+  auto iface = object->add_interface("org.freedesktop.My.Interface");
+  iface->register_method("Hello",
+                         [](const dbus::peer_credentials& c) { return c.pid; });
+
+  // Nothing outside the method holds the cache; the first call must still
+  // be answered, and its lookup kept for the second
+  dbus::endpoint hello(bus->get_unique_name(), "/org/freedesktop/test1",
+                       "org.freedesktop.My.Interface", "Hello");
+  bus->async_method_call(
+      [&](boost::system::error_code ec, uint32_t pid) {
+        EXPECT_FALSE(ec);
+        EXPECT_EQ(pid, (uint32_t)getpid());
+        auto cache = dbus::credentials_cache::get(bus);
+        EXPECT_NE(cache->find(bus->get_unique_name()), nullptr);
+        io.stop();
+      },
+      hello);
+
+  io.run();
+}
+
+TEST(DbusPropertiesInterface, CredentialsDroppedWhenPeerLeaves) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+
+  dbus::DbusObjectServer foo(bus);
+  auto object = foo.add_object("/org/freedesktop/test1");
+  auto iface = object->add_interface("org.freedesktop.My.Interface");
+  std::string caller;
+  iface->register_method("Hello", [&](const dbus::peer_credentials& c) {
+    caller = c.unique_name;
+    return 1;
+  });
+  auto cache = dbus::credentials_cache::get(bus);
+
+  boost::asio::deadline_timer poll(io);
+  std::function<void(boost::system::error_code)> wait_for_drop =
+      [&](boost::system::error_code) {
+        if (cache->size() == 0) {
+          io.stop();
+          return;
+        }
+        poll.expires_from_now(boost::posix_time::milliseconds(1));
+        poll.async_wait(wait_for_drop);
+      };
+
+  // A short lived peer: its credentials are cached by the call, then dropped
+  // when it disconnects
+  auto peer = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  dbus::endpoint hello(bus->get_unique_name(), "/org/freedesktop/test1",
+                       "org.freedesktop.My.Interface", "Hello");
+  peer->async_method_call(
+      [&](boost::system::error_code ec, int32_t) {
+        EXPECT_FALSE(ec);
+        EXPECT_EQ(caller, peer->get_unique_name());
+        EXPECT_NE(cache->find(caller), nullptr);
+        // Not from inside the peer's own handler
+        io.post([&]() {
+          peer.reset();
+          wait_for_drop(boost::system::error_code());
+        });
+      },
+      hello);
+
+  io.run();
+  EXPECT_FALSE(caller.empty());
+  EXPECT_EQ(cache->find(caller), nullptr);
+}
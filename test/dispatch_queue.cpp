@@ -0,0 +1,72 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include <dbus/connection.hpp>
+#include <dbus/properties.hpp>
+#include <dbus/signal_subscription.hpp>
+#include <chrono>
+#include <thread>
+#include <gtest/gtest.h>
+
+TEST(DispatchQueueTest, RepliesOvertakeSignalBacklog) {
+  const int backlog = 1000;
+  boost::asio::io_service io;
+  boost::asio::io_service peer_io;
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  auto peer = std::make_shared<dbus::connection>(peer_io, dbus::bus::session);
+  bus->set_dispatch_budget(1024, 1);
+
+  // The reply to Ping is queued behind a backlog of signals
+  bool pinged = false;
+  dbus::endpoint origin(peer->get_unique_name(), "/org/boost/test",
+                        "org.boost.Test");
+  dbus::DbusObjectServer server(peer);
+  server.add_object("/org/boost/test")
+      ->add_interface("org.boost.Test")
+      ->register_method("Ping", [&]() {
+        for (int i = 0; i < backlog; i++) {
+          auto tick = dbus::message::new_signal(origin, "Tick");
+          tick.set_destination(bus->get_unique_name());
+          peer->send(tick, std::chrono::seconds(0));
+        }
+        pinged = true;
+        return std::tuple<>();
+      });
+
+  int ticks = 0;
+  int ticks_before_reply = -1;
+  dbus::signal_subscription subscription(
+      bus, "type='signal',interface='org.boost.Test',member='Tick'",
+      [](dbus::message& m) {
+        return dbus_message_is_signal(m, "org.boost.Test", "Tick");
+      },
+      [&](dbus::message&) {
+        if (++ticks == backlog) io.stop();
+      });
+
+  dbus::endpoint ping(peer->get_unique_name(), "/org/boost/test",
+                      "org.boost.Test", "Ping");
+  bus->async_method_call(
+      [&](boost::system::error_code ec) {
+        EXPECT_FALSE(ec);
+        ticks_before_reply = ticks;
+      },
+      ping);
+
+  // Let the peer answer, then pull everything it sent into the incoming
+  // queue with a blocking call, so dispatch starts with the whole backlog
+  while (!pinged) {
+    peer_io.run_one();
+  }
+  peer->flush();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  bus->method_call(dbus::endpoint("org.freedesktop.DBus",
+                                  "/org/freedesktop/DBus",
+                                  "org.freedesktop.DBus", "GetId"));
+
+  io.run();
+  EXPECT_EQ(ticks, backlog);
+  EXPECT_EQ(ticks_before_reply, 0);
+}
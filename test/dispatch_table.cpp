@@ -0,0 +1,53 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include <dbus/detail/dispatch_table.hpp>
+#include <memory>
+#include <string>
+#include <boost/container/flat_map.hpp>
+#include <gtest/gtest.h>
+
+typedef boost::container::flat_map<std::string, std::shared_ptr<int>>
+    int_map;
+
+TEST(DispatchTableTest, FindsEveryKey) {
+  int_map entries;
+  for (int i = 0; i < 500; i++) {
+    entries.emplace("Method" + std::to_string(i), std::make_shared<int>(i));
+  }
+
+  dbus::detail::dispatch_table<int> table;
+  table.assign(entries);
+
+  for (auto& entry : entries) {
+    int* found = table.find(entry.first);
+    ASSERT_NE(found, nullptr) << entry.first;
+    EXPECT_EQ(*found, *entry.second);
+  }
+  EXPECT_EQ(table.find("Method500"), nullptr);
+  EXPECT_EQ(table.find(""), nullptr);
+}
+
+TEST(DispatchTableTest, SmallTablesArePerfect) {
+  int_map entries;
+  entries.emplace("Get", std::make_shared<int>(0));
+  entries.emplace("GetAll", std::make_shared<int>(1));
+  entries.emplace("Set", std::make_shared<int>(2));
+
+  dbus::detail::dispatch_table<int> table;
+  table.assign(entries);
+
+  EXPECT_TRUE(table.is_perfect());
+  EXPECT_EQ(*table.find("GetAll"), 1);
+  EXPECT_EQ(table.find("Ge"), nullptr);
+}
+
+TEST(DispatchTableTest, Empty) {
+  dbus::detail::dispatch_table<int> table;
+  EXPECT_EQ(table.find("Get"), nullptr);
+
+  table.assign(int_map());
+  EXPECT_EQ(table.find("Get"), nullptr);
+}
@@ -0,0 +1,87 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include <dbus/connection.hpp>
+#include <dbus/filter.hpp>
+#include <dbus/loop_monitor.hpp>
+#include <dbus/match.hpp>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+
+TEST(LoopMonitor, BlockingCallsOnIoThreadsAreReported) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  std::vector<dbus::loop_monitor::violation> violations;
+  dbus::loop_monitor& monitor = bus->enable_loop_monitor(
+      [&](const dbus::loop_monitor::violation& v) { violations.push_back(v); });
+  monitor.set_probe_interval(std::chrono::milliseconds(1));
+  monitor.set_lag_threshold(std::chrono::milliseconds(10));
+  boost::asio::steady_timer timer(io);
+
+  // Nothing has run the io_service on this thread yet
+  bus->request_name("org.boost.dbus.test.LoopMonitor");
+  EXPECT_TRUE(violations.empty());
+  EXPECT_EQ(bus->get_loop_monitor()->get_counters().blocking_calls, 1);
+
+  timer.expires_from_now(std::chrono::milliseconds(20));
+  timer.async_wait([&](boost::system::error_code ec) {
+    EXPECT_TRUE(bus->get_loop_monitor()->on_io_thread());
+    dbus::endpoint get_id("org.freedesktop.DBus", "/org/freedesktop/DBus",
+                          "org.freedesktop.DBus", "GetId");
+    bus->method_call(get_id);
+    io.stop();
+  });
+  io.run();
+
+  ASSERT_EQ(violations.size(), 1);
+  EXPECT_EQ(violations[0].what,
+            dbus::loop_monitor::violation::kind::blocking_call);
+  EXPECT_EQ(std::string(violations[0].operation), "send_with_reply_and_block");
+  EXPECT_EQ(violations[0].thread, std::this_thread::get_id());
+  EXPECT_FALSE(violations[0].stack.empty());
+
+  dbus::loop_monitor::counters c = bus->get_loop_monitor()->get_counters();
+  EXPECT_EQ(c.blocking_calls, 2);
+  EXPECT_EQ(c.blocking_calls_on_io_thread, 1);
+  EXPECT_GT(c.probes, 0);
+}
+
+TEST(LoopMonitor, LagIsReported) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  std::vector<dbus::loop_monitor::violation> violations;
+  dbus::loop_monitor& monitor = bus->enable_loop_monitor(
+      [&](const dbus::loop_monitor::violation& v) { violations.push_back(v); });
+  monitor.set_probe_interval(std::chrono::milliseconds(1));
+  monitor.set_lag_threshold(std::chrono::milliseconds(10));
+  boost::asio::steady_timer timer(io);
+
+  timer.expires_from_now(std::chrono::milliseconds(5));
+  timer.async_wait([&](boost::system::error_code ec) {
+    // Hold up everything else on the io_service
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    timer.expires_from_now(std::chrono::milliseconds(5));
+    timer.async_wait([&](boost::system::error_code ec) { io.stop(); });
+  });
+  io.run();
+
+  ASSERT_FALSE(violations.empty());
+  EXPECT_EQ(violations[0].what, dbus::loop_monitor::violation::kind::lag);
+  EXPECT_GE(violations[0].duration, std::chrono::milliseconds(20));
+  EXPECT_GE(bus->get_loop_monitor()->get_counters().late_probes, 1);
+}
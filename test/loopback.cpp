@@ -0,0 +1,235 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include <dbus/connection.hpp>
+#include <dbus/filter.hpp>
+#include <dbus/properties.hpp>
+#include <dbus/signal_subscription.hpp>
+#include <run_until.hpp>
+#include <memory>
+#include <string>
+#include <thread>
+#include <gtest/gtest.h>
+
+namespace {
+
+const char* service_name = "org.boost.dbus.test.Loopback";
+
+}  // namespace
+
+class LoopbackTest : public ::testing::Test {
+ protected:
+  LoopbackTest()
+      : bus(std::make_shared<dbus::connection>(io, dbus::bus::session)),
+        service(std::make_shared<dbus::connection>(io, dbus::bus::session)),
+        server(service) {
+    iface = server.add_object("/org/boost/test")
+                ->add_interface("org.boost.Test");
+    iface->register_method("Echo", [](uint32_t x) { return x; });
+    iface->set_property("Value", dbus::uint32(0));
+    dbus::DbusInterface* i = iface.get();
+    iface->register_method("Set", [i](uint32_t x) {
+      i->set_property("Value", x);
+      return x;
+    });
+    service->enable_loopback();
+  }
+
+  /// Call method on the service with args, and wait for the reply.
+  template <typename... Args>
+  std::pair<boost::system::error_code, dbus::message> call(
+      const std::string& path, const std::string& method,
+      const Args&... args) {
+    dbus::message m = dbus::message::new_call(dbus::endpoint(
+        service->get_unique_name(), path, "org.boost.Test", method));
+    m.pack(args...);
+    bool done = false;
+    std::pair<boost::system::error_code, dbus::message> result(
+        boost::system::error_code(), dbus::message(nullptr));
+    bus->async_send(m, [&](boost::system::error_code ec, dbus::message r) {
+      result = std::make_pair(ec, r);
+      done = true;
+    });
+    run_until(io, done);
+    return result;
+  }
+
+  boost::asio::io_service io;
+  std::shared_ptr<dbus::connection> bus;
+  std::shared_ptr<dbus::connection> service;
+  dbus::DbusObjectServer server;
+  std::shared_ptr<dbus::DbusInterface> iface;
+};
+
+TEST_F(LoopbackTest, CallsBypassTheBus) {
+  auto reply = call("/org/boost/test", "Echo", uint32_t(7));
+  ASSERT_FALSE(reply.first);
+  uint32_t x = 0;
+  ASSERT_TRUE(reply.second.unpack(x));
+  EXPECT_EQ(x, 7);
+  EXPECT_EQ(reply.second.get_type(), "method_return");
+
+  // Neither end sent or received anything for it
+  dbus::connection_metrics s = service->metrics();
+  EXPECT_EQ(s.messages_in.method_calls, 0);
+  EXPECT_EQ(s.messages_out.method_returns, 0);
+  dbus::connection_metrics b = bus->metrics();
+  EXPECT_EQ(b.messages_out.method_calls, 0);
+  EXPECT_EQ(b.messages_in.method_returns, 0);
+}
+
+TEST_F(LoopbackTest, CallsByRequestedName) {
+  service->request_name(service_name);
+  boost::asio::io_service service_io;
+  auto other = std::make_shared<dbus::connection>(service_io,
+                                                  dbus::bus::session);
+  dbus::DbusObjectServer other_server(other);
+  other_server.add_object("/org/boost/test")
+      ->add_interface("org.boost.Test")
+      ->register_method("Echo", [](uint32_t x) { return x + 1; });
+  other->request_name(std::string(service_name) + ".Other");
+  other->enable_loopback();
+
+  // The second service runs on its own thread, as it would in a real process
+  boost::asio::io_service::work work(service_io);
+  std::thread service_thread([&service_io]() { service_io.run(); });
+
+  for (auto& name :
+       {std::string(service_name), std::string(service_name) + ".Other"}) {
+    dbus::message m = dbus::message::new_call(
+        dbus::endpoint(name, "/org/boost/test", "org.boost.Test", "Echo"));
+    m.pack(uint32_t(7));
+    bool done = false;
+    uint32_t x = 0;
+    bus->async_send(m, [&](boost::system::error_code ec, dbus::message r) {
+      EXPECT_FALSE(ec);
+      r.unpack(x);
+      done = true;
+    });
+    run_until(io, done);
+    EXPECT_EQ(x, name == service_name ? 7 : 8);
+  }
+
+  service_io.stop();
+  service_thread.join();
+  EXPECT_EQ(bus->metrics().messages_out.method_calls, 0);
+}
+
+TEST_F(LoopbackTest, ErrorsAreRepliedAsTheBusWould) {
+  auto reply = call("/org/boost/test", "Echo", std::string("seven"));
+  EXPECT_TRUE(reply.first);
+  EXPECT_EQ(reply.second.get_type(), "error");
+  EXPECT_STREQ(dbus_message_get_error_name(reply.second),
+               DBUS_ERROR_INVALID_ARGS);
+
+  reply = call("/org/boost/test", "Missing", uint32_t(7));
+  EXPECT_TRUE(reply.first);
+  EXPECT_STREQ(dbus_message_get_error_name(reply.second),
+               DBUS_ERROR_UNKNOWN_METHOD);
+
+  reply = call("/nothing/here", "Echo", uint32_t(7));
+  EXPECT_TRUE(reply.first);
+  EXPECT_STREQ(dbus_message_get_error_name(reply.second),
+               DBUS_ERROR_UNKNOWN_METHOD);
+}
+
+TEST_F(LoopbackTest, SignalsStillReachOtherSubscribers) {
+  auto listener = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  bool changed = false;
+  dbus::signal_subscription subscription(
+      listener,
+      "type='signal',interface='org.freedesktop.DBus.Properties',"
+      "member='PropertiesChanged',sender='" +
+          service->get_unique_name() + "'",
+      [](dbus::message& m) {
+        return dbus_message_is_signal(m, "org.freedesktop.DBus.Properties",
+                                      "PropertiesChanged");
+      },
+      [&](dbus::message& m) {
+        EXPECT_EQ(m.get_path(), "/org/boost/test");
+        changed = true;
+      });
+
+  service->flush();
+  auto signals = service->metrics().messages_out.signals;
+  auto reply = call("/org/boost/test", "Set", uint32_t(3));
+  ASSERT_FALSE(reply.first);
+  run_until(io, changed);
+  EXPECT_TRUE(changed);
+  EXPECT_EQ(service->metrics().messages_out.signals, signals + 1);
+}
+
+TEST_F(LoopbackTest, CallsToOtherProcessesUseTheBus) {
+  dbus::endpoint get_id("org.freedesktop.DBus", "/org/freedesktop/DBus",
+                        "org.freedesktop.DBus", "GetId");
+  dbus::message m = dbus::message::new_call(get_id);
+  bool done = false;
+  bus->async_send(m, [&](boost::system::error_code ec, dbus::message r) {
+    EXPECT_FALSE(ec);
+    done = true;
+  });
+  run_until(io, done);
+  EXPECT_EQ(bus->metrics().messages_out.method_calls, 1);
+}
+
+TEST(Loopback, OnlyOwnedNamesAreServed) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  auto service = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  auto owner = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  dbus::DbusObjectServer server(service);
+  server.add_object("/org/boost/test")
+      ->add_interface("org.boost.Test")
+      ->register_method("Echo", [](uint32_t x) { return x; });
+  dbus::DbusObjectServer owner_server(owner);
+  owner_server.add_object("/org/boost/test")
+      ->add_interface("org.boost.Test")
+      ->register_method("Echo", [](uint32_t x) { return x + 1; });
+  service->enable_loopback();
+
+  const std::string name = std::string(service_name) + ".Contested";
+  auto echo = [&]() {
+    dbus::message m = dbus::message::new_call(
+        dbus::endpoint(name, "/org/boost/test", "org.boost.Test", "Echo"));
+    m.pack(uint32_t(7));
+    bool done = false;
+    uint32_t x = 0;
+    bus->async_send(m, [&](boost::system::error_code ec, dbus::message r) {
+      EXPECT_FALSE(ec);
+      r.unpack(x);
+      done = true;
+    });
+    run_until(io, done);
+    return x;
+  };
+
+  // Held elsewhere, so the request fails and calls go to the owner
+  owner->request_name(name);
+  service->request_name(name);
+  EXPECT_EQ(echo(), 8);
+
+  dbus::endpoint release("org.freedesktop.DBus", "/org/freedesktop/DBus",
+                         "org.freedesktop.DBus", "ReleaseName");
+  owner->method_call(release, name);
+  service->request_name(name);
+  EXPECT_EQ(echo(), 7);
+
+  // Once NameLost has been seen, the next owner gets the calls again
+  dbus::filter lost(service, [](dbus::message& m) {
+    return m.get_member() == "NameLost";
+  });
+  bool released = false;
+  lost.async_dispatch(
+      [&](boost::system::error_code ec, dbus::message) { released = true; });
+  service->method_call(release, name);
+  run_until(io, released);
+  owner->request_name(name);
+  EXPECT_EQ(echo(), 8);
+}
@@ -0,0 +1,129 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include <dbus/connection.hpp>
+#include <dbus/method_profiler.hpp>
+#include <dbus/properties.hpp>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <gtest/gtest.h>
+
+TEST(MethodProfilerTest, RecordsCallsErrorsAndTimes) {
+  boost::asio::io_service io;
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  auto service = std::make_shared<dbus::connection>(io, dbus::bus::session);
+
+  dbus::DbusObjectServer server(service);
+  auto add_items = [&](const std::string& path) {
+    auto iface = server.add_object(path)->add_interface("org.boost.Item");
+    iface->register_method("Get", [](uint32_t id) { return id; });
+    iface->register_method("Slow", [](uint32_t id) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+      return id;
+    });
+    iface->register_method("Fail", [](uint32_t id) -> uint32_t {
+      throw std::runtime_error("no such item");
+    });
+  };
+  add_items("/org/boost/test/items/1");
+  dbus::method_profiler& profiler = server.enable_profiling();
+  // Objects registered after profiling starts are profiled too
+  add_items("/org/boost/test/items/2");
+  profiler.add_path_pattern("/org/boost/test/items");
+
+  auto call = [&](const std::string& path, const std::string& member,
+                  std::function<void(boost::system::error_code)> next) {
+    dbus::endpoint e(service->get_unique_name(), path, "org.boost.Item",
+                     member);
+    bus->async_method_call(
+        [next](boost::system::error_code ec, uint32_t) { next(ec); }, e,
+        (uint32_t)1);
+  };
+
+  call("/org/boost/test/items/1", "Get", [&](boost::system::error_code ec) {
+    EXPECT_FALSE(ec);
+    call("/org/boost/test/items/2", "Get", [&](boost::system::error_code ec) {
+      EXPECT_FALSE(ec);
+      call("/org/boost/test/items/2", "Slow",
+           [&](boost::system::error_code ec) {
+             EXPECT_FALSE(ec);
+             call("/org/boost/test/items/1", "Fail",
+                  [&](boost::system::error_code ec) {
+                    EXPECT_TRUE(ec);
+                    io.stop();
+                  });
+           });
+    });
+  });
+  io.run();
+
+  dbus::method_profiler::profile p = profiler.snapshot();
+  ASSERT_EQ(p.methods.size(), 3);
+  // Busiest first
+  EXPECT_EQ(p.methods[0].member, "Slow");
+  EXPECT_GE(p.methods[0].handler_time.max, std::chrono::milliseconds(2));
+  for (auto& m : p.methods) {
+    EXPECT_EQ(m.path, "/org/boost/test/items/*");
+    EXPECT_EQ(m.interface, "org.boost.Item");
+    if (m.member == "Get") {
+      // Both objects share the pattern's row
+      EXPECT_EQ(m.calls, 2);
+      EXPECT_EQ(m.errors, 0);
+    } else if (m.member == "Fail") {
+      EXPECT_EQ(m.calls, 1);
+      EXPECT_EQ(m.errors, 1);
+    }
+    EXPECT_EQ(m.queue_delay.count, m.calls);
+  }
+  ASSERT_EQ(p.calls_by_sender.size(), 1);
+  EXPECT_EQ(p.calls_by_sender[bus->get_unique_name()], 4);
+
+  std::string report = profiler.report();
+  EXPECT_NE(report.find("/org/boost/test/items/* org.boost.Item.Slow"),
+            std::string::npos);
+  EXPECT_NE(report.find(bus->get_unique_name()), std::string::npos);
+}
+
+TEST(MethodProfilerTest, QueueDelayIsMeasuredPerCall) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  auto service = std::make_shared<dbus::connection>(io, dbus::bus::session);
+
+  dbus::DbusObjectServer server(service);
+  server.add_object("/org/boost/test")
+      ->add_interface("org.boost.Item")
+      ->register_method("Slow", [](uint32_t id) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        return id;
+      });
+  dbus::method_profiler& profiler = server.enable_profiling();
+
+  // Sent together, so the later calls wait for the earlier ones' handlers
+  dbus::endpoint slow(service->get_unique_name(), "/org/boost/test",
+                      "org.boost.Item", "Slow");
+  int outstanding = 3;
+  for (uint32_t i = 0; i < 3; i++) {
+    bus->async_method_call(
+        [&](boost::system::error_code ec, uint32_t) {
+          EXPECT_FALSE(ec);
+          if (--outstanding == 0) io.stop();
+        },
+        slow, i);
+  }
+  io.run();
+
+  dbus::method_profiler::profile p = profiler.snapshot();
+  ASSERT_EQ(p.methods.size(), 1);
+  const dbus::method_profiler::histogram& delay = p.methods[0].queue_delay;
+  EXPECT_EQ(delay.count, 3);
+  EXPECT_GE(delay.max, std::chrono::milliseconds(10));
+  EXPECT_LT(delay.percentile(0.3), delay.percentile(1.0));
+}
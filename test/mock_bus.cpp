@@ -0,0 +1,224 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include <dbus/connection.hpp>
+#include <dbus/mock_bus.hpp>
+#include <dbus/properties.hpp>
+#include <dbus/signal_subscription.hpp>
+#include <run_until.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+namespace {
+
+dbus::message bus_call(const std::string& member) {
+  return dbus::message::new_call(
+      dbus::endpoint("org.freedesktop.DBus", "/org/freedesktop/DBus",
+                     "org.freedesktop.DBus", member));
+}
+
+/// Send m from client and wait for the reply.
+std::pair<boost::system::error_code, dbus::message> call(
+    boost::asio::io_service& io, std::shared_ptr<dbus::connection>& client,
+    dbus::message& m) {
+  bool done = false;
+  std::pair<boost::system::error_code, dbus::message> result(
+      boost::system::error_code(), dbus::message(nullptr));
+  client->async_send(m, [&](boost::system::error_code ec, dbus::message r) {
+    result = std::make_pair(ec, r);
+    done = true;
+  });
+  run_until(io, done);
+  return result;
+}
+
+}  // namespace
+
+TEST(MatchRuleTest, ParsesAndMatches) {
+  dbus::detail::match_rule rule(
+      "type='signal',interface='org.boost.Test',member='Changed',"
+      "path_namespace='/org/boost',arg0='it'\\''s',arg1path='/a/'");
+  dbus::message m = dbus::message::new_signal(
+      dbus::endpoint("", "/org/boost/test", "org.boost.Test"), "Changed");
+  m.pack(std::string("it's"), dbus::object_path{"/a/b"});
+  EXPECT_TRUE(rule.matches(m));
+
+  dbus::message other = dbus::message::new_signal(
+      dbus::endpoint("", "/org/boosted", "org.boost.Test"), "Changed");
+  other.pack(std::string("it's"), dbus::object_path{"/a/b"});
+  EXPECT_FALSE(rule.matches(other));
+
+  EXPECT_EQ(dbus::detail::match_rule("member='x',type='signal'"),
+            dbus::detail::match_rule("type='signal',member='x'"));
+  EXPECT_THROW(dbus::detail::match_rule("colour='blue'"),
+               std::invalid_argument);
+  EXPECT_THROW(dbus::detail::match_rule("member='x"), std::invalid_argument);
+  EXPECT_THROW(dbus::detail::match_rule("type='nonsense'"),
+               std::invalid_argument);
+}
+
+TEST(MatchRuleTest, ResolvesWellKnownSenders) {
+  dbus::detail::match_rule rule("sender='org.boost.Test'");
+  dbus::message m = dbus::message::new_signal(
+      dbus::endpoint("", "/", "org.boost.Test"), "Changed");
+  dbus_message_set_sender(m, ":1.7");
+  EXPECT_FALSE(rule.matches(m));
+  EXPECT_TRUE(rule.matches(m, [](const std::string& name) {
+    return name == "org.boost.Test" ? ":1.7" : "";
+  }));
+}
+
+TEST(MockBus, RoutesCallsByName) {
+  dbus::mock_bus bus;
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto client = std::make_shared<dbus::connection>(io, bus.address());
+  auto service = std::make_shared<dbus::connection>(io, bus.address());
+  dbus::DbusObjectServer server(service);
+  server.add_object("/org/boost/test")
+      ->add_interface("org.boost.Test")
+      ->register_method("Echo", [](uint32_t x) { return x; });
+  service->request_name("org.boost.Test");
+
+  for (auto& name : {std::string("org.boost.Test"),
+                     service->get_unique_name()}) {
+    dbus::message m = dbus::message::new_call(
+        dbus::endpoint(name, "/org/boost/test", "org.boost.Test", "Echo"));
+    m.pack(uint32_t(7));
+    auto reply = call(io, client, m);
+    ASSERT_FALSE(reply.first);
+    uint32_t x = 0;
+    ASSERT_TRUE(reply.second.unpack(x));
+    EXPECT_EQ(x, 7);
+    EXPECT_EQ(reply.second.get_sender(), service->get_unique_name());
+  }
+
+  dbus::message m = dbus::message::new_call(
+      dbus::endpoint("org.boost.Nobody", "/", "org.boost.Test", "Echo"));
+  auto reply = call(io, client, m);
+  EXPECT_TRUE(reply.first);
+  EXPECT_STREQ(dbus_message_get_error_name(reply.second),
+               DBUS_ERROR_SERVICE_UNKNOWN);
+}
+
+TEST(MockBus, AnswersForNames) {
+  dbus::mock_bus bus;
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto client = std::make_shared<dbus::connection>(io, bus.address());
+  auto service = std::make_shared<dbus::connection>(io, bus.address());
+  service->request_name("org.boost.Test");
+
+  dbus::message m = bus_call("GetNameOwner");
+  m.pack(std::string("org.boost.Test"));
+  auto reply = call(io, client, m);
+  std::string owner;
+  ASSERT_TRUE(reply.second.unpack(owner));
+  EXPECT_EQ(owner, service->get_unique_name());
+
+  // A second owner can't take the name from the first
+  auto other = std::make_shared<dbus::connection>(io, bus.address());
+  dbus::message request = bus_call("RequestName");
+  request.pack(std::string("org.boost.Test"),
+               dbus::uint32(DBUS_NAME_FLAG_DO_NOT_QUEUE));
+  dbus::message result = other->send(request);
+  dbus::uint32 code = 0;
+  ASSERT_TRUE(result.unpack(code));
+  EXPECT_EQ(code, DBUS_REQUEST_NAME_REPLY_EXISTS);
+
+  m = bus_call("NameHasOwner");
+  m.pack(std::string("org.boost.Missing"));
+  reply = call(io, client, m);
+  bool has_owner = true;
+  ASSERT_TRUE(reply.second.unpack(has_owner));
+  EXPECT_FALSE(has_owner);
+
+  m = bus_call("GetNameOwner");
+  m.pack(std::string("org.boost.Missing"));
+  reply = call(io, client, m);
+  EXPECT_STREQ(dbus_message_get_error_name(reply.second),
+               DBUS_ERROR_NAME_HAS_NO_OWNER);
+}
+
+TEST(MockBus, DeliversSignalsToMatchingRules) {
+  dbus::mock_bus bus;
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto client = std::make_shared<dbus::connection>(io, bus.address());
+  auto service = std::make_shared<dbus::connection>(io, bus.address());
+  std::vector<std::string> heard;
+  dbus::signal_subscription subscription(
+      client, "type='signal',interface='org.boost.Test',member='Changed'",
+      [](dbus::message& m) {
+        return dbus_message_has_interface(m, "org.boost.Test");
+      },
+      [&](dbus::message& m) {
+        EXPECT_EQ(m.get_sender(), service->get_unique_name());
+        heard.push_back(m.get_member());
+      });
+
+  // The bus routes each connection's messages in order, so had the first
+  // signal been delivered it would arrive first
+  dbus::endpoint origin("", "/org/boost/test", "org.boost.Test");
+  dbus::message ignored = dbus::message::new_signal(origin, "Ignored");
+  service->send(ignored, std::chrono::seconds(0));
+  dbus::message changed = dbus::message::new_signal(origin, "Changed");
+  service->send(changed, std::chrono::seconds(0));
+
+  while (heard.empty() && io.run_one()) {
+  }
+  ASSERT_EQ(heard.size(), 1);
+  EXPECT_EQ(heard[0], "Changed");
+}
+
+TEST(MockBus, ReleasesNamesOnDisconnect) {
+  dbus::mock_bus bus;
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto client = std::make_shared<dbus::connection>(io, bus.address());
+  auto owner = std::make_shared<dbus::connection>(io, bus.address());
+  owner->request_name("org.boost.Owner");
+  std::string unique_name = owner->get_unique_name();
+  bool released = false;
+  dbus::signal_subscription subscription(
+      client,
+      "type='signal',sender='org.freedesktop.DBus',"
+      "member='NameOwnerChanged',arg0='org.boost.Owner'",
+      [](dbus::message& m) {
+        return dbus_message_is_signal(m, "org.freedesktop.DBus",
+                                      "NameOwnerChanged");
+      },
+      [&](dbus::message& m) {
+        std::string name, old_owner, new_owner;
+        ASSERT_TRUE(m.unpack(name, old_owner, new_owner));
+        EXPECT_EQ(name, "org.boost.Owner");
+        EXPECT_EQ(old_owner, unique_name);
+        EXPECT_EQ(new_owner, "");
+        released = true;
+      });
+
+  owner.reset();
+  run_until(io, released);
+  EXPECT_TRUE(released);
+}
@@ -0,0 +1,76 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include <dbus/connection.hpp>
+#include <dbus/name_watcher.hpp>
+#include <gtest/gtest.h>
+
+TEST(NameWatcherTest, WaitsForNameAndSeesItVanish) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  auto service = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  const std::string name = "org.boost.dbus.test.Watched";
+  const std::string service_name = service->get_unique_name();
+
+  dbus::name_watcher watcher(bus);
+  EXPECT_FALSE(watcher.has_owner(name));
+
+  watcher.on_vanished(name, [&](const std::string& vanished) {
+    EXPECT_EQ(vanished, name);
+    EXPECT_FALSE(watcher.has_owner(name));
+    io.stop();
+  });
+  watcher.async_wait_for_name(
+      name, [&](boost::system::error_code ec, const std::string& owner) {
+        EXPECT_FALSE(ec);
+        EXPECT_EQ(owner, service_name);
+        EXPECT_TRUE(watcher.has_owner(name));
+
+        dbus::endpoint e(name, "/org/boost/test", "org.boost.Test", "Ping");
+        EXPECT_EQ(watcher.resolve(e).get_process_name(), service_name);
+
+        dbus::endpoint release("org.freedesktop.DBus", "/org/freedesktop/DBus",
+                               "org.freedesktop.DBus", "ReleaseName");
+        service->async_method_call(
+            [](boost::system::error_code ec, uint32_t result) {
+              EXPECT_FALSE(ec);
+            },
+            release, name);
+      });
+
+  service->request_name(name);
+  io.run();
+}
+
+TEST(NameWatcherTest, AlreadyOwnedNameIsReportedImmediately) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+
+  dbus::name_watcher watcher(bus);
+  watcher.async_wait_for_name(
+      "org.freedesktop.DBus",
+      [&](boost::system::error_code ec, const std::string& owner) {
+        EXPECT_FALSE(ec);
+        EXPECT_EQ(owner, "org.freedesktop.DBus");
+        watcher.async_wait_for_name(
+            "org.freedesktop.DBus",
+            [&](boost::system::error_code ec, const std::string& owner) {
+              EXPECT_FALSE(ec);
+              io.stop();
+            });
+      });
+
+  io.run();
+}
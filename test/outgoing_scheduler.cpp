@@ -0,0 +1,239 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include <dbus/connection.hpp>
+#include <dbus/filter.hpp>
+#include <dbus/properties.hpp>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+
+typedef dbus::outgoing_scheduler::priority priority;
+
+// Records the members of the org.boost.Test messages that reach c
+static std::unique_ptr<dbus::filter> record_arrivals(
+    std::shared_ptr<dbus::connection>& c, std::vector<std::string>& arrivals) {
+  return std::unique_ptr<dbus::filter>(
+      new dbus::filter(c, [&arrivals](dbus::message& m) {
+        if (m.get_interface() == "org.boost.Test") {
+          arrivals.push_back(m.get_member());
+        }
+        return false;
+      }));
+}
+
+TEST(OutgoingScheduler, CallsOvertakeSignals) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  auto peer = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  dbus::DbusObjectServer server(peer);
+  server.add_object("/org/boost/test")
+      ->add_interface("org.boost.Test")
+      ->register_method("Ping", []() { return std::tuple<>(); });
+  std::vector<std::string> arrivals;
+  auto f = record_arrivals(peer, arrivals);
+
+  auto& scheduler = bus->enable_scheduler();
+  EXPECT_EQ(&scheduler, bus->get_scheduler());
+  scheduler.set_batch_size(4);
+
+  // Signals are addressed to the peer so it needn't add a match rule
+  dbus::endpoint origin(peer->get_unique_name(), "/org/boost/test",
+                        "org.boost.Test");
+  for (int i = 0; i < 10; i++) {
+    auto m = dbus::message::new_signal(origin, "Tick");
+    m.set_destination(peer->get_unique_name());
+    bus->send(m, std::chrono::seconds(0));
+  }
+  dbus::endpoint ping(peer->get_unique_name(), "/org/boost/test",
+                      "org.boost.Test", "Ping");
+  bus->async_method_call(
+      [&](boost::system::error_code ec) { EXPECT_FALSE(ec); }, ping);
+  EXPECT_EQ(scheduler.queued(), 11);
+  EXPECT_EQ(scheduler.stats(priority::signal).queued, 10);
+
+  boost::asio::steady_timer poll(io);
+  std::function<void(boost::system::error_code)> wait_for_all =
+      [&](boost::system::error_code) {
+        if (arrivals.size() >= 11) {
+          io.stop();
+          return;
+        }
+        poll.expires_from_now(std::chrono::milliseconds(1));
+        poll.async_wait(wait_for_all);
+      };
+  wait_for_all(boost::system::error_code());
+  io.run();
+
+  ASSERT_EQ(arrivals.size(), 11);
+  EXPECT_EQ(arrivals.front(), "Ping");
+  EXPECT_EQ(scheduler.queued(), 0);
+  auto signals = scheduler.stats(priority::signal);
+  EXPECT_EQ(signals.enqueued, 10);
+  EXPECT_EQ(signals.sent, 10);
+  EXPECT_EQ(signals.queued, 0);
+  EXPECT_GE(signals.max_delay, signals.mean_delay());
+  EXPECT_EQ(scheduler.stats(priority::method_call).sent, 1);
+}
+
+TEST(OutgoingScheduler, RateLimitedSignalsDontHoldUpOthers) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  auto peer = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  // Registering its object paths starts the peer dispatching
+  dbus::DbusObjectServer server(peer);
+  std::vector<std::string> arrivals;
+  auto f = record_arrivals(peer, arrivals);
+
+  auto& scheduler = bus->enable_scheduler();
+  scheduler.set_rate_limit("org.boost.Test", "Tick", 100);
+
+  dbus::endpoint origin(peer->get_unique_name(), "/org/boost/test",
+                        "org.boost.Test");
+  auto start = std::chrono::steady_clock::now();
+  for (auto member : {"Tick", "Tick", "Tick", "Tick", "Tick", "Tock"}) {
+    auto m = dbus::message::new_signal(origin, member);
+    m.set_destination(peer->get_unique_name());
+    bus->send(m, std::chrono::seconds(0));
+  }
+
+  boost::asio::steady_timer poll(io);
+  std::function<void(boost::system::error_code)> wait_for_all =
+      [&](boost::system::error_code) {
+        if (arrivals.size() >= 6) {
+          io.stop();
+          return;
+        }
+        poll.expires_from_now(std::chrono::milliseconds(1));
+        poll.async_wait(wait_for_all);
+      };
+  wait_for_all(boost::system::error_code());
+  io.run();
+
+  // Four ticks had to wait 10ms each for a token; the tock didn't
+  EXPECT_GE(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(40));
+  ASSERT_EQ(arrivals.size(), 6);
+  EXPECT_EQ(arrivals.front(), "Tock");
+  EXPECT_GE(scheduler.stats(priority::signal).max_delay,
+            std::chrono::milliseconds(40));
+}
+
+TEST(OutgoingScheduler, PriorityCanBeSetPerMessage) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  auto peer = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  // Registering its object paths starts the peer dispatching
+  dbus::DbusObjectServer server(peer);
+  std::vector<std::string> arrivals;
+  auto f = record_arrivals(peer, arrivals);
+
+  auto& scheduler = bus->enable_scheduler();
+  scheduler.set_priority("org.boost.Test", "Urgent", priority::reply);
+
+  dbus::endpoint origin(peer->get_unique_name(), "/org/boost/test",
+                        "org.boost.Test");
+  for (auto member : {"Tick", "Urgent", "Tock"}) {
+    auto m = dbus::message::new_signal(origin, member);
+    m.set_destination(peer->get_unique_name());
+    if (m.get_member() == "Tock") {
+      dbus::outgoing_scheduler::set_priority(m, priority::method_call);
+      EXPECT_EQ(scheduler.classify(m), priority::method_call);
+    }
+    bus->send(m, std::chrono::seconds(0));
+  }
+
+  boost::asio::steady_timer poll(io);
+  std::function<void(boost::system::error_code)> wait_for_all =
+      [&](boost::system::error_code) {
+        if (arrivals.size() >= 3) {
+          io.stop();
+          return;
+        }
+        poll.expires_from_now(std::chrono::milliseconds(1));
+        poll.async_wait(wait_for_all);
+      };
+  wait_for_all(boost::system::error_code());
+  io.run();
+
+  EXPECT_EQ(arrivals, (std::vector<std::string>{"Urgent", "Tock", "Tick"}));
+}
+
+TEST(OutgoingScheduler, SendersMayReuseMessagesAndThreads) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  auto peer = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  // Registering its object paths starts the peer dispatching
+  dbus::DbusObjectServer server(peer);
+  std::vector<std::string> arrivals;
+  auto f = record_arrivals(peer, arrivals);
+  auto& scheduler = bus->enable_scheduler();
+
+  // What was queued is what goes out, whatever the sender does with its
+  // message afterwards
+  dbus::endpoint origin(peer->get_unique_name(), "/org/boost/test",
+                        "org.boost.Test");
+  auto m = dbus::message::new_signal(origin, "Tick");
+  m.set_destination(peer->get_unique_name());
+  bus->send(m, std::chrono::seconds(0));
+  EXPECT_EQ(dbus_message_get_serial(m), 0);
+  m.set_destination("org.boost.dbus.test.Nobody");
+
+  // Other threads submit while the io_service releases
+  std::vector<std::thread> senders;
+  for (int i = 0; i < 2; i++) {
+    senders.emplace_back([&]() {
+      for (int j = 0; j < 50; j++) {
+        auto m = dbus::message::new_signal(origin, "Tock");
+        m.set_destination(peer->get_unique_name());
+        bus->send(m, std::chrono::seconds(0));
+      }
+    });
+  }
+
+  boost::asio::steady_timer poll(io);
+  std::function<void(boost::system::error_code)> wait_for_all =
+      [&](boost::system::error_code) {
+        if (arrivals.size() >= 101) {
+          io.stop();
+          return;
+        }
+        poll.expires_from_now(std::chrono::milliseconds(1));
+        poll.async_wait(wait_for_all);
+      };
+  wait_for_all(boost::system::error_code());
+  io.run();
+  for (auto& s : senders) {
+    s.join();
+  }
+
+  ASSERT_EQ(arrivals.size(), 101);
+  EXPECT_EQ(arrivals.front(), "Tick");
+  EXPECT_EQ(scheduler.stats(priority::signal).sent, 101);
+  EXPECT_EQ(scheduler.queued(), 0);
+}
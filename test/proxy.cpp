@@ -0,0 +1,186 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include <dbus/connection.hpp>
+#include <dbus/match.hpp>
+#include <dbus/properties.hpp>
+#include <calculator_proxy.hpp>
+#include <gtest/gtest.h>
+
+class ProxyTest : public ::testing::Test {
+ protected:
+  ProxyTest()
+      : bus(std::make_shared<dbus::connection>(io, dbus::bus::session)),
+        server(bus),
+        object(server.add_object("/com/example/calculator")),
+        iface(std::make_shared<dbus::DbusInterface>("com.example.Calculator",
+                                                    bus)),
+        calculator(bus, bus->get_unique_name(), "/com/example/calculator") {
+    object->register_interface(iface);
+    iface->register_method("Add", [](int32_t a, int32_t b) { return a + b; });
+    iface->register_method("Divide", [](int32_t a, int32_t b) {
+      return std::make_tuple(a / b, a % b);
+    });
+    iface->register_method("Reset", []() { return std::tuple<>(); });
+    iface->register_method("History", []() {
+      return std::vector<std::pair<std::string, int32_t>>{{"Add", 2}};
+    });
+    iface->set_property("Count", (uint32_t)7);
+    iface->set_property("Label", std::string("abacus"));
+  }
+
+  boost::asio::io_service io;
+  std::shared_ptr<dbus::connection> bus;
+  dbus::DbusObjectServer server;
+  std::shared_ptr<dbus::DbusObject> object;
+  std::shared_ptr<dbus::DbusInterface> iface;
+  com::example::CalculatorProxy calculator;
+};
+
+TEST_F(ProxyTest, TypedMethodCalls) {
+  int outstanding = 4;
+  auto done = [&]() {
+    if (--outstanding == 0) io.stop();
+  };
+
+  calculator.async_add(2, 3, [&](boost::system::error_code ec, int32_t sum) {
+    EXPECT_FALSE(ec);
+    EXPECT_EQ(sum, 5);
+    done();
+  });
+  calculator.async_divide(
+      7, 2, [&](boost::system::error_code ec, int32_t q, int32_t r) {
+        EXPECT_FALSE(ec);
+        EXPECT_EQ(q, 3);
+        EXPECT_EQ(r, 1);
+        done();
+      });
+  calculator.async_reset([&](boost::system::error_code ec) {
+    EXPECT_FALSE(ec);
+    done();
+  });
+  calculator.async_history(
+      [&](boost::system::error_code ec,
+          const std::vector<std::pair<std::string, int32_t>>& entries) {
+        EXPECT_FALSE(ec);
+        ASSERT_EQ(entries.size(), 1);
+        EXPECT_EQ(entries[0].first, "Add");
+        EXPECT_EQ(entries[0].second, 2);
+        done();
+      });
+
+  io.run();
+}
+
+TEST_F(ProxyTest, Properties) {
+  calculator.async_get_count([&](boost::system::error_code ec, uint32_t c) {
+    EXPECT_FALSE(ec);
+    EXPECT_EQ(c, 7);
+    calculator.async_set_label("slide rule", [&](boost::system::error_code ec) {
+      EXPECT_FALSE(ec);
+      calculator.async_get_label(
+          [&](boost::system::error_code ec, const std::string& label) {
+            EXPECT_FALSE(ec);
+            EXPECT_EQ(label, "slide rule");
+            io.stop();
+          });
+    });
+  });
+
+  io.run();
+}
+
+TEST_F(ProxyTest, TypedSignalSubscription) {
+  auto subscription = calculator.on_overflow([&](uint32_t count) {
+    EXPECT_EQ(count, 11);
+    io.stop();
+  });
+
+  // A signal with the wrong signature is dropped before the handler
+  dbus::endpoint origin("", "/com/example/calculator",
+                        "com.example.Calculator");
+  auto bad = dbus::message::new_signal(origin, "Overflow");
+  bad.pack(std::string("eleven"));
+  bus->send(bad, std::chrono::seconds(0));
+
+  auto good = dbus::message::new_signal(origin, "Overflow");
+  good.pack((uint32_t)11);
+  bus->send(good, std::chrono::seconds(0));
+
+  io.run();
+}
+
+TEST_F(ProxyTest, SignalsFromOtherSendersAreIgnored) {
+  bus->request_name("com.example.Calculator");
+  com::example::CalculatorProxy named(bus, "com.example.Calculator",
+                                      "/com/example/calculator");
+  auto other = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  // A broader rule lets the bus deliver signals the proxy's rule wouldn't
+  dbus::match broad(bus, "type='signal',interface='com.example.Calculator'");
+
+  std::vector<uint32_t> counts;
+  auto subscription = named.on_overflow([&](uint32_t count) {
+    counts.push_back(count);
+    io.stop();
+  });
+
+  // By the time a later call is answered, the owner has been looked up
+  named.async_reset([&](boost::system::error_code ec) {
+    EXPECT_FALSE(ec);
+    dbus::endpoint origin("", "/com/example/calculator",
+                          "com.example.Calculator");
+    auto spoofed = dbus::message::new_signal(origin, "Overflow");
+    spoofed.pack((uint32_t)1);
+    other->send(spoofed, std::chrono::seconds(0));
+    other->flush();
+
+    auto genuine = dbus::message::new_signal(origin, "Overflow");
+    genuine.pack((uint32_t)11);
+    bus->send(genuine, std::chrono::seconds(0));
+  });
+
+  io.run();
+  ASSERT_EQ(counts.size(), 1);
+  EXPECT_EQ(counts[0], 11);
+}
+
+// Subscribes with a member and signature that don't outlive the call
+class TransientProxy : public dbus::proxy {
+ public:
+  using dbus::proxy::proxy;
+
+  std::unique_ptr<dbus::signal_subscription> on_overflow(
+      std::function<void(uint32_t)> handler) {
+    std::string member("Overflow");
+    std::string signature("u");
+    auto s = subscribe<uint32_t>(member.c_str(), signature.c_str(),
+                                 std::move(handler));
+    member.assign(member.size(), 'x');
+    signature.assign(signature.size(), 'x');
+    return s;
+  }
+};
+
+TEST_F(ProxyTest, SubscriptionsKeepTheirOwnMemberAndSignature) {
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  TransientProxy transient(bus, bus->get_unique_name(),
+                           "/com/example/calculator", "com.example.Calculator");
+  auto subscription = transient.on_overflow([&](uint32_t count) {
+    EXPECT_EQ(count, 11);
+    io.stop();
+  });
+
+  dbus::endpoint origin("", "/com/example/calculator",
+                        "com.example.Calculator");
+  auto overflow = dbus::message::new_signal(origin, "Overflow");
+  overflow.pack((uint32_t)11);
+  bus->send(overflow, std::chrono::seconds(0));
+
+  io.run();
+}
@@ -0,0 +1,225 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include <dbus/connection.hpp>
+#include <dbus/properties.hpp>
+#include <dbus/reply_cache.hpp>
+#include <chrono>
+#include <gtest/gtest.h>
+
+static const std::string inventory_name("org.boost.dbus.test.Inventory");
+
+// Lookup and Uncached both count the calls that reach the service
+static void add_inventory(dbus::DbusObjectServer& server, int& calls) {
+  auto iface = server.add_object("/org/boost/test")
+                   ->add_interface("org.boost.Inventory");
+  iface->register_method("Lookup", [&calls](uint32_t id) {
+    calls++;
+    return "item" + std::to_string(id);
+  });
+  iface->register_method("Uncached", [&calls](uint32_t id) {
+    calls++;
+    return id;
+  });
+}
+
+TEST(ReplyCache, HitsAreAnsweredLocally) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  auto service = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  dbus::DbusObjectServer server(service);
+  int calls = 0;
+  add_inventory(server, calls);
+  service->request_name(inventory_name);
+
+  dbus::endpoint lookup(inventory_name, "/org/boost/test",
+                        "org.boost.Inventory", "Lookup");
+  dbus::endpoint uncached(inventory_name, "/org/boost/test",
+                          "org.boost.Inventory", "Uncached");
+  dbus::reply_cache cache(bus);
+  cache.set_ttl("org.boost.Inventory", "Lookup", std::chrono::minutes(1));
+
+  auto expect_item1 = [&](std::function<void()> next) {
+    return [&, next](boost::system::error_code ec, const std::string& item) {
+      EXPECT_FALSE(ec);
+      EXPECT_EQ(item, "item1");
+      next();
+    };
+  };
+
+  // Different arguments are a different entry, and methods without a TTL
+  // always go to the bus
+  std::function<void()> lookup_again = [&]() {
+    cache.async_method_call(
+        [&](boost::system::error_code ec, const std::string& item) {
+          EXPECT_FALSE(ec);
+          EXPECT_EQ(item, "item2");
+          EXPECT_EQ(calls, 2);
+          EXPECT_EQ(cache.size(), 2);
+          cache.async_method_call(
+              [&](boost::system::error_code ec, uint32_t id) {
+                cache.async_method_call(
+                    [&](boost::system::error_code ec, uint32_t id) {
+                      EXPECT_FALSE(ec);
+                      EXPECT_EQ(calls, 4);
+                      EXPECT_EQ(cache.size(), 2);
+                      io.stop();
+                    },
+                    uncached, (uint32_t)3);
+              },
+              uncached, (uint32_t)3);
+        },
+        lookup, (uint32_t)2);
+  };
+
+  cache.async_method_call(
+      expect_item1([&]() {
+        EXPECT_EQ(calls, 1);
+        EXPECT_EQ(cache.size(), 1);
+        cache.async_method_call(expect_item1([&]() {
+                                  EXPECT_EQ(calls, 1);
+                                  lookup_again();
+                                }),
+                                lookup, (uint32_t)1);
+      }),
+      lookup, (uint32_t)1);
+
+  io.run();
+}
+
+TEST(ReplyCache, ConcurrentMissesShareOneCall) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  auto service = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  dbus::DbusObjectServer server(service);
+  int calls = 0;
+  add_inventory(server, calls);
+  service->request_name(inventory_name);
+
+  dbus::endpoint lookup(inventory_name, "/org/boost/test",
+                        "org.boost.Inventory", "Lookup");
+  dbus::reply_cache cache(bus);
+  cache.set_ttl("org.boost.Inventory", "Lookup", std::chrono::minutes(1));
+
+  int outstanding = 3;
+  for (int i = 0; i < 3; i++) {
+    cache.async_method_call(
+        [&](boost::system::error_code ec, const std::string& item) {
+          EXPECT_FALSE(ec);
+          EXPECT_EQ(item, "item1");
+          EXPECT_EQ(calls, 1);
+          EXPECT_EQ(cache.size(), 1);
+          if (--outstanding == 0) io.stop();
+        },
+        lookup, (uint32_t)1);
+  }
+
+  io.run();
+}
+
+TEST(ReplyCache, EntriesExpireAndAreEvicted) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  auto service = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  dbus::DbusObjectServer server(service);
+  int calls = 0;
+  add_inventory(server, calls);
+  service->request_name(inventory_name);
+
+  dbus::endpoint lookup(inventory_name, "/org/boost/test",
+                        "org.boost.Inventory", "Lookup");
+  dbus::reply_cache cache(bus);
+  dbus::reply_cache::clock::time_point now;
+  cache.set_clock([&]() { return now; });
+  cache.set_max_entries(2);
+  cache.set_ttl("org.boost.Inventory", "Lookup", std::chrono::seconds(50));
+
+  auto ignore = [](boost::system::error_code ec, const std::string&) {
+    EXPECT_FALSE(ec);
+  };
+  cache.async_method_call(ignore, lookup, (uint32_t)1);
+  cache.async_method_call(ignore, lookup, (uint32_t)2);
+  cache.async_method_call(
+      [&](boost::system::error_code ec, const std::string&) {
+        // The least recently used reply made way for the third
+        EXPECT_EQ(cache.size(), 2);
+        EXPECT_EQ(calls, 3);
+        now += std::chrono::seconds(50);
+        cache.async_method_call(
+            [&](boost::system::error_code ec, const std::string& item) {
+              EXPECT_FALSE(ec);
+              EXPECT_EQ(item, "item3");
+              EXPECT_EQ(calls, 4);
+              io.stop();
+            },
+            lookup, (uint32_t)3);
+      },
+      lookup, (uint32_t)3);
+
+  io.run();
+}
+
+TEST(ReplyCache, OwnerChangeInvalidates) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  auto service = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  dbus::DbusObjectServer server(service);
+  int calls = 0;
+  add_inventory(server, calls);
+  service->request_name(inventory_name);
+
+  dbus::endpoint lookup(inventory_name, "/org/boost/test",
+                        "org.boost.Inventory", "Lookup");
+  dbus::reply_cache cache(bus);
+  cache.set_ttl("org.boost.Inventory", "Lookup", std::chrono::minutes(1));
+
+  boost::asio::steady_timer poll(io);
+  std::function<void(boost::system::error_code)> wait_for_empty =
+      [&](boost::system::error_code) {
+        if (cache.size() == 0) {
+          io.stop();
+          return;
+        }
+        poll.expires_from_now(std::chrono::milliseconds(10));
+        poll.async_wait(wait_for_empty);
+      };
+
+  cache.async_method_call(
+      [&](boost::system::error_code ec, const std::string& item) {
+        EXPECT_FALSE(ec);
+        EXPECT_EQ(cache.size(), 1);
+        dbus::endpoint release("org.freedesktop.DBus", "/org/freedesktop/DBus",
+                               "org.freedesktop.DBus", "ReleaseName");
+        service->async_method_call(
+            [&](boost::system::error_code ec, uint32_t result) {
+              EXPECT_FALSE(ec);
+              wait_for_empty(ec);
+            },
+            release, inventory_name);
+      },
+      lookup, (uint32_t)1);
+
+  io.run();
+}
@@ -0,0 +1,18 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_TEST_RUN_UNTIL_HPP
+#define DBUS_TEST_RUN_UNTIL_HPP
+
+#include <boost/asio/io_service.hpp>
+
+// Runs io one handler at a time until done is set, or until io runs out of
+// work or is stopped, as a test's deadline timer does.
+inline void run_until(boost::asio::io_service& io, const bool& done) {
+  while (!done && io.run_one()) {
+  }
+}
+
+#endif  // DBUS_TEST_RUN_UNTIL_HPP
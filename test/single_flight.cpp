@@ -0,0 +1,77 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include <dbus/connection.hpp>
+#include <dbus/properties.hpp>
+#include <dbus/single_flight.hpp>
+#include <gtest/gtest.h>
+
+TEST(SingleFlightTest, IdenticalCallsShareOneReply) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+
+  int calls = 0;
+  dbus::DbusObjectServer server(bus);
+  auto iface = server.add_object("/org/boost/test")
+                   ->add_interface("org.boost.Inventory");
+  iface->register_method("Lookup", [&](uint32_t id) {
+    calls++;
+    return "item" + std::to_string(id);
+  });
+
+  dbus::endpoint lookup(bus->get_unique_name(), "/org/boost/test",
+                        "org.boost.Inventory", "Lookup");
+  dbus::endpoint missing(bus->get_unique_name(), "/org/boost/test",
+                         "org.boost.Inventory", "Missing");
+  dbus::single_flight flights(bus);
+
+  int outstanding = 8;
+  auto done = [&]() {
+    if (--outstanding > 0) return;
+    EXPECT_EQ(flights.in_flight(), 0);
+    EXPECT_EQ(calls, 2);
+    // The flight has landed, so the next call goes to the bus again
+    flights.async_method_call(
+        [&](boost::system::error_code ec, const std::string& item) {
+          EXPECT_FALSE(ec);
+          EXPECT_EQ(calls, 3);
+          io.stop();
+        },
+        lookup, (uint32_t)1);
+  };
+  for (int i = 0; i < 4; i++) {
+    flights.async_method_call(
+        [&](boost::system::error_code ec, const std::string& item) {
+          EXPECT_FALSE(ec);
+          EXPECT_EQ(item, "item1");
+          done();
+        },
+        lookup, (uint32_t)1);
+  }
+  flights.async_method_call(
+      [&](boost::system::error_code ec, const std::string& item) {
+        EXPECT_FALSE(ec);
+        EXPECT_EQ(item, "item2");
+        done();
+      },
+      lookup, (uint32_t)2);
+  // Errors are fanned out too
+  for (int i = 0; i < 3; i++) {
+    flights.async_method_call(
+        [&](boost::system::error_code ec) {
+          EXPECT_TRUE(ec);
+          done();
+        },
+        missing);
+  }
+  EXPECT_EQ(flights.in_flight(), 3);
+
+  io.run();
+}
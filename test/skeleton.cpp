@@ -0,0 +1,165 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include <dbus/connection.hpp>
+#include <dbus/properties.hpp>
+#include <calculator_proxy.hpp>
+#include <calculator_skeleton.hpp>
+#include <gtest/gtest.h>
+
+struct AbacusCalculator : com::example::CalculatorSkeleton {
+  using CalculatorSkeleton::CalculatorSkeleton;
+
+  int32_t handle_add(int32_t a, int32_t b) override {
+    set_count(get_count() + 1);
+    return a + b;
+  }
+
+  std::tuple<int32_t, int32_t> handle_divide(int32_t a, int32_t b) override {
+    return std::make_tuple(a / b, a % b);
+  }
+
+  void handle_reset() override { set_count(0); }
+
+  std::vector<std::pair<std::string, int32_t>> handle_history() override {
+    return {{"Add", (int32_t)get_count()}};
+  }
+
+  // Named like the accessors StaticDbusInterface provides
+  uint32_t handle_get() override { return memory; }
+
+  void handle_set(uint32_t value) override { memory = value; }
+
+  uint32_t memory = 0;
+};
+
+TEST(SkeletonTest, IntrospectionMatchesXml) {
+  constexpr auto xml =
+      dbus::detail::introspection_xml<com::example::CalculatorSkeleton>();
+  EXPECT_EQ(std::string(xml.data, xml.size),
+            "<interface name=\"com.example.Calculator\">"
+            "<method name=\"Add\">"
+            "<arg name=\"a\" type=\"i\" direction=\"in\"/>"
+            "<arg name=\"b\" type=\"i\" direction=\"in\"/>"
+            "<arg name=\"sum\" type=\"i\" direction=\"out\"/>"
+            "</method>"
+            "<method name=\"Divide\">"
+            "<arg name=\"a\" type=\"i\" direction=\"in\"/>"
+            "<arg name=\"b\" type=\"i\" direction=\"in\"/>"
+            "<arg name=\"quotient\" type=\"i\" direction=\"out\"/>"
+            "<arg name=\"remainder\" type=\"i\" direction=\"out\"/>"
+            "</method>"
+            "<method name=\"Reset\"></method>"
+            "<method name=\"History\">"
+            "<arg name=\"entries\" type=\"a{si}\" direction=\"out\"/>"
+            "</method>"
+            "<method name=\"Get\">"
+            "<arg name=\"value\" type=\"u\" direction=\"out\"/>"
+            "</method>"
+            "<method name=\"Set\">"
+            "<arg name=\"value\" type=\"u\" direction=\"in\"/>"
+            "</method>"
+            "<signal name=\"Overflow\"><arg name=\"count\" type=\"u\"/></signal>"
+            "<property name=\"Count\" type=\"u\" access=\"read\"/>"
+            "<property name=\"Label\" type=\"s\" access=\"readwrite\"/>"
+            "</interface>");
+}
+
+TEST(SkeletonTest, ServesGeneratedProxy) {
+  boost::asio::io_service io;
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+
+  dbus::DbusObjectServer server(bus);
+  auto object = server.add_object("/com/example/calculator");
+  auto calculator = std::make_shared<AbacusCalculator>(bus);
+  object->register_interface(calculator);
+  EXPECT_EQ(calculator->get_count(), 0);
+  EXPECT_EQ(calculator->get_label(), "");
+
+  com::example::CalculatorProxy proxy(bus, bus->get_unique_name(),
+                                      "/com/example/calculator");
+  proxy.async_add(2, 3, [&](boost::system::error_code ec, int32_t sum) {
+    EXPECT_FALSE(ec);
+    EXPECT_EQ(sum, 5);
+    EXPECT_EQ(calculator->get_count(), 1);
+    proxy.async_history(
+        [&](boost::system::error_code ec,
+            const std::vector<std::pair<std::string, int32_t>>& entries) {
+          EXPECT_FALSE(ec);
+          ASSERT_EQ(entries.size(), 1);
+          EXPECT_EQ(entries[0].second, 1);
+          proxy.async_get_count([&](boost::system::error_code ec, uint32_t c) {
+            EXPECT_FALSE(ec);
+            EXPECT_EQ(c, 1);
+            proxy.async_set(42, [&](boost::system::error_code ec) {
+              EXPECT_FALSE(ec);
+              proxy.async_get([&](boost::system::error_code ec, uint32_t v) {
+                EXPECT_FALSE(ec);
+                EXPECT_EQ(v, 42);
+                EXPECT_EQ(calculator->memory, 42);
+                io.stop();
+              });
+            });
+          });
+        });
+  });
+
+  io.run();
+}
+
+TEST(SkeletonTest, PeersCannotBreakTypedProperties) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+
+  dbus::DbusObjectServer server(bus);
+  auto object = server.add_object("/com/example/calculator");
+  auto calculator = std::make_shared<AbacusCalculator>(bus);
+  object->register_interface(calculator);
+
+  dbus::endpoint set(bus->get_unique_name(), "/com/example/calculator",
+                     "org.freedesktop.DBus.Properties", "Set");
+  auto set_call = [&](const std::string& property, dbus::dbus_variant value) {
+    auto m = dbus::message::new_call(set);
+    m.pack("com.example.Calculator", property, value);
+    return m;
+  };
+  int outstanding = 3;
+  auto done = [&]() {
+    if (--outstanding == 0) {
+      io.stop();
+    }
+  };
+
+  auto read_only = set_call("Count", (uint32_t)5);
+  bus->async_send(read_only, [&](boost::system::error_code ec,
+                                 dbus::message r) {
+    EXPECT_TRUE(ec);
+    EXPECT_TRUE(dbus_message_is_error(r, DBUS_ERROR_PROPERTY_READ_ONLY));
+    done();
+  });
+  auto wrong_type = set_call("Label", (uint32_t)5);
+  bus->async_send(wrong_type, [&](boost::system::error_code ec,
+                                  dbus::message r) {
+    EXPECT_TRUE(ec);
+    EXPECT_TRUE(dbus_message_is_error(r, DBUS_ERROR_INVALID_ARGS));
+    done();
+  });
+  auto writable = set_call("Label", std::string("abacus"));
+  bus->async_send(writable, [&](boost::system::error_code ec,
+                                dbus::message r) {
+    EXPECT_FALSE(ec);
+    done();
+  });
+
+  io.run();
+  EXPECT_EQ(outstanding, 0);
+  EXPECT_EQ(calculator->get_count(), 0);
+  EXPECT_EQ(calculator->get_label(), "abacus");
+}
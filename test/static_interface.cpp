@@ -0,0 +1,126 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include <dbus/connection.hpp>
+#include <dbus/properties.hpp>
+#include <dbus/static_interface.hpp>
+#include <gtest/gtest.h>
+
+struct Calculator : dbus::StaticDbusInterface<Calculator> {
+  Calculator(std::shared_ptr<dbus::connection>& conn)
+      : StaticDbusInterface(conn) {}
+
+  static constexpr const char* name() { return "com.example.Calculator"; }
+
+  static constexpr auto methods() {
+    return std::make_tuple(
+        dbus::method("Add", &Calculator::add, "a,b", "sum"),
+        dbus::method("Divide", &Calculator::divide, "a,b"),
+        dbus::method("Reset", &Calculator::reset));
+  }
+
+  static constexpr auto signals() {
+    return std::make_tuple(dbus::signal<uint32_t>("Overflow", "count"));
+  }
+
+  static constexpr auto properties() {
+    return std::make_tuple(dbus::property<uint32_t>("Count"),
+                           dbus::property<std::string>(
+                               "Label", dbus::PropertyAccess::READWRITE));
+  }
+
+  int32_t add(int32_t a, int32_t b) {
+    set<0>(++count);
+    return a + b;
+  }
+
+  std::tuple<int32_t, int32_t> divide(int32_t a, int32_t b) const {
+    return std::make_tuple(a / b, a % b);
+  }
+
+  void reset() { count = 0; }
+
+  uint32_t count = 0;
+};
+
+TEST(StaticDbusInterfaceTest, IntrospectionIsGeneratedAtCompileTime) {
+  constexpr auto xml = dbus::detail::introspection_xml<Calculator>();
+  EXPECT_EQ(
+      std::string(xml.data, xml.size),
+      "<interface name=\"com.example.Calculator\">"
+      "<method name=\"Add\">"
+      "<arg name=\"a\" type=\"i\" direction=\"in\"/>"
+      "<arg name=\"b\" type=\"i\" direction=\"in\"/>"
+      "<arg name=\"sum\" type=\"i\" direction=\"out\"/>"
+      "</method>"
+      "<method name=\"Divide\">"
+      "<arg name=\"a\" type=\"i\" direction=\"in\"/>"
+      "<arg name=\"b\" type=\"i\" direction=\"in\"/>"
+      "<arg name=\"out_0\" type=\"i\" direction=\"out\"/>"
+      "<arg name=\"out_1\" type=\"i\" direction=\"out\"/>"
+      "</method>"
+      "<method name=\"Reset\"></method>"
+      "<signal name=\"Overflow\"><arg name=\"count\" type=\"u\"/></signal>"
+      "<property name=\"Count\" type=\"u\" access=\"read\"/>"
+      "<property name=\"Label\" type=\"s\" access=\"readwrite\"/>"
+      "</interface>");
+}
+
+TEST(StaticDbusInterfaceTest, MethodCall) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+
+  dbus::DbusObjectServer server(bus);
+  auto object = server.add_object("/com/example/calculator");
+  auto calculator = std::make_shared<Calculator>(bus);
+  object->register_interface(calculator);
+
+  int outstanding = 2;
+  dbus::endpoint add(bus->get_unique_name(), "/com/example/calculator",
+                     "com.example.Calculator", "Add");
+  bus->async_method_call(
+      [&](const boost::system::error_code ec, int32_t sum) {
+        EXPECT_FALSE(ec);
+        EXPECT_EQ(sum, 5);
+        EXPECT_EQ(calculator->count, 1);
+        EXPECT_EQ(calculator->get_property("Count"),
+                  dbus::dbus_variant((uint32_t)1));
+        if (--outstanding == 0) {
+          io.stop();
+        }
+      },
+      add, (int32_t)2, (int32_t)3);
+
+  dbus::endpoint divide(bus->get_unique_name(), "/com/example/calculator",
+                        "com.example.Calculator", "Divide");
+  bus->async_method_call(
+      [&](const boost::system::error_code ec, int32_t quotient,
+          int32_t remainder) {
+        EXPECT_FALSE(ec);
+        EXPECT_EQ(quotient, 3);
+        EXPECT_EQ(remainder, 1);
+        if (--outstanding == 0) {
+          io.stop();
+        }
+      },
+      divide, (int32_t)7, (int32_t)2);
+
+  io.run();
+}
+
+TEST(StaticDbusInterfaceTest, PropertiesStartValueInitialized) {
+  boost::asio::io_service io;
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  Calculator calculator(bus);
+  EXPECT_EQ(calculator.get<0>(), 0);
+  EXPECT_EQ(calculator.get<1>(), "");
+  calculator.initialize<1>("total");
+  EXPECT_EQ(calculator.get<1>(), "total");
+}
@@ -0,0 +1,114 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include <dbus/connection.hpp>
+#include <dbus/filter.hpp>
+#include <dbus/properties.hpp>
+#include <dbus/trace.hpp>
+#include <algorithm>
+#include <vector>
+#include <gtest/gtest.h>
+
+namespace {
+std::vector<dbus::trace::event> events;
+
+void record(const dbus::trace::event& e) { events.push_back(e); }
+
+const dbus::trace::event* find(dbus::trace::point where, dbus::uint32 serial,
+                               dbus::uint32 reply_serial) {
+  for (auto& e : events) {
+    if (e.where == where && (serial == 0 || e.serial == serial) &&
+        (reply_serial == 0 || e.reply_serial == reply_serial)) {
+      return &e;
+    }
+  }
+  return nullptr;
+}
+}  // namespace
+
+TEST(TraceTest, FollowsOneCallEndToEnd) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  dbus::DbusObjectServer server(bus);
+  server.add_object("/org/boost/test")
+      ->add_interface("org.boost.Echo")
+      ->register_method("Echo", [](uint32_t x) { return x; });
+
+  events.clear();
+  dbus::trace::set_hook(&record);
+  dbus::endpoint echo(bus->get_unique_name(), "/org/boost/test",
+                      "org.boost.Echo", "Echo");
+  auto m = dbus::message::new_call(echo);
+  m.pack((uint32_t)3);
+  bus->async_send(m, [&](boost::system::error_code ec, dbus::message r) {
+    EXPECT_FALSE(ec);
+    io.stop();
+  });
+  io.run();
+  dbus::trace::set_hook(nullptr);
+
+  dbus::uint32 serial = dbus_message_get_serial(m);
+  ASSERT_NE(serial, 0);
+  const dbus::trace::event* async_send =
+      find(dbus::trace::point::async_send, 0, 0);
+  const dbus::trace::event* sent = find(dbus::trace::point::sent, serial, 0);
+  const dbus::trace::event* received =
+      find(dbus::trace::point::reply_received, 0, serial);
+  const dbus::trace::event* handled =
+      find(dbus::trace::point::reply_handler, 0, serial);
+  ASSERT_NE(async_send, nullptr);
+  ASSERT_NE(sent, nullptr);
+  ASSERT_NE(received, nullptr);
+  ASSERT_NE(handled, nullptr);
+  // The message is identified before it has a serial
+  EXPECT_EQ(async_send->value, sent->value);
+  EXPECT_LE(async_send->time, sent->time);
+  EXPECT_LE(sent->time, received->time);
+  EXPECT_LE(received->time, handled->time);
+  EXPECT_NE(find(dbus::trace::point::dispatch_end, 0, 0), nullptr);
+}
+
+TEST(TraceTest, FilterQueueIsTraced) {
+  boost::asio::io_service io;
+  boost::asio::deadline_timer t(io, boost::posix_time::seconds(10));
+  t.async_wait([&](const boost::system::error_code&) {
+    io.stop();
+    FAIL() << "Callback was never called\n";
+  });
+  auto bus = std::make_shared<dbus::connection>(io, dbus::bus::session);
+  dbus::filter f(bus, [](dbus::message& m) {
+    return m.get_member() == "Traced";
+  });
+
+  events.clear();
+  dbus::trace::set_hook(&record);
+  dbus::endpoint self(bus->get_unique_name(), "/org/boost/test",
+                      "org.boost.Test");
+  auto s = dbus::message::new_signal(self, "Traced");
+  s.set_destination(bus->get_unique_name());
+  bus->send(s, std::chrono::seconds(0));
+  f.async_dispatch([&](boost::system::error_code ec, dbus::message m) {
+    EXPECT_FALSE(ec);
+    io.stop();
+  });
+  io.run();
+  dbus::trace::set_hook(nullptr);
+
+  // Serials are only unique per sender, so the bus's own messages may share
+  // this one; only ours matched the filter
+  dbus::uint32 serial = dbus_message_get_serial(s);
+  EXPECT_TRUE(std::any_of(
+      events.begin(), events.end(), [&](const dbus::trace::event& e) {
+        return e.where == dbus::trace::point::filter_offer &&
+               e.serial == serial && e.value == 1;
+      }));
+  EXPECT_NE(find(dbus::trace::point::queue_push, serial, 0), nullptr);
+  EXPECT_NE(find(dbus::trace::point::queue_pop, serial, 0), nullptr);
+}
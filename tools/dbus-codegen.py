@@ -0,0 +1,501 @@
+#!/usr/bin/env python3
+# Copyright (c) Benjamin Kietzman (github.com/bkietz)
+#
+# Distributed under the Boost Software License, Version 1.0. (See accompanying
+# file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+"""Generate typed C++ bindings from D-Bus introspection XML.
+
+    dbus-codegen.py --proxy|--skeleton [--namespace ns] -o out.hpp iface.xml
+
+--proxy writes one dbus::proxy subclass per interface, with an async_ call
+per method, an on_ subscription per signal and async_get_/async_set_ calls
+per property.  Signatures are resolved here, once, rather than on every
+message.
+
+--skeleton writes one abstract dbus::StaticDbusInterface per interface, with
+a pure virtual handle_ call per method, an emit_ call per signal and typed
+get_/set_ accessors per property.
+"""
+
+import argparse
+import os
+import re
+import sys
+import textwrap
+import xml.etree.ElementTree as ET
+
+BASIC_TYPES = {
+    'y': 'dbus::byte',
+    'b': 'bool',
+    'n': 'dbus::int16',
+    'q': 'dbus::uint16',
+    'i': 'dbus::int32',
+    'u': 'dbus::uint32',
+    'x': 'dbus::int64',
+    't': 'dbus::uint64',
+    'd': 'double',
+    's': 'std::string',
+    'o': 'dbus::object_path',
+    'g': 'dbus::signature',
+}
+
+# Types that can travel inside a dbus::dbus_variant, and so can be properties.
+VARIANT_TYPES = set('ybnqiuxtds')
+
+# Types cheap enough to pass by value
+NUMERIC_TYPES = set('ybnqiuxtd')
+
+CPP_KEYWORDS = set('''
+    alignas alignof and and_eq asm auto bitand bitor bool break case catch char
+    char16_t char32_t class compl const constexpr const_cast continue decltype
+    default delete do double dynamic_cast else enum explicit export extern
+    false float for friend goto if inline int long mutable namespace new
+    noexcept not not_eq nullptr operator or or_eq private protected public
+    register reinterpret_cast return short signed sizeof static static_assert
+    static_cast struct switch template this thread_local throw true try typedef
+    typeid typename union unsigned using virtual void volatile wchar_t while
+    xor xor_eq'''.split())
+
+
+class Unsupported(Exception):
+  pass
+
+
+def parse_type(sig, pos):
+  """Return (c++ type, next position) for the complete type at sig[pos]."""
+  code = sig[pos]
+  if code in BASIC_TYPES:
+    return BASIC_TYPES[code], pos + 1
+  if code == 'v':
+    return 'dbus::dbus_variant', pos + 1
+  if code == 'a':
+    if sig[pos + 1] == '{':
+      key, pos = parse_type(sig, pos + 2)
+      value, pos = parse_type(sig, pos)
+      if sig[pos] != '}':
+        raise Unsupported(sig)
+      return 'std::vector<std::pair<%s, %s>>' % (key, value), pos + 1
+    element, pos = parse_type(sig, pos + 1)
+    return 'std::vector<%s>' % element, pos
+  # structs, unix fds and maybe types have no mapping in dbus::message
+  raise Unsupported(sig)
+
+
+def cpp_type(sig):
+  try:
+    t, end = parse_type(sig or '', 0)
+  except IndexError:
+    raise Unsupported(sig)
+  if end != len(sig):
+    raise Unsupported(sig)
+  return t
+
+
+def snake_case(name):
+  name = re.sub(r'([A-Z]+)([A-Z][a-z])', r'\1_\2', name)
+  name = re.sub(r'([a-z0-9])([A-Z])', r'\1_\2', name)
+  return name.lower()
+
+
+def identifier(name, fallback):
+  name = re.sub(r'\W', '_', name or '')
+  if not name or name[0].isdigit():
+    return fallback
+  return name + '_' if name in CPP_KEYWORDS else name
+
+
+class Arg(object):
+
+  def __init__(self, node, index):
+    self.signature = node.get('type')
+    self.direction = node.get('direction')
+    self.xml_name = node.get('name') or ''
+    self.name = identifier(self.xml_name, 'arg%d' % index)
+    self.type = cpp_type(self.signature)
+
+  def param(self):
+    if self.signature in NUMERIC_TYPES:
+      return '%s %s' % (self.type, self.name)
+    return 'const %s& %s' % (self.type, self.name)
+
+
+class Member(object):
+
+  def __init__(self, node):
+    self.name = node.get('name')
+    self.args = [Arg(a, i) for i, a in enumerate(node.findall('arg'))]
+
+  def inputs(self):
+    return [a for a in self.args if a.direction in (None, 'in')]
+
+  def outputs(self):
+    return [a for a in self.args if a.direction == 'out']
+
+
+class Property(object):
+
+  def __init__(self, node):
+    self.name = node.get('name')
+    self.signature = node.get('type')
+    self.access = node.get('access', 'read')
+    self.type = cpp_type(self.signature)
+
+  def in_variant(self):
+    return self.signature in VARIANT_TYPES
+
+
+class Interface(object):
+
+  def __init__(self, node):
+    self.name = node.get('name')
+    self.methods, self.signals, self.properties = [], [], []
+    self.skipped = []
+    for kind, cls, out in (('method', Member, self.methods),
+                           ('signal', Member, self.signals),
+                           ('property', Property, self.properties)):
+      for child in node.findall(kind):
+        try:
+          out.append(cls(child))
+        except Unsupported as e:
+          self.skipped.append((kind, child.get('name'), str(e)))
+
+  def class_name(self, suffix):
+    return self.name.split('.')[-1] + suffix
+
+  def namespace(self, override):
+    if override is not None:
+      return [n for n in override.split('::') if n]
+    return self.name.split('.')[:-1]
+
+
+def join_signature(args):
+  return ''.join(a.signature for a in args)
+
+
+def describe(member):
+  return '%s(%s)' % (member.name, ', '.join(
+      ' '.join(filter(None, (a.direction, a.signature, a.name)))
+      for a in member.args))
+
+
+WIDTH = 80
+
+
+class Writer(object):
+
+  def __init__(self):
+    self.lines = []
+
+  def __call__(self, line=''):
+    self.lines.append(line)
+
+  def text(self):
+    return '\n'.join(self.lines) + '\n'
+
+  def wrap(self, head, args, tail, indent):
+    """Write head, then args separated by commas, then tail.
+
+    Arguments that don't fit within WIDTH continue aligned after head, or
+    if that still overflows, on lines indented four past indent.
+    """
+    if not args:
+      self(head + tail)
+      return
+    items = [a + ',' for a in args[:-1]] + [args[-1] + tail]
+    for first, col in ((head, len(head)), (' ' * (indent + 4), indent + 4)):
+      lines, line, fresh = [], first, True
+      for item in items:
+        joined = line + ('' if fresh else ' ') + item
+        if fresh or len(joined) <= WIDTH:
+          line, fresh = joined, False
+        else:
+          lines.append(line)
+          line = ' ' * col + item
+      lines.append(line)
+      if all(len(l) <= WIDTH for l in lines):
+        break
+    if first != head:
+      self(head.rstrip())
+    for l in lines:
+      self(l)
+
+  def comment(self, prefix, text):
+    """Write text as comment lines starting with prefix."""
+    for l in textwrap.wrap(text, WIDTH - len(prefix), break_long_words=False,
+                           break_on_hyphens=False):
+      self(prefix + l)
+
+  def class_head(self, name, base):
+    line = 'class %s : public %s {' % (name, base)
+    if len(line) <= WIDTH:
+      self(line)
+    else:
+      self('class %s' % name)
+      self('    : public %s {' % base)
+
+  def inline_function(self, signature, body):
+    """Write a one-statement member function, on one line if it fits."""
+    line = '  %s { %s }' % (signature, body)
+    if len(line) <= WIDTH:
+      self(line)
+    else:
+      self('  %s {' % signature)
+      self('    %s' % body)
+      self('  }')
+
+
+def write_proxy(w, iface):
+  cls = iface.class_name('Proxy')
+  w('/// Client proxy for %s.' % iface.name)
+  w.class_head(cls, 'dbus::proxy')
+  w(' public:')
+  w('  static constexpr const char* interface_name() {')
+  w('    return "%s";' % iface.name)
+  w('  }')
+  w()
+  w.wrap('  %s(' % cls, ['dbus::connection_ptr connection',
+                         'const std::string& destination',
+                         'const std::string& path'], ')', 2)
+  init = ['dbus::proxy(connection, destination, path, interface_name())']
+  init += ['%s_call_(new_call("%s"))' % (snake_case(m.name), m.name)
+           for m in iface.methods]
+  w('      : ' + ',\n        '.join(init) + ' {}')
+
+  for m in iface.methods:
+    ins, outs = m.inputs(), m.outputs()
+    w()
+    w.comment('  /// ', 'Call %s.' % describe(m))
+    w('  /**')
+    w.comment('   * ', 'The handler is called as '
+              'handler(boost::system::error_code%s).' %
+              ''.join(', %s %s' % (a.type, a.name) for a in outs))
+    w('   */')
+    w('  template <typename Handler>')
+    params = ['const %s& %s' % (a.type, a.name) for a in ins] + [
+        'Handler handler']
+    w.wrap('  void async_%s(' % snake_case(m.name), params, ') {', 2)
+    w.wrap('    async_call<%s>(' % ', '.join(a.type for a in outs),
+           ['%s_call_' % snake_case(m.name),
+            '"%s"' % join_signature(outs), 'std::move(handler)'] +
+           [a.name for a in ins], ');', 4)
+    w('  }')
+
+  for s in iface.signals:
+    w()
+    w.comment('  /// ', 'Subscribe to %s.' % describe(s))
+    w('  /**')
+    w.comment('   * ', 'The handler is called as handler(%s).' %
+              ', '.join('%s %s' % (a.type, a.name) for a in s.args))
+    w('   */')
+    w('  template <typename Handler>')
+    w.wrap('  std::unique_ptr<dbus::signal_subscription> on_%s(' %
+           snake_case(s.name), ['Handler handler'], ') {', 2)
+    w.wrap('    return subscribe<%s>(' % ', '.join(a.type for a in s.args),
+           ['"%s"' % s.name, '"%s"' % join_signature(s.args),
+            'std::move(handler)'], ');', 4)
+    w('  }')
+
+  for p in iface.properties:
+    if not p.in_variant():
+      iface.skipped.append(('property', p.name, p.signature))
+      continue
+    if 'read' in p.access:
+      w()
+      w('  /// Read the %s property (%s).' % (p.name, p.signature))
+      w('  template <typename Handler>')
+      w.wrap('  void async_get_%s(' % snake_case(p.name),
+             ['Handler handler'], ') {', 2)
+      w.wrap('    async_get_property<%s>(' % p.type,
+             ['"%s"' % p.name, 'std::move(handler)'], ');', 4)
+      w('  }')
+    if 'write' in p.access:
+      w()
+      w('  /// Write the %s property (%s).' % (p.name, p.signature))
+      w('  template <typename Handler>')
+      w.wrap('  void async_set_%s(' % snake_case(p.name),
+             ['const %s& value' % p.type, 'Handler handler'], ') {', 2)
+      w.wrap('    async_set_property(',
+             ['"%s"' % p.name, 'value', 'std::move(handler)'], ');', 4)
+      w('  }')
+
+  if iface.methods:
+    w()
+    w(' private:')
+    for m in iface.methods:
+      w('  dbus::message %s_call_;' % snake_case(m.name))
+  w('};')
+
+
+def return_type(outs):
+  if not outs:
+    return 'void'
+  if len(outs) == 1:
+    return outs[0].type
+  return 'std::tuple<%s>' % ', '.join(a.type for a in outs)
+
+
+def names(args):
+  return ','.join(a.xml_name for a in args)
+
+
+def access(p):
+  return {'read': 'READ', 'write': 'WRITE'}.get(p.access, 'READWRITE')
+
+
+def handler_name(m):
+  # Prefixed so that methods such as Get or Emit can't hide the accessors
+  # StaticDbusInterface gives the skeleton
+  return 'handle_' + snake_case(m.name)
+
+
+def write_tuple(w, entries):
+  """Write the body of a constexpr function returning a tuple of entries.
+
+  Each entry is a (head, args) pair, written as head(args...).
+  """
+  w('    return std::make_tuple(')
+  for i, (head, args) in enumerate(entries):
+    w.wrap('        %s(' % head, args,
+           '));' if i == len(entries) - 1 else '),', 8)
+
+
+def write_skeleton(w, iface):
+  cls = iface.class_name('Skeleton')
+  properties = [p for p in iface.properties if p.in_variant()]
+  iface.skipped += [('property', p.name, p.signature)
+                    for p in iface.properties if not p.in_variant()]
+
+  w('/// Server skeleton for %s.' % iface.name)
+  w('/**')
+  w(' * Derive from this, implement the pure virtual methods and register an')
+  w(' * instance with a dbus::DbusObject.  Method dispatch and introspection')
+  w(' * data are fixed at compile time.')
+  w(' */')
+  w.class_head(cls, 'dbus::StaticDbusInterface<%s>' % cls)
+  w(' public:')
+  w.inline_function('static constexpr const char* name()',
+                    'return "%s";' % iface.name)
+
+  if iface.methods:
+    w()
+    w('  static constexpr auto methods() {')
+    write_tuple(w, [('dbus::method',
+                     ['"%s"' % m.name, '&%s::%s' % (cls, handler_name(m)),
+                      '"%s"' % names(m.inputs()), '"%s"' % names(m.outputs())])
+                    for m in iface.methods])
+    w('  }')
+  if iface.signals:
+    w()
+    w('  static constexpr auto signals() {')
+    write_tuple(w, [('dbus::signal<%s>' % ', '.join(a.type for a in s.args),
+                     ['"%s"' % s.name, '"%s"' % names(s.args)])
+                    for s in iface.signals])
+    w('  }')
+  if properties:
+    w()
+    w('  static constexpr auto properties() {')
+    write_tuple(w, [('dbus::property<%s>' % p.type,
+                     ['"%s"' % p.name, 'dbus::PropertyAccess::' + access(p)])
+                    for p in properties])
+    w('  }')
+
+  # After properties(), whose deduced type the initializers need
+  w()
+  w('  explicit %s(std::shared_ptr<dbus::connection>& conn)' % cls)
+  w('      : StaticDbusInterface(conn) {')
+  for i, p in enumerate(properties):
+    w.wrap('    initialize<%d>(' % i, ['%s()' % p.type], ');', 4)
+  w('  }')
+
+  for m in iface.methods:
+    w()
+    w.comment('  /// ', 'Handle %s.' % describe(m))
+    w.wrap('  virtual %s %s(' % (return_type(m.outputs()), handler_name(m)),
+           [a.param() for a in m.inputs()], ') = 0;', 2)
+
+  for i, s in enumerate(iface.signals):
+    w()
+    w.comment('  /// ', 'Emit %s.' % describe(s))
+    w.wrap('  void emit_%s(' % snake_case(s.name),
+           [a.param() for a in s.args], ') {', 2)
+    w.wrap('    emit<%d>(' % i, [a.name for a in s.args], ');', 4)
+    w('  }')
+
+  for i, p in enumerate(properties):
+    w()
+    w('  /// The %s property (%s).' % (p.name, p.signature))
+    w.inline_function('const %s& get_%s() const' % (p.type, snake_case(p.name)),
+                      'return get<%d>();' % i)
+    w()
+    w.wrap('  void set_%s(' % snake_case(p.name),
+           ['const %s& value' % p.type,
+            'dbus::UpdateType update_mode = '
+            'dbus::UpdateType::VALUE_CHANGE_ONLY'], ') {', 2)
+    w('    set<%d>(value, update_mode);' % i)
+    w('  }')
+  w('};')
+
+
+def generate(interfaces, source, output, namespace, header, writer):
+  guard = re.sub(r'\W', '_', os.path.basename(output)).upper()
+  w = Writer()
+  w('// Generated by dbus-codegen.py from %s.  Do not edit.' %
+    os.path.basename(source))
+  w()
+  w('#ifndef %s' % guard)
+  w('#define %s' % guard)
+  w()
+  w('#include <%s>' % header)
+  w('#include <memory>')
+  w('#include <string>')
+  w('#include <tuple>')
+  w('#include <utility>')
+  w('#include <vector>')
+  for iface in interfaces:
+    ns = iface.namespace(namespace)
+    w()
+    for n in ns:
+      w('namespace %s {' % n)
+    if ns:
+      w()
+    writer(w, iface)
+    for kind, name, sig in iface.skipped:
+      sys.stderr.write('%s: skipped %s %s.%s: unsupported signature %s\n' %
+                       (source, kind, iface.name, name, sig))
+    if ns:
+      w()
+    for n in reversed(ns):
+      w('}  // namespace %s' % n)
+  w()
+  w('#endif  // %s' % guard)
+  return w.text()
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+  mode = parser.add_mutually_exclusive_group(required=True)
+  mode.add_argument('--proxy', action='store_true',
+                    help='generate client proxies')
+  mode.add_argument('--skeleton', action='store_true',
+                    help='generate server skeletons')
+  parser.add_argument('--namespace', default=None,
+                      help='C++ namespace, defaults to the interface prefix')
+  parser.add_argument('-o', '--output', required=True)
+  parser.add_argument('xml')
+  args = parser.parse_args()
+
+  root = ET.parse(args.xml).getroot()
+  interfaces = [Interface(n) for n in root.iter('interface')]
+  if args.proxy:
+    header, writer = 'dbus/proxy.hpp', write_proxy
+  else:
+    header, writer = 'dbus/static_interface.hpp', write_skeleton
+  text = generate(interfaces, args.xml, args.output, args.namespace, header,
+                  writer)
+  with open(args.output, 'w') as f:
+    f.write(text)
+
+
+if __name__ == '__main__':
+  main()